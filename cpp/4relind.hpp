@@ -0,0 +1,457 @@
+/*
+ * 4relind.hpp:
+ *	C++20 interface of lib4relind ("make lib4relind.a"), header only.
+ *	Stack levels, buses, relays and inputs are distinct types: a constant
+ *	index is checked when compiling (Relay(5) does not build), a run time
+ *	index goes through make() and comes back as std::optional. Boards and
+ *	buses are RAII handles over the devices opened by the C library. Every
+ *	call is inline and maps to a single C call, "make cpp" builds
+ *	cpp/4relind-bench that measures the difference.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#ifndef RELIND_HPP_
+#define RELIND_HPP_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "relay.h"
+
+namespace relind
+{
+
+/*
+ * Index:
+ *	Integer in [Min, Max], Tag keeps the kinds of index apart
+ *********************************************************************************
+ */
+template <int Min, int Max, class Tag>
+class Index
+{
+public:
+	static constexpr int min = Min;
+	static constexpr int max = Max;
+
+	consteval Index(int v) : mV(check(v))
+	{
+	}
+
+	static constexpr std::optional<Index> make(int v) noexcept
+	{
+		if (v < Min || v > Max)
+		{
+			return std::nullopt;
+		}
+		return Index(v, Unchecked{});
+	}
+
+	constexpr int value() const noexcept
+	{
+		return mV;
+	}
+
+	constexpr auto operator<=>(const Index&) const = default;
+
+private:
+	struct Unchecked
+	{
+	};
+
+	constexpr Index(int v, Unchecked) noexcept : mV(v)
+	{
+	}
+
+	static consteval int check(int v)
+	{
+		if (v < Min || v > Max)
+		{
+			throw "index out of range"; // not a constant expression: compile error
+		}
+		return v;
+	}
+
+	int mV;
+};
+
+struct RelayTag;
+struct InputTag;
+struct StackTag;
+struct BusTag;
+
+using Relay = Index<CHANNEL_NR_MIN, RELAY_CH_NR_MAX, RelayTag>;
+using Input = Index<CHANNEL_NR_MIN, IN_CH_NR_MAX, InputTag>;
+using Stack = Index<0, STACK_NR_MAX - 1, StackTag>;
+using BusNr = Index<0, I2C_BUS_NR_MAX - 1, BusTag>;
+
+/*
+ * Mask:
+ *	Bitmap of the channels of one kind, bit 0 = channel 1
+ *********************************************************************************
+ */
+template <class Ch>
+class Mask
+{
+public:
+	static constexpr u8 all = (1 << Ch::max) - 1;
+
+	constexpr Mask() noexcept = default;
+
+	constexpr explicit Mask(unsigned bits) noexcept : mBits(bits & all)
+	{
+	}
+
+	constexpr Mask(std::initializer_list<Ch> chs) noexcept
+	{
+		for (Ch ch : chs)
+		{
+			mBits |= bit(ch);
+		}
+	}
+
+	constexpr u8 bits() const noexcept
+	{
+		return mBits;
+	}
+
+	constexpr bool test(Ch ch) const noexcept
+	{
+		return (mBits & bit(ch)) != 0;
+	}
+
+	constexpr Mask with(Ch ch, bool on = true) const noexcept
+	{
+		return Mask(on ? (mBits | bit(ch)) : (mBits & ~bit(ch)));
+	}
+
+	constexpr Mask without(Ch ch) const noexcept
+	{
+		return with(ch, false);
+	}
+
+	constexpr int count() const noexcept
+	{
+		return __builtin_popcount(mBits);
+	}
+
+	constexpr Mask operator|(Mask o) const noexcept
+	{
+		return Mask(mBits | o.mBits);
+	}
+
+	constexpr Mask operator&(Mask o) const noexcept
+	{
+		return Mask(mBits & o.mBits);
+	}
+
+	constexpr Mask operator^(Mask o) const noexcept
+	{
+		return Mask(mBits ^ o.mBits);
+	}
+
+	constexpr Mask operator~() const noexcept
+	{
+		return Mask(~mBits);
+	}
+
+	constexpr bool operator==(const Mask&) const = default;
+
+private:
+	static constexpr u8 bit(Ch ch) noexcept
+	{
+		return 1 << (ch.value() - 1);
+	}
+
+	u8 mBits = 0;
+};
+
+using RelayMask = Mask<Relay>;
+using InputMask = Mask<Input>;
+
+/*
+ * BoardId:
+ *	Board of the library (BOARD_ID()), stack level on a bus
+ *********************************************************************************
+ */
+class BoardId
+{
+public:
+	constexpr BoardId(Stack stack, BusNr bus = BusNr(I2C_BUS_DEFAULT)) noexcept
+		: mId(BOARD_ID(bus.value(), stack.value()))
+	{
+	}
+
+	// "<stack>" or "<bus>.<stack>" as on the command line
+	static std::optional<BoardId> parse(const char* str) noexcept
+	{
+		int id = boardIdParse(str);
+
+		if (id < 0)
+		{
+			return std::nullopt;
+		}
+		return BoardId(id);
+	}
+
+	constexpr int value() const noexcept
+	{
+		return mId;
+	}
+
+	constexpr Stack stack() const noexcept
+	{
+		return *Stack::make(BOARD_STACK(mId));
+	}
+
+	constexpr BusNr bus() const noexcept
+	{
+		return *BusNr::make(BOARD_BUS(mId));
+	}
+
+	const char* str() const noexcept
+	{
+		return boardIdStr(mId);
+	}
+
+	constexpr auto operator<=>(const BoardId&) const = default;
+
+private:
+	constexpr explicit BoardId(int id) noexcept : mId(id)
+	{
+	}
+
+	int mId;
+};
+
+struct State
+{
+	RelayMask relays;
+	InputMask inputs;
+	bool ok = false;	// false if the board did not answer
+	uint64_t timeMs = 0;
+};
+
+inline State stateOf(const BoardSnapshotType& snap) noexcept
+{
+	return State{RelayMask(snap.relays), InputMask(snap.inputs), snap.ok != 0, snap.timeMs};
+}
+
+/*
+ * Board:
+ *	One configured board, the device is closed with the handle
+ *********************************************************************************
+ */
+class Board
+{
+public:
+	static std::optional<Board> open(BoardId id) noexcept
+	{
+		int dev = doBoardInit(id.value());
+
+		if (dev < 0)
+		{
+			return std::nullopt;
+		}
+		return Board(id, dev);
+	}
+
+	Board(const Board&) = delete;
+	Board& operator=(const Board&) = delete;
+
+	Board(Board&& o) noexcept : mId(o.mId), mDev(std::exchange(o.mDev, -1))
+	{
+	}
+
+	Board& operator=(Board&& o) noexcept
+	{
+		std::swap(mId, o.mId);
+		std::swap(mDev, o.mDev);
+		return *this;
+	}
+
+	~Board()
+	{
+		if (mDev >= 0)
+		{
+			boardClose(mDev);
+		}
+	}
+
+	BoardId id() const noexcept
+	{
+		return mId;
+	}
+
+	// device for the C calls
+	int fd() const noexcept
+	{
+		return mDev;
+	}
+
+	bool set(Relay relay, bool on) noexcept
+	{
+		return OK == relayChSet(mDev, relay.value(), on ? ON : OFF);
+	}
+
+	bool write(RelayMask relays) noexcept
+	{
+		return OK == relaySet(mDev, relays.bits());
+	}
+
+	std::optional<bool> get(Relay relay) const noexcept
+	{
+		OutStateEnumType state = OFF;
+
+		if (OK != relayChGet(mDev, relay.value(), &state))
+		{
+			return std::nullopt;
+		}
+		return state == ON;
+	}
+
+	std::optional<bool> get(Input input) const noexcept
+	{
+		OutStateEnumType state = OFF;
+
+		if (OK != inChGet(mDev, input.value(), &state))
+		{
+			return std::nullopt;
+		}
+		return state == ON;
+	}
+
+	std::optional<RelayMask> relays() const noexcept
+	{
+		int val = 0;
+
+		if (OK != relayGet(mDev, &val))
+		{
+			return std::nullopt;
+		}
+		return RelayMask(val);
+	}
+
+	std::optional<InputMask> inputs() const noexcept
+	{
+		int val = 0;
+
+		if (OK != inGet(mDev, &val))
+		{
+			return std::nullopt;
+		}
+		return InputMask(val);
+	}
+
+	// relays and inputs with one read
+	State snapshot() const noexcept
+	{
+		BoardSnapshotType snap = {};
+
+		boardSnapshot(mDev, &snap);
+		return stateOf(snap);
+	}
+
+private:
+	Board(BoardId id, int dev) noexcept : mId(id), mDev(dev)
+	{
+	}
+
+	BoardId mId;
+	int mDev;
+};
+
+/*
+ * Bus:
+ *	The boards found on one bus, read and written with one batched transfer
+ *********************************************************************************
+ */
+class Bus
+{
+public:
+	static std::optional<Bus> open(BusNr bus)
+	{
+		int ids[BOARD_NR_MAX];
+		int cnt = boardListGet(ids);
+		Bus b;
+
+		for (int i = 0; i < cnt; i++)
+		{
+			if (BOARD_BUS(ids[i]) != bus.value())
+			{
+				continue;
+			}
+			std::optional<Board> board = Board::open(BoardId(*Stack::make(BOARD_STACK(ids[i])), bus));
+			if (!board)
+			{
+				continue;
+			}
+			b.mIds[b.mBoards.size()] = ids[i];
+			b.mBoards.push_back(std::move(*board));
+		}
+		if (b.mBoards.empty())
+		{
+			return std::nullopt;
+		}
+		return b;
+	}
+
+	std::span<Board> boards() noexcept
+	{
+		return mBoards;
+	}
+
+	// <out>[i] is the state of boards()[i], return the boards that answered
+	int snapshot(std::span<State> out) const noexcept
+	{
+		BoardSnapshotType snaps[STACK_NR_MAX];
+		int n = (int)std::min(out.size(), mBoards.size());
+		int cnt = 0;
+
+		if (n == 0)
+		{
+			return 0;
+		}
+		cnt = boardSnapshotAll(mIds.data(), snaps, n);
+		for (int i = 0; i < n; i++)
+		{
+			out[i] = stateOf(snaps[i]);
+		}
+		return cnt;
+	}
+
+	// relays[i] written to boards()[i], return the boards written
+	int write(std::span<const RelayMask> relays) noexcept
+	{
+		u8 vals[STACK_NR_MAX];
+		int ok[STACK_NR_MAX];
+		int n = (int)std::min(relays.size(), mBoards.size());
+
+		if (n == 0)
+		{
+			return 0;
+		}
+		for (int i = 0; i < n; i++)
+		{
+			vals[i] = relays[i].bits();
+		}
+		return boardRelaysWrite(mIds.data(), vals, ok, n);
+	}
+
+private:
+	Bus() = default;
+
+	std::vector<Board> mBoards;
+	std::array<int, STACK_NR_MAX> mIds = {};
+};
+
+} // namespace relind
+
+#endif //RELIND_HPP_
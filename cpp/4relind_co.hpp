@@ -0,0 +1,582 @@
+/*
+ * 4relind_co.hpp:
+ *	C++20 coroutines over 4relind.hpp, run by the epoll loop of the daemon
+ *	(src/evloop.c) on one thread:
+ *		co_await board.input(Input(3)).rising();	next 0 -> 1 edge
+ *		co_await after(250ms);
+ *		co_await board.apply(RelayMask{1, 2});		relays written
+ *	The awaiters live in the coroutine frame and are linked into the loop
+ *	lists, a wait allocates nothing. The boards used are sampled every
+ *	period with one batched read per bus, the applies made during one
+ *	turn of the loop go out with one batched write.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#ifndef RELIND_CO_HPP_
+#define RELIND_CO_HPP_
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <vector>
+
+#include "4relind.hpp"
+extern "C"
+{
+#include "evloop.h"
+#include "thread.h"
+}
+
+namespace relind::co
+{
+
+class Loop;
+
+struct Waiter
+{
+	std::coroutine_handle<> handle;
+	Waiter* next = nullptr;
+};
+
+/*
+ * Task:
+ *	Sequence started on the current loop, runs until its first wait at once
+ *	and frees itself at the end
+ *********************************************************************************
+ */
+struct Task
+{
+	struct promise_type
+	{
+		promise_type() noexcept;
+		~promise_type();
+
+		Task get_return_object() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never initial_suspend() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never final_suspend() noexcept
+		{
+			return {};
+		}
+
+		void return_void() noexcept
+		{
+		}
+
+		void unhandled_exception() noexcept
+		{
+			std::terminate();
+		}
+	};
+};
+
+enum class Edge
+{
+	Rising,
+	Falling,
+	Any,
+};
+
+class TimerAwaiter : public Waiter
+{
+public:
+	TimerAwaiter(Loop& loop, uint64_t dueMs) noexcept : mLoop(&loop), mDueMs(dueMs)
+	{
+	}
+
+	bool await_ready() const noexcept
+	{
+		return mDueMs <= timeMsGet();
+	}
+
+	void await_suspend(std::coroutine_handle<> h);
+
+	void await_resume() const noexcept
+	{
+	}
+
+	uint64_t dueMs() const noexcept
+	{
+		return mDueMs;
+	}
+
+private:
+	Loop* mLoop;
+	uint64_t mDueMs;
+};
+
+class EdgeAwaiter : public Waiter
+{
+public:
+	EdgeAwaiter(Loop& loop, int slot, Input input, Edge edge) noexcept
+		: mLoop(&loop), mSlot(slot), mInput(input), mEdge(edge)
+	{
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> h) noexcept;
+
+	// level of the input after the edge
+	bool await_resume() const noexcept
+	{
+		return mLevel;
+	}
+
+	// true (and the level recorded) if <prev> -> <cur> is the awaited edge
+	bool match(InputMask prev, InputMask cur) noexcept
+	{
+		if (prev.test(mInput) == cur.test(mInput))
+		{
+			return false;
+		}
+		mLevel = cur.test(mInput);
+		return mEdge == Edge::Any || mLevel == (mEdge == Edge::Rising);
+	}
+
+private:
+	Loop* mLoop;
+	int mSlot;
+	Input mInput;
+	Edge mEdge;
+	bool mLevel = false;
+};
+
+class ApplyAwaiter : public Waiter
+{
+public:
+	ApplyAwaiter(Loop& loop, int slot, RelayMask relays, RelayMask mask) noexcept
+		: mLoop(&loop), mSlot(slot), mRelays(relays), mMask(mask)
+	{
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> h) noexcept;
+
+	// false if the board did not take the write
+	bool await_resume() const noexcept
+	{
+		return mOk;
+	}
+
+private:
+	friend class Loop;
+
+	Loop* mLoop;
+	int mSlot;
+	RelayMask mRelays;
+	RelayMask mMask;
+	bool mOk = false;
+};
+
+class InputRef
+{
+public:
+	InputRef(Loop& loop, int slot, Input input) noexcept : mLoop(&loop), mSlot(slot), mInput(input)
+	{
+	}
+
+	EdgeAwaiter rising() const noexcept
+	{
+		return EdgeAwaiter(*mLoop, mSlot, mInput, Edge::Rising);
+	}
+
+	EdgeAwaiter falling() const noexcept
+	{
+		return EdgeAwaiter(*mLoop, mSlot, mInput, Edge::Falling);
+	}
+
+	EdgeAwaiter change() const noexcept
+	{
+		return EdgeAwaiter(*mLoop, mSlot, mInput, Edge::Any);
+	}
+
+	bool level() const noexcept;
+
+private:
+	Loop* mLoop;
+	int mSlot;
+	Input mInput;
+};
+
+class BoardRef
+{
+public:
+	BoardRef(Loop& loop, int slot) noexcept : mLoop(&loop), mSlot(slot)
+	{
+	}
+
+	InputRef input(Input input) const noexcept
+	{
+		return InputRef(*mLoop, mSlot, input);
+	}
+
+	// the relays of <mask> take their value from <relays>
+	ApplyAwaiter apply(RelayMask relays, RelayMask mask = RelayMask(RelayMask::all)) const noexcept
+	{
+		return ApplyAwaiter(*mLoop, mSlot, relays, mask);
+	}
+
+	// last sample
+	State state() const noexcept;
+
+private:
+	Loop* mLoop;
+	int mSlot;
+};
+
+/*
+ * Loop:
+ *	One per thread, runs the tasks started while it exists
+ *********************************************************************************
+ */
+class Loop
+{
+public:
+	explicit Loop(std::chrono::milliseconds period = std::chrono::milliseconds(20))
+		: mPeriodMs(period.count() > 0 ? period.count() : 1)
+	{
+		evInit();
+		mTimers.reserve(1024);
+		sCurrent = this;
+	}
+
+	Loop(const Loop&) = delete;
+	Loop& operator=(const Loop&) = delete;
+
+	~Loop()
+	{
+		if (sCurrent == this)
+		{
+			sCurrent = nullptr;
+		}
+	}
+
+	static Loop& current() noexcept
+	{
+		return *sCurrent;
+	}
+
+	// board used by the tasks, configured and sampled from now on
+	std::optional<BoardRef> board(BoardId id)
+	{
+		for (int i = 0; i < mCnt; i++)
+		{
+			if (mSlots[i].board->id() == id)
+			{
+				return BoardRef(*this, i);
+			}
+		}
+		if (mCnt == BOARD_NR_MAX)
+		{
+			return std::nullopt;
+		}
+		std::optional<Board> b = Board::open(id);
+		if (!b)
+		{
+			return std::nullopt;
+		}
+		Slot& s = mSlots[mCnt];
+		s.board = std::move(b);
+		s.state = s.board->snapshot();
+		mIds[mCnt] = id.value();
+		return BoardRef(*this, mCnt++);
+	}
+
+	// until all the tasks ended or stop()
+	void run()
+	{
+		uint64_t now = 0;
+		uint64_t next = 0;
+
+		mStop = false;
+		mNextSampleMs = timeMsGet();
+		while (!mStop && mTasks > 0)
+		{
+			runReady();
+			flushApply();
+			if (mReadyHead != nullptr)
+			{
+				continue;
+			}
+			now = timeMsGet();
+			if (now >= mNextSampleMs)
+			{
+				sample();
+				mNextSampleMs = now + mPeriodMs;
+			}
+			timersFire(now);
+			if (mReadyHead != nullptr)
+			{
+				continue;
+			}
+			next = mNextSampleMs;
+			if (!mTimers.empty() && mTimers.front()->dueMs() < next)
+			{
+				next = mTimers.front()->dueMs();
+			}
+			now = timeMsGet();
+			evRun(next > now ? (int)(next - now) : 0);
+		}
+	}
+
+	void stop() noexcept
+	{
+		mStop = true;
+	}
+
+	int tasks() const noexcept
+	{
+		return mTasks;
+	}
+
+	// batched writes made for the applies
+	uint64_t writes() const noexcept
+	{
+		return mWrites;
+	}
+
+private:
+	friend struct Task::promise_type;
+	friend class TimerAwaiter;
+	friend class EdgeAwaiter;
+	friend class ApplyAwaiter;
+	friend class InputRef;
+	friend class BoardRef;
+
+	struct Slot
+	{
+		std::optional<Board> board;
+		State state;
+		Waiter* edges = nullptr;	// EdgeAwaiter list
+		RelayMask pendRelays;	// applies waiting for the write
+		RelayMask pendMask;
+		bool wrOk = false;	// result of the last batched write
+	};
+
+	static bool timerLater(const TimerAwaiter* a, const TimerAwaiter* b) noexcept
+	{
+		return a->dueMs() > b->dueMs();
+	}
+
+	void ready(Waiter* w) noexcept
+	{
+		w->next = nullptr;
+		if (mReadyTail != nullptr)
+		{
+			mReadyTail->next = w;
+		}
+		else
+		{
+			mReadyHead = w;
+		}
+		mReadyTail = w;
+	}
+
+	void runReady()
+	{
+		Waiter* w = nullptr;
+
+		while ( (w = mReadyHead) != nullptr)
+		{
+			mReadyHead = w->next;
+			if (mReadyHead == nullptr)
+			{
+				mReadyTail = nullptr;
+			}
+			w->handle.resume();
+		}
+	}
+
+	void timerAdd(TimerAwaiter* t)
+	{
+		mTimers.push_back(t);
+		std::push_heap(mTimers.begin(), mTimers.end(), timerLater);
+	}
+
+	void timersFire(uint64_t now) noexcept
+	{
+		while (!mTimers.empty() && mTimers.front()->dueMs() <= now)
+		{
+			std::pop_heap(mTimers.begin(), mTimers.end(), timerLater);
+			ready(mTimers.back());
+			mTimers.pop_back();
+		}
+	}
+
+	void sample() noexcept
+	{
+		BoardSnapshotType snaps[BOARD_NR_MAX];
+		InputMask prev;
+		Waiter** link = nullptr;
+		EdgeAwaiter* e = nullptr;
+
+		if (mCnt == 0)
+		{
+			return;
+		}
+		boardSnapshotAll(mIds, snaps, mCnt);
+		for (int i = 0; i < mCnt; i++)
+		{
+			if (!snaps[i].ok)
+			{
+				mSlots[i].state.ok = false;
+				continue;
+			}
+			prev = mSlots[i].state.inputs;
+			mSlots[i].state = stateOf(snaps[i]);
+			if (prev == mSlots[i].state.inputs)
+			{
+				continue;
+			}
+			for (link = &mSlots[i].edges; *link != nullptr;)
+			{
+				e = static_cast<EdgeAwaiter*>(*link);
+				if (e->match(prev, mSlots[i].state.inputs))
+				{
+					*link = e->next;
+					ready(e);
+				}
+				else
+				{
+					link = &e->next;
+				}
+			}
+		}
+	}
+
+	void flushApply() noexcept
+	{
+		int ids[BOARD_NR_MAX];
+		u8 vals[BOARD_NR_MAX];
+		int ok[BOARD_NR_MAX];
+		int slots[BOARD_NR_MAX];
+		Waiter* w = nullptr;
+		ApplyAwaiter* a = nullptr;
+		Slot* s = nullptr;
+		int n = 0;
+
+		if (mApply == nullptr)
+		{
+			return;
+		}
+		for (int i = 0; i < mCnt; i++)
+		{
+			s = &mSlots[i];
+			if (s->pendMask.bits() == 0)
+			{
+				continue;
+			}
+			s->state.relays = (s->state.relays & ~s->pendMask) | (s->pendRelays & s->pendMask);
+			ids[n] = mIds[i];
+			vals[n] = s->state.relays.bits();
+			slots[n++] = i;
+			s->pendMask = RelayMask();
+		}
+		if (n > 0)
+		{
+			boardRelaysWrite(ids, vals, ok, n);
+			mWrites++;
+		}
+		for (int i = 0; i < n; i++)
+		{
+			mSlots[slots[i]].wrOk = ok[i] != 0;
+			mSlots[slots[i]].pendRelays = RelayMask();
+		}
+		while ( (w = mApply) != nullptr)
+		{
+			mApply = w->next;
+			a = static_cast<ApplyAwaiter*>(w);
+			a->mOk = mSlots[a->mSlot].wrOk;
+			ready(a);
+		}
+	}
+
+	static inline thread_local Loop* sCurrent = nullptr;
+
+	Slot mSlots[BOARD_NR_MAX];
+	int mIds[BOARD_NR_MAX] = {};
+	int mCnt = 0;
+	uint64_t mPeriodMs;
+	uint64_t mNextSampleMs = 0;
+	std::vector<TimerAwaiter*> mTimers;	// heap, earliest first
+	Waiter* mReadyHead = nullptr;
+	Waiter* mReadyTail = nullptr;
+	Waiter* mApply = nullptr;	// ApplyAwaiter list
+	int mTasks = 0;
+	bool mStop = false;
+	uint64_t mWrites = 0;
+};
+
+inline Task::promise_type::promise_type() noexcept
+{
+	Loop::current().mTasks++;
+}
+
+inline Task::promise_type::~promise_type()
+{
+	Loop::current().mTasks--;
+}
+
+inline void TimerAwaiter::await_suspend(std::coroutine_handle<> h)
+{
+	handle = h;
+	mLoop->timerAdd(this);
+}
+
+inline void EdgeAwaiter::await_suspend(std::coroutine_handle<> h) noexcept
+{
+	handle = h;
+	next = mLoop->mSlots[mSlot].edges;
+	mLoop->mSlots[mSlot].edges = this;
+}
+
+inline void ApplyAwaiter::await_suspend(std::coroutine_handle<> h) noexcept
+{
+	Loop::Slot& s = mLoop->mSlots[mSlot];
+
+	handle = h;
+	// a later apply of the same turn wins on the relays both set
+	s.pendRelays = (s.pendRelays & ~mMask) | (mRelays & mMask);
+	s.pendMask = s.pendMask | mMask;
+	next = mLoop->mApply;
+	mLoop->mApply = this;
+}
+
+inline bool InputRef::level() const noexcept
+{
+	return mLoop->mSlots[mSlot].state.inputs.test(mInput);
+}
+
+inline State BoardRef::state() const noexcept
+{
+	return mLoop->mSlots[mSlot].state;
+}
+
+// awaitable: resume after <d> on the current loop
+template <class Rep, class Period>
+inline TimerAwaiter after(std::chrono::duration<Rep, Period> d) noexcept
+{
+	return TimerAwaiter(Loop::current(),
+		timeMsGet() + std::chrono::duration_cast<std::chrono::milliseconds>(d).count());
+}
+
+} // namespace relind::co
+
+#endif //RELIND_CO_HPP_
@@ -0,0 +1,136 @@
+/*
+ * bench.cpp:
+ *	4relind-bench [<count> [<id>]], times the same accesses made through the
+ *	C calls and through 4relind.hpp. The relays toggle thousands of times,
+ *	so it runs only on the simulator (SM4RELIND_SIM="0"), which also leaves
+ *	the cost of the wrapper alone. Pinned to one CPU, every access is timed
+ *	BENCH_ROUNDS times for each side, alternating, and the minimum and
+ *	median of the rounds are printed.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <sched.h>
+
+#include "4relind.hpp"
+#include "sim.h"
+
+#define BENCH_ROUNDS	21	// timed runs of every access and side, odd for the median
+
+using namespace relind;
+
+// the masks are computed when compiling
+static_assert(RelayMask{1, 3}.bits() == 0x05);
+static_assert(RelayMask(0x0f).without(2) == RelayMask{1, 3, 4});
+static_assert((~InputMask{4}).count() == 3);
+static_assert(BoardId(Stack(2), BusNr(3)).value() == BOARD_ID(3, 2));
+
+static constexpr Relay gRelays[RELAY_CH_NR_MAX] = {1, 2, 3, 4};
+static constexpr Input gInputs[IN_CH_NR_MAX] = {1, 2, 3, 4};
+
+static uint64_t timeNsGet(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+template <class F>
+static double timeRun(int count, F f)
+{
+	uint64_t start = timeNsGet();
+
+	for (int i = 0; i < count; i++)
+	{
+		f(i);
+	}
+	return (double)(timeNsGet() - start) / count;
+}
+
+template <class C, class Cpp>
+static void compare(const char* name, int count, C c, Cpp cpp)
+{
+	double nsC[BENCH_ROUNDS];
+	double nsCpp[BENCH_ROUNDS];
+	double medC = 0;
+	double medCpp = 0;
+
+	for (int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		// alternate to spread the noise over both
+		nsC[r] = timeRun(count, c);
+		nsCpp[r] = timeRun(count, cpp);
+	}
+	std::sort(nsC, nsC + BENCH_ROUNDS);
+	std::sort(nsCpp, nsCpp + BENCH_ROUNDS);
+	medC = nsC[BENCH_ROUNDS / 2];
+	medCpp = nsCpp[BENCH_ROUNDS / 2];
+	printf("%-12s %8.0f %8.0f %8.0f %8.0f %+8.1f%%\n", name, nsC[0], medC, nsCpp[0], medCpp,
+		100.0 * (medCpp - medC) / medC);
+}
+
+int main(int argc, char* argv[])
+{
+	int count = (argc > 1) ? atoi(argv[1]) : BENCH_COUNT_DEFAULT;
+	std::optional<BoardId> id = BoardId::parse((argc > 2) ? argv[2] : "0");
+	std::optional<Board> board;
+	int dev = 0;
+	int val = 0;
+	OutStateEnumType state = OFF;
+	BoardSnapshotType snap;
+	RelayMask saved;
+	cpu_set_t cpus;
+	volatile int sink = 0;
+
+	if (count <= 0 || !id)
+	{
+		printf("Usage: 4relind-bench [<count> [<id>]]\n");
+		return 1;
+	}
+	if (getenv(SIM_ENV) == NULL || *getenv(SIM_ENV) == 0)
+	{
+		printf("4relind-bench toggles the relays, run it on the simulator (%s=\"%s\")\n",
+			SIM_ENV, id->str());
+		return 1;
+	}
+	board = Board::open(*id);
+	if (!board)
+	{
+		printf("Board %s not responding\n", id->str());
+		return 1;
+	}
+	dev = board->fd();
+	saved = board->relays().value_or(RelayMask());
+	CPU_ZERO(&cpus);
+	CPU_SET(sched_getcpu(), &cpus);
+	sched_setaffinity(0, sizeof(cpus), &cpus); // keep the caches and the clock of one CPU
+	printf("%d rounds of %d, ns per access\n", BENCH_ROUNDS, count);
+	printf("%-12s %8s %8s %8s %8s %9s\n", "access", "C min", "C med", "C++ min", "C++ med", "med diff");
+	compare("relay set", count,
+		[&](int i) { relayChSet(dev, 1 + (i & 3), ((i >> 2) & 1) ? ON : OFF); },
+		[&](int i) { board->set(gRelays[i & 3], (i >> 2) & 1); });
+	compare("relay get", count,
+		[&](int i) { relayChGet(dev, 1 + (i & 3), &state); sink = state; },
+		[&](int i) { sink = board->get(gRelays[i & 3]).value_or(false); });
+	compare("relays write", count,
+		[&](int i) { relaySet(dev, i & 0x0f); },
+		[&](int i) { board->write(RelayMask(i)); });
+	compare("inputs read", count,
+		[&](int) { inGet(dev, &val); sink = val; },
+		[&](int) { sink = board->inputs().value_or(InputMask()).bits(); });
+	compare("input get", count,
+		[&](int i) { inChGet(dev, 1 + (i & 3), &state); sink = state; },
+		[&](int i) { sink = board->get(gInputs[i & 3]).value_or(false); });
+	compare("snapshot", count,
+		[&](int) { boardSnapshot(dev, &snap); sink = snap.relays; },
+		[&](int) { sink = board->snapshot().relays.bits(); });
+	(void)sink;
+	board->write(saved);
+	return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * co_bench.cpp:
+ *	4relind-co-bench [<sequences> [<steps> [<id>]]], runs many coroutine
+ *	sequences on one thread, every step waits 1..50ms then changes one
+ *	relay. Reports the batched writes made and the allocations done while
+ *	running (the frames are allocated when the sequences start).
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "4relind_co.hpp"
+
+using namespace relind;
+using namespace relind::co;
+using namespace std::chrono_literals;
+
+static uint64_t gAllocs = 0;
+
+void* operator new(std::size_t size)
+{
+	void* p = std::malloc(size ? size : 1);
+
+	if (p == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	gAllocs++;
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+static constexpr Relay gRelays[RELAY_CH_NR_MAX] = {1, 2, 3, 4};
+
+static Task sequence(BoardRef board, int n, int steps, uint64_t* late)
+{
+	RelayMask mask;
+	uint64_t due = 0;
+	int ms = 0;
+
+	for (int i = 0; i < steps; i++)
+	{
+		ms = 1 + (n * 7 + i * 13) % 50;
+		due = timeMsGet() + ms;
+		co_await after(std::chrono::milliseconds(ms));
+		if (timeMsGet() - due > *late)
+		{
+			*late = timeMsGet() - due;
+		}
+		mask = RelayMask().with(gRelays[(n + i) & 3]);
+		co_await board.apply((i & 1) ? mask : RelayMask(), mask);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	int seqs = (argc > 1) ? atoi(argv[1]) : 1000;
+	int steps = (argc > 2) ? atoi(argv[2]) : 10;
+	std::optional<BoardId> id = BoardId::parse((argc > 3) ? argv[3] : "0");
+	std::optional<BoardRef> board;
+	uint64_t late = 0;
+	uint64_t start = 0;
+	uint64_t allocs = 0;
+	Loop loop;
+
+	if (seqs <= 0 || steps <= 0 || !id)
+	{
+		printf("Usage: 4relind-co-bench [<sequences> [<steps> [<id>]]]\n");
+		return 1;
+	}
+	board = loop.board(*id);
+	if (!board)
+	{
+		printf("Board %s not responding\n", id->str());
+		return 1;
+	}
+	for (int i = 0; i < seqs; i++)
+	{
+		sequence(*board, i, steps, &late);
+	}
+	allocs = gAllocs;
+	start = timeMsGet();
+	loop.run();
+	printf("%d sequences x %d steps in %llu ms, %llu batched writes\n", seqs, steps,
+		(unsigned long long)(timeMsGet() - start), (unsigned long long)loop.writes());
+	printf("timer max late %llu ms, %llu allocations while running\n",
+		(unsigned long long)late, (unsigned long long)(gAllocs - allocs));
+	return 0;
+}
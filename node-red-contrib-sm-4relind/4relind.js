@@ -1,21 +1,127 @@
 module.exports = function(RED) {
     "use strict";
     var I2C = require("i2c-bus");
+    var fs = require("fs");
+    // addon over lib4relind, built at install when the library is installed: one handle per
+    // board for all the nodes, bus calls on the libuv threadpool. i2c-bus otherwise.
+    var native = null;
+    try {
+        native = require("./build/Release/4relind.node");
+    } catch(err) {
+        native = null;
+    }
     const DEFAULT_HW_ADD = 0x38;
     const INPUT_REG = 0x00;
     const OUT_REG = 0x01;
+    const POLINV_REG = 0x02;
     const CFG_REG = 0x03;
+    const CFG_VAL = 0x0f;
+    const INIT_FILE = "/run/4relind/init"; // boards configured by "4relind init-all" since boot
+    var initMask = 0;
+    var initPolInv = 0;
+
+    function initialized(stack) {
+        if (initMask == 0) {
+            try {
+                var fields = fs.readFileSync(INIT_FILE, "utf8").trim().split(/\s+/);
+                initMask = parseInt(fields[0], 16) || 0;
+                initPolInv = parseInt(fields[1], 16) || 0;
+            } catch(err) {
+                initMask = 0;
+            }
+        }
+        return (initMask & (1 << stack)) != 0;
+    }
     const mask = new ArrayBuffer(4);
     mask[0] = 0x80;
     mask[1] = 0x40;
     mask[2] = 0x20;
     mask[3] = 0x10;
     
-    const inMask = new ArrayBuffer(4);
-    inMask[0] = 0x08;
-    inMask[1] = 0x04;
-    inMask[2] = 0x02;
-    inMask[3] = 0x01;
+    // opto inputs decode, keyed on the polarity programmed in POLINV by "4relind init-all --polinv"
+    const inDecode = [[15, 7, 11, 3, 13, 5, 9, 1, 14, 6, 10, 2, 12, 4, 8, 0],
+                      [0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15]];
+
+    // last known relay state per card, trusted for SHADOW_REFRESH_MS to skip writes of the same value
+    const SHADOW_REFRESH_MS = 1000;
+    var shadow = {};
+
+    function shadowGet(hwAdd) {
+        var entry = shadow[hwAdd];
+        if (entry == undefined || Date.now() - entry.time >= SHADOW_REFRESH_MS) {
+            return -1;
+        }
+        return entry.val;
+    }
+
+    function shadowSet(hwAdd, val) {
+        shadow[hwAdd] = {val: val & 0xf0, time: Date.now()};
+    }
+
+    // input polarity: from "init-all" or, for a board it did not configure, from POLINV
+    // (a board kept powered through a reboot keeps the setting)
+    function polInvGet(port, stack, hwAdd) {
+        if (initialized(stack)) {
+            return initPolInv != 0 ? 1 : 0;
+        }
+        return port.readByteSync(hwAdd, POLINV_REG) != 0 ? 1 : 0;
+    }
+
+    function optoDecode(polInv, inVal) {
+        return inDecode[polInv][inVal & 0x0f];
+    }
+
+    function clamp(val, min, max) {
+        return (val < min) ? min : ((val > max) ? max : val);
+    }
+
+    function payloadGet(node, msg) {
+        if (node.payloadType == null) {
+            return node.payload;
+        } else if (node.payloadType == 'none') {
+            return null;
+        }
+        return RED.util.evaluateNodeProperty(node.payload, node.payloadType, node, msg);
+    }
+
+    function relayWriteNative(node, msg, stack, relay) {
+        var myPayload;
+        var done;
+        try {
+            myPayload = payloadGet(node, msg);
+        } catch(err) {
+            node.error(err, msg);
+            return;
+        }
+        relay = clamp(relay, 0, 4);
+        if (relay == 0) {
+            if (isNaN(myPayload)) {
+                return;
+            }
+            done = native.write([{id: stack, relays: myPayload & 0x0f}]);
+        } else {
+            done = native.setRelay(stack, relay,
+                !(myPayload == null || myPayload == false || myPayload == 0 || myPayload == 'off'));
+        }
+        done.then(function() {
+            node.send(msg);
+        }, function(err) {
+            node.error(err, msg);
+        });
+    }
+
+    // relays and inputs of one board from one (batched) read
+    function boardReadNative(node, msg, stack, send) {
+        native.snapshot([stack]).then(function(state) {
+            if (!state[0].ok) {
+                node.error("4-RELAY card " + stack + " not responding", msg);
+                return;
+            }
+            send(state[0]);
+        }, function(err) {
+            node.error(err, msg);
+        });
+    }
     
     // The relay Node
     function RelayNode(n) {
@@ -26,7 +132,9 @@ module.exports = function(RED) {
         this.payloadType = n.payloadType;
         var node = this;
  
-        node.port = I2C.openSync( 1 );
+        if (!native) {
+            node.port = I2C.openSync( 1 );
+        }
         node.on("input", function(msg) {
             var myPayload;
             var stack = node.stack;
@@ -45,6 +153,10 @@ module.exports = function(RED) {
             } else {
                 this.status({});
             }
+            if (native) {
+                relayWriteNative(node, msg, clamp(stack, 0, 7), relay);
+                return;
+            }
             var hwAdd = DEFAULT_HW_ADD;
             var found = 1;
             if(stack < 0){
@@ -56,7 +168,7 @@ module.exports = function(RED) {
             //check the type of io_expander
             var st = (stack & 0x02) + (0x01 & (stack >> 2)) + (0x04 & (stack << 2));
             hwAdd += st ^ 0x07;
-            var direction = 0xaa;
+            var direction = CFG_VAL;
             try{
                 direction = node.port.readByteSync(hwAdd, CFG_REG );
             }catch(err) {
@@ -73,13 +185,17 @@ module.exports = function(RED) {
                 } else {
                     myPayload = RED.util.evaluateNodeProperty(this.payload, this.payloadType, this,msg);
                 }
-                if(direction != 0x0f){
+                if(direction != CFG_VAL){
                     node.port.writeByteSync(hwAdd, OUT_REG, 0x00);
                     node.port.writeByteSync(hwAdd, CFG_REG, 0x0f);
+                    shadowSet(hwAdd, 0x00);
                     //node.log('First update direction');  
                 }
-                var relayVal = 0;    
-                relayVal = node.port.readByteSync(hwAdd, OUT_REG);
+                var knownVal = shadowGet(hwAdd);
+                var relayVal = knownVal;
+                if (knownVal < 0) {
+                    relayVal = node.port.readByteSync(hwAdd, OUT_REG);
+                }
                 //node.log('Relays ' + String(relayVal));
                 if(relay < 0){
                   relay = 0;
@@ -111,9 +227,15 @@ module.exports = function(RED) {
                     relayVal |= mask[relay];
                   }
                 }
+                if (knownVal >= 0 && (relayVal & 0xf0) == knownVal) {
+                    msg.writeSuppressed = true; // the relays already have this state
+                    node.send(msg);
+                    return;
+                }
                 node.port.writeByte(hwAdd, OUT_REG, relayVal,  function(err) {
                     if (err) { node.error(err, msg);
                     } else {
+                      shadowSet(hwAdd, relayVal);
                       node.send(msg);
                     }
                 });
@@ -124,7 +246,9 @@ module.exports = function(RED) {
         });
 
         node.on("close", function() {
-            node.port.closeSync();
+            if (node.port) {
+                node.port.closeSync();
+            }
         });
     }
     RED.nodes.registerType("4relind", RelayNode);
@@ -138,7 +262,9 @@ module.exports = function(RED) {
         this.payloadType = n.payloadType;
         var node = this;
  
-        node.port = I2C.openSync( 1 );
+        if (!native) {
+            node.port = I2C.openSync( 1 );
+        }
         node.on("input", function(msg) {
             var myPayload;
             var stack = node.stack;
@@ -157,6 +283,15 @@ module.exports = function(RED) {
             } else {
                 this.status({});
             }
+            if (native) {
+                boardReadNative(node, msg, clamp(stack, 0, 7), function(state) {
+                    relay = clamp(relay, 0, 4);
+                    msg.inputs = state.inputs;
+                    msg.payload = (relay == 0) ? state.relays : (state.relays >> (relay - 1)) & 1;
+                    node.send(msg);
+                });
+                return;
+            }
             var hwAdd = DEFAULT_HW_ADD;
             var found = 1;
             if(stack < 0){
@@ -168,7 +303,7 @@ module.exports = function(RED) {
             //check the type of io_expander
             var st = (stack & 0x02) + (0x01 & (stack >> 2)) + (0x04 & (stack << 2));
             hwAdd += st ^ 0x07;
-            var direction = 0xaa;
+            var direction = CFG_VAL;
             try{
                 direction = node.port.readByteSync(hwAdd, CFG_REG );
             }catch(err) {               
@@ -186,12 +321,14 @@ module.exports = function(RED) {
                     myPayload = RED.util.evaluateNodeProperty(this.payload, this.payloadType, this,msg);
                 }
                 
-                if(direction != 0x0f){
+                if(direction != CFG_VAL){
                     node.port.writeByteSync(hwAdd, OUT_REG, 0x00);                    
                     node.port.writeByteSync(hwAdd, CFG_REG, 0x0f);
                 }
                 var relayVal = 0;    
-                relayVal = node.port.readByteSync(hwAdd, OUT_REG);
+                relayVal = node.port.readByteSync(hwAdd, INPUT_REG);// relays and inputs in one read
+                shadowSet(hwAdd, relayVal);
+                msg.inputs = optoDecode(polInvGet(node.port, stack, hwAdd), relayVal);
                 if(relay < 0){
                   relay = 0;
                 }
@@ -228,7 +365,9 @@ module.exports = function(RED) {
         });
 
         node.on("close", function() {
-            node.port.closeSync();
+            if (node.port) {
+                node.port.closeSync();
+            }
         });
     }
     RED.nodes.registerType("4relindrd", RelayReadNode);
@@ -242,7 +381,9 @@ module.exports = function(RED) {
         this.payloadType = n.payloadType;
         var node = this;
  
-        node.port = I2C.openSync( 1 );
+        if (!native) {
+            node.port = I2C.openSync( 1 );
+        }
         node.on("input", function(msg) {
             var myPayload;
             var stack = node.stack;
@@ -261,6 +402,14 @@ module.exports = function(RED) {
             } else {
                 this.status({});
             }
+            if (native) {
+                boardReadNative(node, msg, clamp(stack, 0, 7), function(state) {
+                    channel = clamp(channel, 0, 4);
+                    msg.payload = (channel == 0) ? state.inputs : (state.inputs >> (channel - 1)) & 1;
+                    node.send(msg);
+                });
+                return;
+            }
             var hwAdd = DEFAULT_HW_ADD;
             var found = 1;
             if(stack < 0){
@@ -272,7 +421,7 @@ module.exports = function(RED) {
             //check the type of io_expander
             var st = (stack & 0x02) + (0x01 & (stack >> 2)) + (0x04 & (stack << 2));
             hwAdd += st ^ 0x07;
-            var direction = 0xaa;
+            var direction = CFG_VAL;
             try{
                 direction = node.port.readByteSync(hwAdd, CFG_REG );
             }catch(err) {               
@@ -290,7 +439,7 @@ module.exports = function(RED) {
                     myPayload = RED.util.evaluateNodeProperty(this.payload, this.payloadType, this,msg);
                 }
                 
-                if(direction != 0x0f){
+                if(direction != CFG_VAL){
                     node.port.writeByteSync(hwAdd, OUT_REG, 0x00);                    
                     node.port.writeByteSync(hwAdd, CFG_REG, 0x0f);
                 }
@@ -302,26 +451,13 @@ module.exports = function(RED) {
                 if(channel > 4){
                   channel = 4;
                 }
+                var optoVal = optoDecode(polInvGet(node.port, stack, hwAdd), relayVal);
                 if(channel == 0){
-                    var i = 0;
-                    var newRelayVal = 0;
-                    for(i = 0; i<4; i++){
-                      if(( inMask[i] & relayVal) == 0){// inverted input
-                        newRelayVal |= 1<<i ;
-                      }
-                    }
-                    msg.payload = newRelayVal;  
+                    msg.payload = optoVal;
                 }
                 else{
                   channel-= 1;//zero based
-                  if(relayVal & inMask[channel])
-                  {
-                    msg.payload = 0;
-                  }
-                  else
-                  {
-                    msg.payload = 1;
-                  }
+                  msg.payload = (optoVal >> channel) & 1;
                 }
                 node.send(msg);
                
@@ -332,7 +468,9 @@ module.exports = function(RED) {
         });
 
         node.on("close", function() {
-            node.port.closeSync();
+            if (node.port) {
+                node.port.closeSync();
+            }
         });
     }
     RED.nodes.registerType("4relindin", OptoReadNode);
@@ -0,0 +1,10 @@
+{
+  "targets": [
+    {
+      "target_name": "4relind",
+      "sources": [ "src/addon.c" ],
+      "include_dirs": [ "/usr/local/include/4relind" ],
+      "libraries": [ "-L/usr/local/lib", "-l4relind", "-lpthread", "-lrt", "-lm", "-lcrypt" ]
+    }
+  ]
+}
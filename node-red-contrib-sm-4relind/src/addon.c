@@ -0,0 +1,566 @@
+/*
+ * addon.c:
+ *	Node N-API addon over lib4relind ("make install-lib" in the repository),
+ *	loaded once per Node-RED process and shared by all the nodes: every
+ *	board is opened once and the bus calls run on the libuv threadpool.
+ *		snapshot([id, ...])		Promise of [{id, relays, inputs, ok}],
+ *						one batched read per bus
+ *		write([{id, relays}, ...])	Promise of the number of boards written,
+ *						one batched write per bus
+ *		setRelay(id, relay, on)		Promise, one relay changed
+ *		subscribe([id, ...], cb[, ms])	cb({id, relays, inputs, ok}) now and on
+ *						every change, return a handle
+ *		unsubscribe(handle)
+ *	<id> is the stack level or a "<bus>.<stack>" string.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <node_api.h>
+
+#include "relay.h"
+
+#define ADDON_SUB_MAX		64
+#define ADDON_PERIOD_MS		20	// default sampling period of the subscriptions
+#define ADDON_PERIOD_MS_MIN	5
+
+enum
+{
+	ADDON_OP_SNAPSHOT = 0,
+	ADDON_OP_WRITE,
+	ADDON_OP_SET,
+};
+
+typedef struct
+{
+	napi_async_work work;
+	napi_deferred deferred;
+	int op;
+	int n;
+	int ids[BOARD_NR_MAX];
+	u8 vals[BOARD_NR_MAX];
+	int ok[BOARD_NR_MAX];
+	BoardSnapshotType snaps[BOARD_NR_MAX];
+	int ret;
+} AddonWorkType;
+
+typedef struct
+{
+	int used;
+	napi_threadsafe_function tsfn;
+	uint64_t boards;	// bit per board id
+	int periodMs;
+	int primed;	// current state sent
+} AddonSubType;
+
+typedef struct
+{
+	int id;
+	BoardSnapshotType snap;
+} AddonEventType;
+
+// the library is not reentrant (one job queue per bus, one workerWait())
+static pthread_mutex_t gLibLock = PTHREAD_MUTEX_INITIALIZER;
+static int gDev[BOARD_NR_MAX];	// doBoardInit() result + 1, 0 = not opened
+
+static pthread_mutex_t gSubLock = PTHREAD_MUTEX_INITIALIZER;
+static AddonSubType gSub[ADDON_SUB_MAX];
+static pthread_t gSampler;
+static int gSamplerRunning = 0;
+
+/*
+ * devGet:
+ *	Device of <id>, the board is configured on first use. Under gLibLock.
+ *********************************************************************************
+ */
+static int devGet(int id)
+{
+	int dev = 0;
+
+	if (gDev[id] > 0)
+	{
+		return gDev[id] - 1;
+	}
+	dev = doBoardInit(id);
+	if (dev < 0)
+	{
+		return ERROR;
+	}
+	gDev[id] = dev + 1;
+	return dev;
+}
+
+static int idGet(napi_env env, napi_value val, int* id)
+{
+	napi_valuetype type;
+	char str[16];
+	size_t len = 0;
+	int32_t n = 0;
+
+	if (napi_ok != napi_typeof(env, val, &type))
+	{
+		return ERROR;
+	}
+	if (type == napi_number)
+	{
+		napi_get_value_int32(env, val, &n);
+		snprintf(str, sizeof(str), "%d", n);
+	}
+	else if (type != napi_string
+		|| napi_ok != napi_get_value_string_utf8(env, val, str, sizeof(str), &len))
+	{
+		return ERROR;
+	}
+	*id = boardIdParse(str);
+	return (*id < 0) ? ERROR : OK;
+}
+
+static napi_value stateObject(napi_env env, int id, const BoardSnapshotType* snap)
+{
+	napi_value obj;
+	napi_value v;
+
+	napi_create_object(env, &obj);
+	napi_create_string_utf8(env, boardIdStr(id), NAPI_AUTO_LENGTH, &v);
+	napi_set_named_property(env, obj, "id", v);
+	napi_get_boolean(env, snap->ok != 0, &v);
+	napi_set_named_property(env, obj, "ok", v);
+	if (snap->ok)
+	{
+		napi_create_uint32(env, snap->relays, &v);
+		napi_set_named_property(env, obj, "relays", v);
+		napi_create_uint32(env, snap->inputs, &v);
+		napi_set_named_property(env, obj, "inputs", v);
+	}
+	return obj;
+}
+
+static napi_value throwError(napi_env env, const char* msg)
+{
+	napi_throw_type_error(env, NULL, msg);
+	return NULL;
+}
+
+/*
+ * workExecute:
+ *	Bus access of a call, on a threadpool thread
+ *********************************************************************************
+ */
+static void workExecute(napi_env env, void* data)
+{
+	AddonWorkType* w = (AddonWorkType*)data;
+	int dev = 0;
+
+	(void)env;
+	pthread_mutex_lock(&gLibLock);
+	switch (w->op)
+	{
+	case ADDON_OP_SNAPSHOT:
+		w->ret = boardSnapshotAll(w->ids, w->snaps, w->n);
+		break;
+	case ADDON_OP_WRITE:
+		w->ret = boardRelaysWrite(w->ids, w->vals, w->ok, w->n);
+		break;
+	case ADDON_OP_SET:
+		dev = devGet(w->ids[0]);
+		w->ret = (dev < 0) ? ERROR : relayChSet(dev, w->vals[0], w->ok[0] ? ON : OFF);
+		break;
+	}
+	pthread_mutex_unlock(&gLibLock);
+}
+
+static void workComplete(napi_env env, napi_status status, void* data)
+{
+	AddonWorkType* w = (AddonWorkType*)data;
+	napi_value res;
+	napi_value msg;
+	int i = 0;
+
+	if (status != napi_ok || w->ret < 0)
+	{
+		napi_create_string_utf8(env, (w->op == ADDON_OP_SET) ? "board not responding"
+			: "invalid request", NAPI_AUTO_LENGTH, &msg);
+		napi_create_error(env, NULL, msg, &res);
+		napi_reject_deferred(env, w->deferred, res);
+	}
+	else
+	{
+		switch (w->op)
+		{
+		case ADDON_OP_SNAPSHOT:
+			napi_create_array_with_length(env, w->n, &res);
+			for (i = 0; i < w->n; i++)
+			{
+				napi_set_element(env, res, i, stateObject(env, w->ids[i], &w->snaps[i]));
+			}
+			break;
+		case ADDON_OP_WRITE:
+			napi_create_int32(env, w->ret, &res);
+			break;
+		default:
+			napi_get_undefined(env, &res);
+			break;
+		}
+		napi_resolve_deferred(env, w->deferred, res);
+	}
+	napi_delete_async_work(env, w->work);
+	free(w);
+}
+
+static napi_value workQueue(napi_env env, AddonWorkType* w)
+{
+	napi_value promise;
+	napi_value name;
+
+	napi_create_promise(env, &w->deferred, &promise);
+	napi_create_string_utf8(env, "4relind", NAPI_AUTO_LENGTH, &name);
+	napi_create_async_work(env, NULL, name, workExecute, workComplete, w, &w->work);
+	napi_queue_async_work(env, w->work);
+	return promise;
+}
+
+static napi_value doSnapshot(napi_env env, napi_callback_info info)
+{
+	AddonWorkType* w = NULL;
+	napi_value argv[1];
+	napi_value el;
+	size_t argc = 1;
+	uint32_t len = 0;
+	uint32_t i = 0;
+	bool isArray = false;
+
+	napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+	if (argc < 1 || napi_ok != napi_is_array(env, argv[0], &isArray) || !isArray)
+	{
+		return throwError(env, "snapshot([id, ...])");
+	}
+	napi_get_array_length(env, argv[0], &len);
+	if (len == 0 || len > BOARD_NR_MAX || (w = calloc(1, sizeof(AddonWorkType))) == NULL)
+	{
+		return throwError(env, "snapshot: 1 to 64 boards");
+	}
+	w->op = ADDON_OP_SNAPSHOT;
+	w->n = len;
+	for (i = 0; i < len; i++)
+	{
+		napi_get_element(env, argv[0], i, &el);
+		if (OK != idGet(env, el, &w->ids[i]))
+		{
+			free(w);
+			return throwError(env, "snapshot: invalid board id");
+		}
+	}
+	return workQueue(env, w);
+}
+
+static napi_value doWrite(napi_env env, napi_callback_info info)
+{
+	AddonWorkType* w = NULL;
+	napi_value argv[1];
+	napi_value el;
+	napi_value v;
+	size_t argc = 1;
+	uint32_t len = 0;
+	uint32_t i = 0;
+	uint32_t relays = 0;
+	bool isArray = false;
+
+	napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+	if (argc < 1 || napi_ok != napi_is_array(env, argv[0], &isArray) || !isArray)
+	{
+		return throwError(env, "write([{id, relays}, ...])");
+	}
+	napi_get_array_length(env, argv[0], &len);
+	if (len == 0 || len > BOARD_NR_MAX || (w = calloc(1, sizeof(AddonWorkType))) == NULL)
+	{
+		return throwError(env, "write: 1 to 64 boards");
+	}
+	w->op = ADDON_OP_WRITE;
+	w->n = len;
+	for (i = 0; i < len; i++)
+	{
+		napi_get_element(env, argv[0], i, &el);
+		if (napi_ok != napi_get_named_property(env, el, "id", &v) || OK != idGet(env, v, &w->ids[i])
+			|| napi_ok != napi_get_named_property(env, el, "relays", &v)
+			|| napi_ok != napi_get_value_uint32(env, v, &relays) || relays > 0x0f)
+		{
+			free(w);
+			return throwError(env, "write: {id, relays 0..15} expected");
+		}
+		w->vals[i] = relays;
+	}
+	return workQueue(env, w);
+}
+
+static napi_value doSetRelay(napi_env env, napi_callback_info info)
+{
+	AddonWorkType* w = NULL;
+	napi_value argv[3];
+	size_t argc = 3;
+	int32_t ch = 0;
+	bool on = false;
+	int id = 0;
+
+	napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+	if (argc < 3 || OK != idGet(env, argv[0], &id)
+		|| napi_ok != napi_get_value_int32(env, argv[1], &ch)
+		|| ch < CHANNEL_NR_MIN || ch > RELAY_CH_NR_MAX
+		|| napi_ok != napi_coerce_to_bool(env, argv[2], &argv[2])
+		|| napi_ok != napi_get_value_bool(env, argv[2], &on))
+	{
+		return throwError(env, "setRelay(id, 1..4, on)");
+	}
+	if ( (w = calloc(1, sizeof(AddonWorkType))) == NULL)
+	{
+		return throwError(env, "out of memory");
+	}
+	w->op = ADDON_OP_SET;
+	w->n = 1;
+	w->ids[0] = id;
+	w->vals[0] = ch;
+	w->ok[0] = on;
+	return workQueue(env, w);
+}
+
+/*
+ * eventCall:
+ *	Deliver a sampled change to the JavaScript callback, on the main thread
+ *********************************************************************************
+ */
+static void eventCall(napi_env env, napi_value cb, void* context, void* data)
+{
+	AddonEventType* ev = (AddonEventType*)data;
+	napi_value undef;
+	napi_value arg;
+
+	(void)context;
+	if (env != NULL && cb != NULL)
+	{
+		napi_get_undefined(env, &undef);
+		arg = stateObject(env, ev->id, &ev->snap);
+		napi_call_function(env, undef, cb, 1, &arg, NULL);
+	}
+	free(ev);
+}
+
+static void eventSend(AddonSubType* s, int id, const BoardSnapshotType* snap)
+{
+	AddonEventType* ev = malloc(sizeof(AddonEventType));
+
+	if (ev == NULL)
+	{
+		return;
+	}
+	ev->id = id;
+	ev->snap = *snap;
+	if (napi_ok != napi_call_threadsafe_function(s->tsfn, ev, napi_tsfn_nonblocking))
+	{
+		free(ev);
+	}
+}
+
+/*
+ * samplerThread:
+ *	Read the boards of all the subscriptions with one batched read per bus,
+ *	at the shortest period asked, and send the changes
+ *********************************************************************************
+ */
+static void* samplerThread(void* arg)
+{
+	BoardSnapshotType snaps[BOARD_NR_MAX];
+	BoardSnapshotType last[BOARD_NR_MAX];
+	int ids[BOARD_NR_MAX];
+	uint64_t boards = 0;
+	uint64_t valid = 0;
+	uint64_t changed = 0;
+	int periodMs = 0;
+	int n = 0;
+	int i = 0;
+	int j = 0;
+
+	(void)arg;
+	for (;;)
+	{
+		pthread_mutex_lock(&gSubLock);
+		boards = 0;
+		periodMs = 1000;
+		for (i = 0; i < ADDON_SUB_MAX; i++)
+		{
+			if (gSub[i].used)
+			{
+				boards |= gSub[i].boards;
+				periodMs = (gSub[i].periodMs < periodMs) ? gSub[i].periodMs : periodMs;
+			}
+		}
+		if (boards == 0)
+		{
+			gSamplerRunning = 0;
+			pthread_mutex_unlock(&gSubLock);
+			return NULL;
+		}
+		pthread_mutex_unlock(&gSubLock);
+
+		for (n = 0, i = 0; i < BOARD_NR_MAX; i++)
+		{
+			if (boards & (1ull << i))
+			{
+				ids[n++] = i;
+			}
+		}
+		pthread_mutex_lock(&gLibLock);
+		boardSnapshotAll(ids, snaps, n);
+		pthread_mutex_unlock(&gLibLock);
+
+		changed = 0;
+		for (i = 0; i < n; i++)
+		{
+			j = ids[i];
+			if (!(valid & (1ull << j)) || snaps[i].ok != last[j].ok
+				|| (snaps[i].ok && (snaps[i].relays != last[j].relays || snaps[i].inputs != last[j].inputs)))
+			{
+				changed |= 1ull << j;
+			}
+			last[j] = snaps[i];
+			valid |= 1ull << j;
+		}
+		valid &= boards;
+
+		pthread_mutex_lock(&gSubLock);
+		for (i = 0; i < ADDON_SUB_MAX; i++)
+		{
+			if (!gSub[i].used)
+			{
+				continue;
+			}
+			for (j = 0; j < n; j++)
+			{
+				if ( (gSub[i].boards & (1ull << ids[j]))
+					&& (!gSub[i].primed || (changed & (1ull << ids[j]))))
+				{
+					eventSend(&gSub[i], ids[j], &snaps[j]);
+				}
+			}
+			gSub[i].primed = 1;
+		}
+		pthread_mutex_unlock(&gSubLock);
+		usleep(periodMs * 1000);
+	}
+	return NULL;
+}
+
+static napi_value doSubscribe(napi_env env, napi_callback_info info)
+{
+	napi_value argv[3];
+	napi_value el;
+	napi_value name;
+	napi_value res;
+	size_t argc = 3;
+	uint32_t len = 0;
+	uint32_t i = 0;
+	uint64_t boards = 0;
+	int32_t periodMs = ADDON_PERIOD_MS;
+	int id = 0;
+	int h = 0;
+	bool isArray = false;
+	napi_valuetype type;
+
+	napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+	if (argc < 2 || napi_ok != napi_is_array(env, argv[0], &isArray) || !isArray
+		|| napi_ok != napi_typeof(env, argv[1], &type) || type != napi_function)
+	{
+		return throwError(env, "subscribe([id, ...], cb[, ms])");
+	}
+	napi_get_array_length(env, argv[0], &len);
+	for (i = 0; i < len; i++)
+	{
+		napi_get_element(env, argv[0], i, &el);
+		if (OK != idGet(env, el, &id))
+		{
+			return throwError(env, "subscribe: invalid board id");
+		}
+		boards |= 1ull << id;
+	}
+	if (argc > 2 && napi_ok == napi_get_value_int32(env, argv[2], &periodMs)
+		&& periodMs < ADDON_PERIOD_MS_MIN)
+	{
+		periodMs = ADDON_PERIOD_MS_MIN;
+	}
+	if (boards == 0)
+	{
+		return throwError(env, "subscribe: no board");
+	}
+	pthread_mutex_lock(&gSubLock);
+	for (h = 0; h < ADDON_SUB_MAX && gSub[h].used; h++)
+		;
+	if (h == ADDON_SUB_MAX)
+	{
+		pthread_mutex_unlock(&gSubLock);
+		return throwError(env, "subscribe: too many subscriptions");
+	}
+	napi_create_string_utf8(env, "4relind events", NAPI_AUTO_LENGTH, &name);
+	if (napi_ok != napi_create_threadsafe_function(env, argv[1], NULL, name, 0, 1, NULL, NULL,
+		NULL, eventCall, &gSub[h].tsfn))
+	{
+		pthread_mutex_unlock(&gSubLock);
+		return throwError(env, "subscribe: callback");
+	}
+	gSub[h].used = 1;
+	gSub[h].boards = boards;
+	gSub[h].periodMs = periodMs;
+	gSub[h].primed = 0;
+	if (!gSamplerRunning)
+	{
+		if (gSampler != 0)
+		{
+			pthread_join(gSampler, NULL); // the previous one has ended
+		}
+		gSamplerRunning = (0 == pthread_create(&gSampler, NULL, samplerThread, NULL));
+	}
+	pthread_mutex_unlock(&gSubLock);
+	napi_create_int32(env, h, &res);
+	return res;
+}
+
+static napi_value doUnsubscribe(napi_env env, napi_callback_info info)
+{
+	napi_value argv[1];
+	size_t argc = 1;
+	int32_t h = -1;
+
+	napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+	if (argc < 1 || napi_ok != napi_get_value_int32(env, argv[0], &h) || h < 0 || h >= ADDON_SUB_MAX)
+	{
+		return throwError(env, "unsubscribe(handle)");
+	}
+	pthread_mutex_lock(&gSubLock);
+	if (gSub[h].used)
+	{
+		gSub[h].used = 0;
+		napi_release_threadsafe_function(gSub[h].tsfn, napi_tsfn_abort);
+	}
+	pthread_mutex_unlock(&gSubLock);
+	return NULL;
+}
+
+static napi_value addonInit(napi_env env, napi_value exports)
+{
+	napi_property_descriptor props[] =
+	{
+		{"snapshot", NULL, doSnapshot, NULL, NULL, NULL, napi_default, NULL},
+		{"write", NULL, doWrite, NULL, NULL, NULL, napi_default, NULL},
+		{"setRelay", NULL, doSetRelay, NULL, NULL, NULL, napi_default, NULL},
+		{"subscribe", NULL, doSubscribe, NULL, NULL, NULL, napi_default, NULL},
+		{"unsubscribe", NULL, doUnsubscribe, NULL, NULL, NULL, napi_default, NULL},
+	};
+
+	napi_define_properties(env, exports, sizeof(props) / sizeof(props[0]), props);
+	return exports;
+}
+
+NAPI_MODULE(NODE_GYP_MODULE_NAME, addonInit)
@@ -1,4 +1,5 @@
 import smbus
+import time
 
 # bus = smbus.SMBus(1)    # 0 = /dev/i2c-0 (port I2C0), 1 = /dev/i2c-1 (port I2C1)
 
@@ -14,47 +15,91 @@ relayChRemap = [7, 6, 5, 4]
 optoMaskRemap = [0x08, 0x04, 0x02, 0x01]
 optoChRemap = [3, 2, 1, 0]
 
+INIT_FILE = "/run/4relind/init"  # boards configured by "4relind init-all" since boot
+__init_mask = 0
+__init_polinv = 0
+__board_polinv = {}  # polarity of the inputs per address, set by __check()
+
+SHADOW_REFRESH = 1.0  # seconds to trust the last known relay state before writing anyway
+__shadow = {}
+__stats = {'writes': 0, 'suppressed': 0}
+
+
+# channel 1 is the most significant pin of each expander nibble
+__nibbleRemap = [0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15]
+# opto inputs decode, keyed on the polarity programmed in POLINV by "4relind init-all --polinv"
+__optoDecode = [[15, 7, 11, 3, 13, 5, 9, 1, 14, 6, 10, 2, 12, 4, 8, 0],
+                [0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15]]
+
 
 def __relayToIO(relay):
-    val = 0
-    for i in range(0, 4):
-        if (relay & (1 << i)) != 0:
-            val = val + relayMaskRemap[i]
-    return val
+    return __nibbleRemap[relay & 0x0f] << 4
 
 
 def __IOToRelay(iov):
-    val = 0
-    for i in range(0, 4):
-        if (iov & relayMaskRemap[i]) != 0:
-            val = val + (1 << i)
-    return val
+    return __nibbleRemap[(iov >> 4) & 0x0f]
 
 
-def __IOToOpto(iov):
-    val = 0
-    for i in range(0, 4):
-        if (iov & optoMaskRemap[i]) == 0:
-            val = val + (1 << i)
-    return val
+def __IOToOpto(iov, polinv=0):
+    return __optoDecode[1 if polinv else 0][iov & 0x0f]
 
 
-def __optoToIO(opto):
-    val = 0
-    for i in range(0, 4):
-        if (opto & (1 << i)) == 0:
-            val = val + optoMaskRemap[i]
-    return val
+def __initialized(add):
+    global __init_mask, __init_polinv
+    if __init_mask == 0:
+        try:
+            with open(INIT_FILE) as f:
+                fields = f.read().split()
+            __init_mask = int(fields[0], 16)
+            if len(fields) > 1:
+                __init_polinv = int(fields[1], 16)
+        except (IOError, OSError, ValueError, IndexError):
+            return False
+    for stack in range(0, 8):
+        st = (stack & 0x02) + (0x01 & (stack >> 2)) + (0x04 & (stack << 2))
+        if DEVICE_ADDRESS + (0x07 ^ st) == add:
+            return (__init_mask & (1 << stack)) != 0
+    return False
+
+
+def __polinv(add):
+    return __board_polinv.get(add, 0)
 
 
 def __check(bus, add):
+    # one CFG read even after init-all: a power cycled board comes back unconfigured
     cfg = bus.read_byte_data(add, RELAY4_CFG_REG_ADD)
     if cfg != 0x0f:
         bus.write_byte_data(add, RELAY4_CFG_REG_ADD, 0x0f)
         bus.write_byte_data(add, RELAY4_OUTPORT_REG_ADD, 0)
+    if __initialized(add):
+        __board_polinv[add] = __init_polinv
+    else:
+        # not configured by init-all, POLINV may still hold an earlier --polinv
+        __board_polinv[add] = bus.read_byte_data(add, RELAY4_POLINV_REG_ADD)
     return bus.read_byte_data(add, RELAY4_INPORT_REG_ADD)
 
 
+def __shadow_get(add):
+    entry = __shadow.get(add)
+    if entry is None or time.time() - entry[1] >= SHADOW_REFRESH:
+        return None
+    return entry[0]
+
+
+def __shadow_set(add, iov):
+    __shadow[add] = (iov & 0xf0, time.time())
+
+
+def __write(bus, add, iov):
+    if __shadow_get(add) == (iov & 0xf0):
+        __stats['suppressed'] += 1
+        return
+    bus.write_byte_data(add, RELAY4_OUTPORT_REG_ADD, iov)
+    __shadow_set(add, iov)
+    __stats['writes'] += 1
+
+
 def set_relay(stack, relay, value):
     if stack < 0 or stack > 7:
         raise ValueError('Invalid stack level')
@@ -65,20 +110,28 @@ def set_relay(stack, relay, value):
     if relay > 4:
         raise ValueError('Invalid relay number')
 
-    bus = smbus.SMBus(1)
     st = (stack & 0x02) + (0x01 & (stack >> 2)) + (0x04 & (stack << 2))
     stack = 0x07 ^ st
+    oldVal = __shadow_get(DEVICE_ADDRESS + stack)
+    if oldVal is not None:
+        newVal = __IOToRelay(oldVal)
+        if value == 0:
+            newVal = newVal & (~(1 << (relay - 1)))
+        else:
+            newVal = newVal | (1 << (relay - 1))
+        if __relayToIO(newVal) == oldVal:
+            __stats['suppressed'] += 1
+            return
+    bus = smbus.SMBus(1)
     try:
         oldVal = __check(bus, DEVICE_ADDRESS + stack)
+        __shadow_set(DEVICE_ADDRESS + stack, oldVal)
         oldVal = __IOToRelay(oldVal)
         if value == 0:
             oldVal = oldVal & (~(1 << (relay - 1)))
-            oldVal = __relayToIO(oldVal)
-            bus.write_byte_data(DEVICE_ADDRESS + stack, RELAY4_OUTPORT_REG_ADD, oldVal)
         else:
             oldVal = oldVal | (1 << (relay - 1))
-            oldVal = __relayToIO(oldVal)
-            bus.write_byte_data(DEVICE_ADDRESS + stack, RELAY4_OUTPORT_REG_ADD, oldVal)
+        __write(bus, DEVICE_ADDRESS + stack, __relayToIO(oldVal))
     except Exception as e:
         bus.close()
         raise RuntimeError("Unable to communicate with 4relind with exception " + str(e))
@@ -95,17 +148,24 @@ def set_relay_all(stack, value):
     if value < 0:
         raise ValueError('Invalid relay value')
 
+    value = __relayToIO(value)
+    if __shadow_get(DEVICE_ADDRESS + stack) == value:
+        __stats['suppressed'] += 1
+        return
     bus = smbus.SMBus(1)
     try:
-        oldVal = __check(bus, DEVICE_ADDRESS + stack)
-        value = __relayToIO(value)
-        bus.write_byte_data(DEVICE_ADDRESS + stack, RELAY4_OUTPORT_REG_ADD, value)
+        __check(bus, DEVICE_ADDRESS + stack)
+        __write(bus, DEVICE_ADDRESS + stack, value)
     except Exception as e:
         bus.close()
         raise RuntimeError("Unable to communicate with 4relind with exception " + str(e))
     bus.close()
 
 
+def get_write_stats():
+    return dict(__stats)
+
+
 def get_relay(stack, relay):
     if stack < 0 or stack > 7:
         raise ValueError('Invalid stack level')
@@ -118,6 +178,7 @@ def get_relay(stack, relay):
     bus = smbus.SMBus(1)
     try:
         val = __check(bus, DEVICE_ADDRESS + stack)
+        __shadow_set(DEVICE_ADDRESS + stack, val)
         bus.close()
     except Exception as e:
         bus.close()
@@ -137,6 +198,7 @@ def get_relay_all(stack):
     stack = 0x07 ^ st
     try:
         val = __check(bus, DEVICE_ADDRESS + stack)
+        __shadow_set(DEVICE_ADDRESS + stack, val)
         bus.close()
     except Exception as e:
         bus.close()
@@ -157,11 +219,12 @@ def get_opto(stack, channel):
     bus = smbus.SMBus(1)
     try:
         val = __check(bus, DEVICE_ADDRESS + stack)
+        __shadow_set(DEVICE_ADDRESS + stack, val)
         bus.close()
     except Exception as e:
         bus.close()
         raise RuntimeError("Unable to communicate with 4relind with exception " + str(e))
-    val = __IOToOpto(val)
+    val = __IOToOpto(val, __polinv(DEVICE_ADDRESS + stack))
     val = val & (1 << (channel - 1))
     if val == 0:
         return 0
@@ -176,9 +239,26 @@ def get_opto_all(stack):
     stack = 0x07 ^ st
     try:
         val = __check(bus, DEVICE_ADDRESS + stack)
+        __shadow_set(DEVICE_ADDRESS + stack, val)
         bus.close()
     except Exception as e:
         bus.close()
         raise RuntimeError("Unable to communicate with 4relind with exception " + str(e))
-    val = __IOToOpto(val)
+    val = __IOToOpto(val, __polinv(DEVICE_ADDRESS + stack))
     return val
+
+
+def get_status(stack):
+    if stack < 0 or stack > 7:
+        raise ValueError('Invalid stack level')
+    bus = smbus.SMBus(1)
+    st = (stack & 0x02) + (0x01 & (stack >> 2)) + (0x04 & (stack << 2))
+    stack = 0x07 ^ st
+    try:
+        val = __check(bus, DEVICE_ADDRESS + stack)
+        __shadow_set(DEVICE_ADDRESS + stack, val)
+        bus.close()
+    except Exception as e:
+        bus.close()
+        raise RuntimeError("Unable to communicate with 4relind with exception " + str(e))
+    return __IOToRelay(val), __IOToOpto(val, __polinv(DEVICE_ADDRESS + stack)), time.time()
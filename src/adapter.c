@@ -0,0 +1,184 @@
+/*
+ * adapter.c:
+ *	Capabilities of the I2C adapters and the transfer method chosen for the
+ *	single register reads and writes. The comm layer probes I2C_FUNCS and
+ *	times every supported method on the first access to an adapter, the
+ *	result is kept in a memory mapped file in /run so the probing runs once
+ *	per boot and is shared by all processes.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "relay.h"
+#include "config.h"
+#include "mux.h"
+#include "adapter.h"
+
+typedef struct
+{
+	AdapterInfoType info[I2C_BUS_NR_MAX];
+} AdapterFileType;
+
+static AdapterFileType gLocal; // used if the shared file is not available
+static AdapterFileType* gAdapter = NULL;
+static pthread_once_t gAdapterOnce = PTHREAD_ONCE_INIT;
+
+static const char* gMethodName[I2C_METHOD_COUNT] =
+{
+	"rdwr",
+	"smbus",
+	"rw"};
+
+static const char* gOpName[ADAPTER_OP_COUNT] =
+{
+	"read",
+	"write"};
+
+static void adapterFileOpen(void)
+{
+	if (0 == mmDirCreate(RUN_DIR))
+	{
+		gAdapter = mmFileOpen(ADAPTER_FILE, sizeof(AdapterFileType), 1);
+	}
+	if (gAdapter == NULL)
+	{
+		gAdapter = &gLocal;
+	}
+}
+
+/*
+ * adapterInfoGet:
+ *	Shared record of the adapter /dev/i2c-<adapter>, NULL if out of range
+ *********************************************************************************
+ */
+AdapterInfoType* adapterInfoGet(int adapter)
+{
+	if (adapter < 0 || adapter >= I2C_BUS_NR_MAX)
+	{
+		return NULL;
+	}
+	pthread_once(&gAdapterOnce, adapterFileOpen);
+	return &gAdapter->info[adapter];
+}
+
+/*
+ * adapterReset:
+ *	Forget the probing result, the next access probes the adapter again
+ *********************************************************************************
+ */
+void adapterReset(int adapter)
+{
+	AdapterInfoType* info = adapterInfoGet(adapter);
+
+	if (info != NULL)
+	{
+		memset(info, 0, sizeof(AdapterInfoType));
+	}
+}
+
+const char* adapterMethodName(int method)
+{
+	if (method < 0 || method >= I2C_METHOD_COUNT)
+	{
+		return "?";
+	}
+	return gMethodName[method];
+}
+
+/*
+ * adapterPrint:
+ *	Human readable capabilities, chosen methods and measured costs
+ *********************************************************************************
+ */
+void adapterPrint(FILE* out, int adapter)
+{
+	AdapterInfoType* info = adapterInfoGet(adapter);
+	int op = 0;
+	int m = 0;
+
+	if (info == NULL)
+	{
+		return;
+	}
+	if (!info->probed)
+	{
+		fprintf(out, "i2c-%d: not probed\n", adapter);
+		return;
+	}
+	fprintf(out, "i2c-%d: funcs 0x%08llx\n", adapter, (unsigned long long)info->funcs);
+	for (op = 0; op < ADAPTER_OP_COUNT; op++)
+	{
+		if (!info->benched[op])
+		{
+			fprintf(out, "  %-6s not measured yet\n", gOpName[op]);
+			continue;
+		}
+		fprintf(out, "  %-6s %-6s", gOpName[op], gMethodName[info->method[op]]);
+		for (m = 0; m < I2C_METHOD_COUNT; m++)
+		{
+			if (info->costNs[op][m] == 0)
+			{
+				fprintf(out, "  %s -", gMethodName[m]);
+			}
+			else
+			{
+				fprintf(out, "  %s %.1fus", gMethodName[m], info->costNs[op][m] / 1000.0);
+			}
+		}
+		fprintf(out, "\n");
+	}
+}
+
+void adapterMetricsPrint(FILE* out)
+{
+	int buses[I2C_BUS_NR_MAX];
+	AdapterInfoType* info = NULL;
+	int cnt = 0;
+	int i = 0;
+	int op = 0;
+	int m = 0;
+	int parent = 0;
+	int done = 0;
+
+	cnt = configBusesGet(buses);
+	for (i = 0; i < cnt; i++)
+	{
+		parent = muxParentGet(buses[i]);
+		info = adapterInfoGet(parent);
+		if (info == NULL || !info->probed || (done & (1 << parent)))
+		{
+			continue;
+		}
+		if (done == 0)
+		{
+			fprintf(out, "# HELP sm4relind_i2c_method Transfer method chosen for single register accesses\n");
+			fprintf(out, "# TYPE sm4relind_i2c_method gauge\n");
+			fprintf(out, "# HELP sm4relind_i2c_cost_seconds Measured time of one single register access\n");
+			fprintf(out, "# TYPE sm4relind_i2c_cost_seconds gauge\n");
+		}
+		done |= 1 << parent;
+		for (op = 0; op < ADAPTER_OP_COUNT; op++)
+		{
+			if (!info->benched[op])
+			{
+				continue;
+			}
+			for (m = 0; m < I2C_METHOD_COUNT; m++)
+			{
+				fprintf(out, "sm4relind_i2c_method{bus=\"%d\",op=\"%s\",method=\"%s\"} %d\n",
+					parent, gOpName[op], gMethodName[m], info->method[op] == (uint32_t)m);
+				if (info->costNs[op][m] != 0)
+				{
+					fprintf(out, "sm4relind_i2c_cost_seconds{bus=\"%d\",op=\"%s\",method=\"%s\"} %.9f\n",
+						parent, gOpName[op], gMethodName[m], info->costNs[op][m] / 1e9);
+				}
+			}
+		}
+	}
+}
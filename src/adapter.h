@@ -0,0 +1,41 @@
+#ifndef ADAPTER_H_
+#define ADAPTER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "mmfile.h"
+
+#define ADAPTER_FILE		RUN_DIR "/adapters"
+#define ADAPTER_BENCH_LOOPS	8	// accesses timed per method
+
+typedef enum
+{
+	I2C_METHOD_RDWR = 0,	// one combined I2C_RDWR transfer
+	I2C_METHOD_SMBUS,		// I2C_SMBUS byte-data ioctl
+	I2C_METHOD_RW,			// write() of the register then read()
+	I2C_METHOD_COUNT
+} I2cMethodType;
+
+typedef enum
+{
+	ADAPTER_OP_READ = 0,
+	ADAPTER_OP_WRITE,
+	ADAPTER_OP_COUNT
+} AdapterOpType;
+
+typedef struct
+{
+	uint32_t probed;	// funcs valid
+	uint64_t funcs;		// I2C_FUNCS answer
+	uint32_t benched[ADAPTER_OP_COUNT];
+	uint32_t method[ADAPTER_OP_COUNT];
+	uint32_t costNs[ADAPTER_OP_COUNT][I2C_METHOD_COUNT]; // 0 = unsupported or failed
+} AdapterInfoType;
+
+AdapterInfoType* adapterInfoGet(int adapter);
+void adapterReset(int adapter);
+const char* adapterMethodName(int method);
+void adapterPrint(FILE* out, int adapter);
+void adapterMetricsPrint(FILE* out);
+
+#endif //ADAPTER_H_
@@ -13,9 +13,16 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 #include <sys/ioctl.h>
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include "comm.h"
+#include "adapter.h"
+#include "gpio.h"
+#include "health.h"
+#include "mux.h"
+#include "sim.h"
 
 #define I2C_SLAVE	0x0703
 #define I2C_SMBUS	0x0720	/* SMBus-level access */
@@ -40,30 +47,197 @@
 #define I2C_SMBUS_BLOCK_MAX	32	/* As specified in SMBus standard */
 #define I2C_SMBUS_I2C_BLOCK_MAX	32	/* Not specified but we use same structure */
 
+#define COMM_DEV_MAX	1024
 
-int i2cSetup(int addr)
+typedef struct
+{
+	int16_t bus;
+	int16_t addr;	// slave address + 1, 0 = not an i2cSetup() handle
+} CommDevType;
+
+static CommDevType gDev[COMM_DEV_MAX];
+
+static int devAddr(int dev, int* bus)
+{
+	*bus = -1;
+	if (dev < 0 || dev >= COMM_DEV_MAX)
+	{
+		return -1;
+	}
+	*bus = gDev[dev].bus;
+	return gDev[dev].addr - 1;
+}
+
+
+/*
+ * adapterOpen:
+ *	Open the adapter carrying <bus> (the mux parent for a bus behind a mux),
+ *	a placeholder descriptor when the adapters are simulated or the gpio
+ *	backend does the accesses
+ *********************************************************************************
+ */
+static int adapterOpen(int bus)
 {
-	int file;
 	char filename[40];
-	sprintf(filename, "/dev/i2c-1");
 
-	if ( (file = open(filename, O_RDWR)) < 0)
+	if (simEnabled() || gpioEnabled())
+	{
+		return open("/dev/null", O_RDWR);
+	}
+	sprintf(filename, "/dev/i2c-%d", muxParentGet(bus));
+	return open(filename, O_RDWR);
+}
+
+static int i2cTransfer(int fd, struct i2c_msg* msgs, int n)
+{
+	struct i2c_rdwr_ioctl_data data;
+	int bus = 0;
+
+	if (simEnabled())
+	{
+		devAddr(fd, &bus);
+		return simTransfer(muxParentGet(bus), msgs, n);
+	}
+	data.msgs = msgs;
+	data.nmsgs = n;
+	return (ioctl(fd, I2C_RDWR, &data) == n) ? 0 : -1;
+}
+
+/*
+ * muxEnter, muxLeave:
+ *	Around every access to a bus behind a mux: hold the adapter and select
+ *	the channel if it is not selected yet
+ *********************************************************************************
+ */
+static int muxEnter(int fd, int bus)
+{
+	uint8_t addr[MUX_PER_BUS];
+	uint8_t ctrl[MUX_PER_BUS];
+	struct i2c_msg msg;
+	int n = 0;
+	int i = 0;
+
+	n = muxLock(bus, addr, ctrl);
+	if (n < 0)
+	{
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+	{
+		msg.addr = addr[i];
+		msg.flags = 0;
+		msg.len = 1;
+		msg.buf = &ctrl[i];
+		if (0 != i2cTransfer(fd, &msg, 1))
+		{
+			muxUnlock(bus, 0);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void muxLeave(int bus, int ok)
+{
+	muxUnlock(bus, ok);
+}
+
+int i2cSetup(int bus, int addr)
+{
+	int file;
+
+	if ( (file = adapterOpen(bus)) < 0)
 	{
 		printf("Failed to open the bus.");
 		return -1;
 	}
-	if (ioctl(file, I2C_SLAVE, addr) < 0)
+	if (!simEnabled() && !gpioEnabled() && ioctl(file, I2C_SLAVE, addr) < 0)
 	{
 		printf("Failed to acquire bus access and/or talk to slave.\n");
 		return -1;
 	}
+	if (file < COMM_DEV_MAX)
+	{
+		gDev[file].bus = bus;
+		gDev[file].addr = addr + 1;
+	}
 
 	return file;
 }
 
-int i2cMem8Read(int dev, int add, uint8_t* buff, int size)
+/*
+ * adapterProbe:
+ *	Capabilities of the adapter carrying <bus>, asked once per boot. Until
+ *	the methods are timed use the first one the adapter supports.
+ *********************************************************************************
+ */
+static AdapterInfoType* adapterProbe(int fd, int bus)
 {
-	uint8_t intBuff[I2C_SMBUS_BLOCK_MAX];
+	AdapterInfoType* info = adapterInfoGet(muxParentGet(bus));
+	unsigned long funcs = 0;
+	int op = 0;
+
+	if (info == NULL || __atomic_load_n(&info->probed, __ATOMIC_ACQUIRE))
+	{
+		return info;
+	}
+	if (simEnabled())
+	{
+		funcs = I2C_FUNC_I2C | I2C_FUNC_SMBUS_BYTE_DATA;
+	}
+	else if (ioctl(fd, I2C_FUNCS, &funcs) < 0)
+	{
+		funcs = I2C_FUNC_I2C; // plain transfers are all an old driver knows
+	}
+	info->funcs = funcs;
+	for (op = 0; op < ADAPTER_OP_COUNT; op++)
+	{
+		info->method[op] = (funcs & I2C_FUNC_I2C) ? I2C_METHOD_RDWR : I2C_METHOD_SMBUS;
+	}
+	__atomic_store_n(&info->probed, 1, __ATOMIC_RELEASE);
+	return info;
+}
+
+static int methodSupported(AdapterInfoType* info, int method, int op)
+{
+	if (method == I2C_METHOD_SMBUS)
+	{
+		return 0 != (info->funcs & ((op == ADAPTER_OP_READ) ? I2C_FUNC_SMBUS_READ_BYTE_DATA
+			: I2C_FUNC_SMBUS_WRITE_BYTE_DATA));
+	}
+	return 0 != (info->funcs & I2C_FUNC_I2C);
+}
+
+static int smbusAccess(int fd, int rw, int add, uint8_t* val)
+{
+	struct i2c_smbus_ioctl_data args;
+	union i2c_smbus_data data;
+
+	data.byte = *val;
+	args.read_write = rw;
+	args.command = 0xff & add;
+	args.size = I2C_SMBUS_BYTE_DATA;
+	args.data = &data;
+	if (ioctl(fd, I2C_SMBUS, &args) < 0)
+	{
+		return -1;
+	}
+	*val = data.byte;
+	return 0;
+}
+
+/*
+ * methodRead, methodWrite:
+ *	Register access with one transfer method, I2C_METHOD_SMBUS only for
+ *	<size> 1. The simulated adapter sees what i2c-core makes of each method:
+ *	the SMBus byte-data emulation is a combined transfer, read/write is two.
+ *********************************************************************************
+ */
+static int methodRead(int dev, int method, int add, uint8_t* buff, int size)
+{
+	uint8_t intBuff[1];
+	struct i2c_msg msgs[2];
+	int bus = 0;
 
 	if (NULL == buff)
 	{
@@ -76,6 +250,25 @@ int i2cMem8Read(int dev, int add, uint8_t* buff, int size)
 	}
 
 	intBuff[0] = 0xff & add;
+	msgs[0].addr = msgs[1].addr = devAddr(dev, &bus);
+	msgs[0].flags = 0;
+	msgs[0].len = 1;
+	msgs[0].buf = intBuff;
+	msgs[1].flags = I2C_M_RD;
+	msgs[1].len = size;
+	msgs[1].buf = buff;
+	if (method == I2C_METHOD_RDWR || (method == I2C_METHOD_SMBUS && simEnabled()))
+	{
+		return i2cTransfer(dev, msgs, 2);
+	}
+	if (method == I2C_METHOD_SMBUS)
+	{
+		return (size == 1) ? smbusAccess(dev, I2C_SMBUS_READ, add, buff) : -1;
+	}
+	if (simEnabled())
+	{
+		return (0 == i2cTransfer(dev, &msgs[0], 1) && 0 == i2cTransfer(dev, &msgs[1], 1)) ? 0 : -1;
+	}
 
 	if (write(dev, intBuff, 1) != 1)
 	{
@@ -90,9 +283,11 @@ int i2cMem8Read(int dev, int add, uint8_t* buff, int size)
 	return 0; //OK
 }
 
-int i2cMem8Write(int dev, int add, uint8_t* buff, int size)
+static int methodWrite(int dev, int method, int add, uint8_t* buff, int size)
 {
 	uint8_t intBuff[I2C_SMBUS_BLOCK_MAX];
+	struct i2c_msg msg;
+	int bus = 0;
 
 	if (NULL == buff)
 	{
@@ -106,6 +301,18 @@ int i2cMem8Write(int dev, int add, uint8_t* buff, int size)
 
 	intBuff[0] = 0xff & add;
 	memcpy(&intBuff[1], buff, size);
+	if (method == I2C_METHOD_SMBUS && !simEnabled())
+	{
+		return (size == 1) ? smbusAccess(dev, I2C_SMBUS_WRITE, add, buff) : -1;
+	}
+	if (method == I2C_METHOD_RDWR || simEnabled())
+	{
+		msg.addr = devAddr(dev, &bus);
+		msg.flags = 0;
+		msg.len = size + 1;
+		msg.buf = intBuff;
+		return i2cTransfer(dev, &msg, 1);
+	}
 
 	if (write(dev, intBuff, size + 1) != size + 1)
 	{
@@ -115,5 +322,419 @@ int i2cMem8Write(int dev, int add, uint8_t* buff, int size)
 	return 0;
 }
 
+/*
+ * adapterBench:
+ *	Time ADAPTER_BENCH_LOOPS accesses of the caller's register with every
+ *	method the adapter supports and keep the cheapest one. A write stores
+ *	the caller's value again and again, a read leaves the value in <buff>.
+ *	-1 if no method worked (the device is missing), the next access
+ *	measures again.
+ *********************************************************************************
+ */
+static int adapterBench(int dev, AdapterInfoType* info, int op, int add, uint8_t* buff)
+{
+	struct timespec t0;
+	struct timespec t1;
+	uint8_t val = 0;
+	uint64_t ns = 0;
+	int best = -1;
+	int m = 0;
+	int i = 0;
+	int ret = 0;
+
+	for (m = 0; m < I2C_METHOD_COUNT; m++)
+	{
+		info->costNs[op][m] = 0;
+		if (!methodSupported(info, m, op))
+		{
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (i = 0; i < ADAPTER_BENCH_LOOPS; i++)
+		{
+			val = *buff;
+			ret = (op == ADAPTER_OP_READ) ? methodRead(dev, m, add, &val, 1)
+				: methodWrite(dev, m, add, &val, 1);
+			if (ret != 0)
+			{
+				break;
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		if (i < ADAPTER_BENCH_LOOPS)
+		{
+			continue;
+		}
+		ns = (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+		info->costNs[op][m] = (ns / ADAPTER_BENCH_LOOPS > 0) ? ns / ADAPTER_BENCH_LOOPS : 1;
+		if (best < 0 || info->costNs[op][m] < info->costNs[op][best])
+		{
+			best = m;
+		}
+		*buff = val;
+	}
+	if (best < 0)
+	{
+		return -1;
+	}
+	info->method[op] = best;
+	__atomic_store_n(&info->benched[op], 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static int i2cMem8ReadRaw(int dev, int add, uint8_t* buff, int size)
+{
+	AdapterInfoType* info = NULL;
+	int bus = 0;
+
+	devAddr(dev, &bus);
+	info = adapterProbe(dev, bus);
+	if (info == NULL || size != 1)
+	{
+		return methodRead(dev, I2C_METHOD_RW, add, buff, size);
+	}
+	if (!__atomic_load_n(&info->benched[ADAPTER_OP_READ], __ATOMIC_ACQUIRE)
+		&& 0 == adapterBench(dev, info, ADAPTER_OP_READ, add, buff))
+	{
+		return 0;
+	}
+	return methodRead(dev, info->method[ADAPTER_OP_READ], add, buff, size);
+}
+
+static int i2cMem8WriteRaw(int dev, int add, uint8_t* buff, int size)
+{
+	AdapterInfoType* info = NULL;
+	int bus = 0;
+
+	devAddr(dev, &bus);
+	info = adapterProbe(dev, bus);
+	if (info == NULL || size != 1)
+	{
+		return methodWrite(dev, I2C_METHOD_RW, add, buff, size);
+	}
+	if (!__atomic_load_n(&info->benched[ADAPTER_OP_WRITE], __ATOMIC_ACQUIRE)
+		&& 0 == adapterBench(dev, info, ADAPTER_OP_WRITE, add, buff))
+	{
+		return 0;
+	}
+	return methodWrite(dev, info->method[ADAPTER_OP_WRITE], add, buff, size);
+}
+
+/*
+ * i2cMem8Read, i2cMem8Write:
+ *	Register access guarded by the device circuit breaker: a quarantined
+ *	device fails at once instead of waiting for the bus timeouts. With the
+ *	gpio backend the kernel driver does the transfer (and any mux switching).
+ *********************************************************************************
+ */
+int i2cMem8Read(int dev, int add, uint8_t* buff, int size)
+{
+	int bus = 0;
+	int addr = devAddr(dev, &bus);
+	int ret = 0;
+
+	if (!healthAllow(bus, addr))
+	{
+		return -1;
+	}
+	if (gpioEnabled())
+	{
+		ret = (size == 1) ? gpioRegRead(bus, addr, add, buff) : -1;
+	}
+	else if (0 != muxEnter(dev, bus))
+	{
+		return -1;
+	}
+	else
+	{
+		ret = i2cMem8ReadRaw(dev, add, buff, size);
+		muxLeave(bus, ret == 0);
+	}
+	healthResult(bus, addr, ret == 0);
+	return ret;
+}
 
+int i2cMem8Write(int dev, int add, uint8_t* buff, int size)
+{
+	int bus = 0;
+	int addr = devAddr(dev, &bus);
+	int ret = 0;
 
+	if (!healthAllow(bus, addr))
+	{
+		return -1;
+	}
+	if (gpioEnabled())
+	{
+		ret = (size == 1 && buff != NULL) ? gpioRegWrite(bus, addr, add, buff[0]) : -1;
+	}
+	else if (0 != muxEnter(dev, bus))
+	{
+		return -1;
+	}
+	else
+	{
+		ret = i2cMem8WriteRaw(dev, add, buff, size);
+		muxLeave(bus, ret == 0);
+	}
+	healthResult(bus, addr, ret == 0);
+	return ret;
+}
+
+/*
+ * i2cBusOpen:
+ *	Open the bus without selecting a slave, for the batched transfers
+ *********************************************************************************
+ */
+int i2cBusOpen(int bus)
+{
+	int file;
+
+	if ( (file = adapterOpen(bus)) < 0)
+	{
+		printf("Failed to open the bus.");
+		return -1;
+	}
+	if (file < COMM_DEV_MAX)
+	{
+		gDev[file].bus = bus;
+		gDev[file].addr = 0;
+	}
+	return file;
+}
+
+/*
+ * batchSingle:
+ *	One register of a batch on its own: <n> 1 for a write message, 2 for a
+ *	register read. Adapters without plain I2C get the SMBus byte-data ioctl.
+ *********************************************************************************
+ */
+static int batchSingle(int fd, AdapterInfoType* info, struct i2c_msg* msgs, int n)
+{
+	if (info == NULL || (info->funcs & I2C_FUNC_I2C))
+	{
+		return i2cTransfer(fd, msgs, n);
+	}
+	if (ioctl(fd, I2C_SLAVE, msgs[0].addr) < 0)
+	{
+		return -1;
+	}
+	if (n == 1)
+	{
+		return smbusAccess(fd, I2C_SMBUS_WRITE, msgs[0].buf[0], &msgs[0].buf[1]);
+	}
+	return smbusAccess(fd, I2C_SMBUS_READ, msgs[0].buf[0], msgs[1].buf);
+}
+
+/*
+ * batchSplit:
+ *	<n> entries of <per> messages each (1 write, 2 register read) in one
+ *	combined transfer. When it fails (an absent board NAKs and ends the
+ *	whole transfer) the halves are tried again, so only the missing boards
+ *	end up alone and the others keep sharing transfers. <ok>[i] per entry,
+ *	return the entries done.
+ *********************************************************************************
+ */
+static int batchSplit(int fd, AdapterInfoType* info, struct i2c_msg* msgs, int per, int n, int* ok)
+{
+	int i = 0;
+	int cnt = 0;
+
+	if (info != NULL && !(info->funcs & I2C_FUNC_I2C)) // SMBus only, one register per call
+	{
+		for (i = 0; i < n; i++)
+		{
+			ok[i] = (0 == batchSingle(fd, info, &msgs[per * i], per));
+			cnt += ok[i];
+		}
+		return cnt;
+	}
+	if (0 == i2cTransfer(fd, msgs, per * n))
+	{
+		for (i = 0; i < n; i++)
+		{
+			ok[i] = 1;
+		}
+		return n;
+	}
+	if (n == 1)
+	{
+		ok[0] = 0;
+		return 0;
+	}
+	cnt = batchSplit(fd, info, msgs, per, n / 2, ok);
+	return cnt + batchSplit(fd, info, &msgs[per * (n / 2)], per, n - n / 2, &ok[n / 2]);
+}
+
+/*
+ * gpioBatch:
+ *	The batch on the gpio backend: one multi-line request per device
+ *********************************************************************************
+ */
+static int gpioBatch(int bus, I2cRegType* regs, int n, int write)
+{
+	int cnt = 0;
+	int k = 0;
+
+	for (k = 0; k < n; k++)
+	{
+		regs[k].ok = 0;
+		if (!healthAllow(bus, regs[k].addr))
+		{
+			continue;
+		}
+		if (write)
+		{
+			regs[k].ok = (0 == gpioRegWrite(bus, regs[k].addr, regs[k].reg, regs[k].val));
+		}
+		else
+		{
+			regs[k].ok = (0 == gpioRegRead(bus, regs[k].addr, regs[k].reg, &regs[k].val));
+		}
+		healthResult(bus, regs[k].addr, regs[k].ok);
+		cnt += regs[k].ok;
+	}
+	return cnt;
+}
+
+/*
+ * i2cBatchWrite:
+ *	Write one register on each of <n> devices with as few transfers as
+ *	possible. If a combined transfer fails (missing device, adapter limits)
+ *	fall back to one transfer per register. Return the number of successful
+ *	writes, every entry gets its own ok flag. Quarantined devices are skipped.
+ *	An adapter without plain I2C support gets one SMBus write per register.
+ *********************************************************************************
+ */
+int i2cBatchWrite(int fd, I2cRegType* regs, int n)
+{
+	struct i2c_msg msgs[I2C_RDWR_MSGS_MAX];
+	uint8_t buff[I2C_RDWR_MSGS_MAX][2];
+	int idx[I2C_RDWR_MSGS_MAX];
+	int ok[I2C_RDWR_MSGS_MAX];
+	AdapterInfoType* info = NULL;
+	int i = 0;
+	int k = 0;
+	int chunk = 0;
+	int cnt = 0;
+	int bus = 0;
+
+	if (NULL == regs || n <= 0)
+	{
+		return -1;
+	}
+	devAddr(fd, &bus);
+	if (gpioEnabled())
+	{
+		return gpioBatch(bus, regs, n, 1);
+	}
+	info = adapterProbe(fd, bus);
+	if (0 != muxEnter(fd, bus))
+	{
+		for (k = 0; k < n; k++)
+		{
+			regs[k].ok = 0;
+		}
+		return 0;
+	}
+	for (k = 0; k < n;)
+	{
+		for (chunk = 0; k < n && chunk < I2C_RDWR_MSGS_MAX; k++)
+		{
+			regs[k].ok = 0;
+			if (!healthAllow(bus, regs[k].addr))
+			{
+				continue;
+			}
+			buff[chunk][0] = regs[k].reg;
+			buff[chunk][1] = regs[k].val;
+			msgs[chunk].addr = regs[k].addr;
+			msgs[chunk].flags = 0;
+			msgs[chunk].len = 2;
+			msgs[chunk].buf = buff[chunk];
+			idx[chunk++] = k;
+		}
+		if (chunk == 0)
+		{
+			continue;
+		}
+		cnt += batchSplit(fd, info, msgs, 1, chunk, ok);
+		for (i = 0; i < chunk; i++)
+		{
+			regs[idx[i]].ok = ok[i];
+			healthResult(bus, regs[idx[i]].addr, ok[i]);
+		}
+	}
+	muxLeave(bus, cnt > 0);
+	return cnt;
+}
+
+/*
+ * i2cBatchRead:
+ *	Read one register from each of <n> devices, same fall back as above
+ *	(some adapters accept only one read message per transfer)
+ *********************************************************************************
+ */
+int i2cBatchRead(int fd, I2cRegType* regs, int n)
+{
+	struct i2c_msg msgs[I2C_RDWR_MSGS_MAX];
+	int idx[I2C_RDWR_MSGS_MAX / 2];
+	int ok[I2C_RDWR_MSGS_MAX / 2];
+	AdapterInfoType* info = NULL;
+	int i = 0;
+	int k = 0;
+	int chunk = 0;
+	int cnt = 0;
+	int bus = 0;
+
+	if (NULL == regs || n <= 0)
+	{
+		return -1;
+	}
+	devAddr(fd, &bus);
+	if (gpioEnabled())
+	{
+		return gpioBatch(bus, regs, n, 0);
+	}
+	info = adapterProbe(fd, bus);
+	if (0 != muxEnter(fd, bus))
+	{
+		for (k = 0; k < n; k++)
+		{
+			regs[k].ok = 0;
+		}
+		return 0;
+	}
+	for (k = 0; k < n;)
+	{
+		for (chunk = 0; k < n && chunk < I2C_RDWR_MSGS_MAX / 2; k++)
+		{
+			regs[k].ok = 0;
+			if (!healthAllow(bus, regs[k].addr))
+			{
+				continue;
+			}
+			msgs[2 * chunk].addr = regs[k].addr;
+			msgs[2 * chunk].flags = 0;
+			msgs[2 * chunk].len = 1;
+			msgs[2 * chunk].buf = &regs[k].reg;
+			msgs[2 * chunk + 1].addr = regs[k].addr;
+			msgs[2 * chunk + 1].flags = I2C_M_RD;
+			msgs[2 * chunk + 1].len = 1;
+			msgs[2 * chunk + 1].buf = &regs[k].val;
+			idx[chunk++] = k;
+		}
+		if (chunk == 0)
+		{
+			continue;
+		}
+		cnt += batchSplit(fd, info, msgs, 2, chunk, ok);
+		for (i = 0; i < chunk; i++)
+		{
+			regs[idx[i]].ok = ok[i];
+			healthResult(bus, regs[idx[i]].addr, ok[i]);
+		}
+	}
+	muxLeave(bus, cnt > 0);
+	return cnt;
+}
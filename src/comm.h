@@ -3,9 +3,23 @@
 
 #include <stdint.h>
 
-int i2cSetup(int addr);
+int i2cSetup(int bus, int addr);
 int i2cMem8Read(int dev, int add, uint8_t* buff, int size);
 int i2cMem8Write(int dev, int add, uint8_t* buff, int size);
 
+#define I2C_RDWR_MSGS_MAX	42	// i2c-dev limit of messages in one transfer
+
+typedef struct
+{
+	uint8_t addr;
+	uint8_t reg;
+	uint8_t val;
+	uint8_t ok;
+} I2cRegType;
+
+int i2cBusOpen(int bus);
+int i2cBatchWrite(int fd, I2cRegType* regs, int n);
+int i2cBatchRead(int fd, I2cRegType* regs, int n);
+
 
 #endif //COMM_H_
\ No newline at end of file
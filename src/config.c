@@ -0,0 +1,244 @@
+/*
+ * config.c:
+ *	System wide settings from /etc/4relind.conf, one setting per line,
+ *	'#' starts a comment:
+ *		bus <n>		scan /dev/i2c-<n> for boards (default: bus 1 only)
+ *		mux <n> <parent> <addr> <channel>
+ *				bus <n> is not an adapter but channel <channel> of the
+ *				PCA9548 style mux at <addr> on /dev/i2c-<parent>; the boards
+ *				behind it are scanned too
+ *		modbus <port>	serve the sampled boards over Modbus TCP while the
+ *				daemon runs (0 = off, the default)
+ *		mqtt <host> [<port> [<prefix>]]
+ *				mirror the boards to an MQTT broker while the daemon runs
+ *				(default port 1883, topics under "4relind")
+ *		http <port>	serve the boards as JSON over HTTP, with a
+ *				Server-Sent Events stream of the changes (0 = off)
+ *		backend <i2c|gpio>
+ *				access the expanders with i2c-dev (default) or through
+ *				the gpiochips of the kernel gpio-pca953x driver
+ *	The file is read once per process, SM4RELIND_CONF may name another one
+ *	and SM4RELIND_BACKEND overrides the backend.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+
+#include "relay.h"
+#include "mux.h"
+#include "config.h"
+
+typedef struct
+{
+	int busCnt;
+	int buses[I2C_BUS_NR_MAX];
+	int isMux[I2C_BUS_NR_MAX];
+	ConfigMuxType mux[I2C_BUS_NR_MAX];
+	int backend;
+	int modbusPort;
+	int httpPort;
+	ConfigMqttType mqtt;
+} ConfigType;
+
+static ConfigType gConfig;
+static pthread_once_t gConfigOnce = PTHREAD_ONCE_INIT;
+
+static void busAdd(int bus)
+{
+	int i = 0;
+
+	for (i = 0; i < gConfig.busCnt && gConfig.buses[i] != bus; i++)
+		;
+	if (i == gConfig.busCnt)
+	{
+		gConfig.buses[gConfig.busCnt++] = bus;
+	}
+}
+
+static int busCheck(int bus)
+{
+	if (bus < 0 || bus >= I2C_BUS_NR_MAX)
+	{
+		printf("%s: bus %d out of range [0..%d]\n", CONFIG_FILE, bus,
+			I2C_BUS_NR_MAX - 1);
+		return ERROR;
+	}
+	return OK;
+}
+
+static void backendSet(const char* name)
+{
+	if (strcasecmp(name, "i2c") == 0)
+	{
+		gConfig.backend = CONFIG_BACKEND_I2C;
+	}
+	else if (strcasecmp(name, "gpio") == 0)
+	{
+		gConfig.backend = CONFIG_BACKEND_GPIO;
+	}
+	else
+	{
+		printf("%s: unknown backend \"%s\"\n", CONFIG_FILE, name);
+	}
+}
+
+static void configLoad(void)
+{
+	FILE* file = NULL;
+	char line[128];
+	char name[16];
+	char* p = NULL;
+	ConfigMqttType mqtt;
+	ConfigMuxType mux;
+	int bus = 0;
+
+	memset(&gConfig, 0, sizeof(gConfig));
+	file = fopen(getenv(CONFIG_ENV) ? getenv(CONFIG_ENV) : CONFIG_FILE, "r");
+	while (file != NULL && fgets(line, sizeof(line), file) != NULL)
+	{
+		if ( (p = strpbrk(line, "#\r\n")) != NULL)
+		{
+			*p = 0;
+		}
+		mqtt.port = MQTT_PORT_DEFAULT;
+		strcpy(mqtt.prefix, MQTT_PREFIX_DEFAULT);
+		if (sscanf(line, " bus %d", &bus) == 1)
+		{
+			if (OK == busCheck(bus))
+			{
+				busAdd(bus);
+			}
+		}
+		else if (sscanf(line, " mux %d %d %i %d", &bus, &mux.parent, &mux.addr,
+			&mux.channel) == 4)
+		{
+			if (OK != busCheck(bus) || OK != busCheck(mux.parent))
+			{
+				continue;
+			}
+			if (mux.addr < MUX_ADDR_BASE || mux.addr >= MUX_ADDR_BASE + MUX_PER_BUS
+				|| mux.channel < 0 || mux.channel >= MUX_CH_NR_MAX
+				|| bus == mux.parent)
+			{
+				printf("%s: invalid mux line \"%s\"\n", CONFIG_FILE, line);
+				continue;
+			}
+			gConfig.isMux[bus] = 1;
+			gConfig.mux[bus] = mux;
+			busAdd(bus);
+		}
+		else if (sscanf(line, " modbus %d", &gConfig.modbusPort) == 1)
+		{
+			if (gConfig.modbusPort < 0 || gConfig.modbusPort > 65535)
+			{
+				printf("%s: invalid modbus port %d\n", CONFIG_FILE, gConfig.modbusPort);
+				gConfig.modbusPort = 0;
+			}
+		}
+		else if (sscanf(line, " http %d", &gConfig.httpPort) == 1)
+		{
+			if (gConfig.httpPort < 0 || gConfig.httpPort > 65535)
+			{
+				printf("%s: invalid http port %d\n", CONFIG_FILE, gConfig.httpPort);
+				gConfig.httpPort = 0;
+			}
+		}
+		else if (sscanf(line, " mqtt %63s %d %31s", mqtt.host, &mqtt.port, mqtt.prefix) >= 1)
+		{
+			gConfig.mqtt = mqtt;
+		}
+		else if (sscanf(line, " backend %15s", name) == 1)
+		{
+			backendSet(name);
+		}
+	}
+	if (file != NULL)
+	{
+		fclose(file);
+	}
+	if (gConfig.busCnt == 0)
+	{
+		busAdd(I2C_BUS_DEFAULT);
+	}
+	if (getenv(BACKEND_ENV) != NULL)
+	{
+		backendSet(getenv(BACKEND_ENV));
+	}
+}
+
+/*
+ * configBusesGet:
+ *	Fill <buses> (I2C_BUS_NR_MAX entries) with the configured bus numbers,
+ *	in file order without duplicates, return the count
+ *********************************************************************************
+ */
+int configBusesGet(int* buses)
+{
+	pthread_once(&gConfigOnce, configLoad);
+	memcpy(buses, gConfig.buses, gConfig.busCnt * sizeof(int));
+	return gConfig.busCnt;
+}
+
+/*
+ * configMuxGet:
+ *	OK and the mux route if <bus> sits behind a mux, ERROR for an adapter
+ *********************************************************************************
+ */
+int configMuxGet(int bus, ConfigMuxType* mux)
+{
+	pthread_once(&gConfigOnce, configLoad);
+	if (bus < 0 || bus >= I2C_BUS_NR_MAX || !gConfig.isMux[bus])
+	{
+		return ERROR;
+	}
+	if (mux != NULL)
+	{
+		*mux = gConfig.mux[bus];
+	}
+	return OK;
+}
+
+/*
+ * configBackendGet:
+ *	CONFIG_BACKEND_I2C or CONFIG_BACKEND_GPIO
+ *********************************************************************************
+ */
+int configBackendGet(void)
+{
+	pthread_once(&gConfigOnce, configLoad);
+	return gConfig.backend;
+}
+
+int configModbusPortGet(void)
+{
+	pthread_once(&gConfigOnce, configLoad);
+	return gConfig.modbusPort;
+}
+
+int configHttpPortGet(void)
+{
+	pthread_once(&gConfigOnce, configLoad);
+	return gConfig.httpPort;
+}
+
+/*
+ * configMqttGet:
+ *	OK and the broker settings if the MQTT bridge is configured
+ *********************************************************************************
+ */
+int configMqttGet(ConfigMqttType* mqtt)
+{
+	pthread_once(&gConfigOnce, configLoad);
+	if (gConfig.mqtt.host[0] == 0)
+	{
+		return ERROR;
+	}
+	*mqtt = gConfig.mqtt;
+	return OK;
+}
@@ -0,0 +1,38 @@
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#define CONFIG_FILE	"/etc/4relind.conf"
+#define CONFIG_ENV	"SM4RELIND_CONF"	// overrides CONFIG_FILE
+#define BACKEND_ENV	"SM4RELIND_BACKEND"	// overrides the backend setting
+
+typedef enum
+{
+	CONFIG_BACKEND_I2C = 0,	// raw i2c-dev transfers
+	CONFIG_BACKEND_GPIO		// gpiochips of the gpio-pca953x driver
+} ConfigBackendType;
+
+typedef struct
+{
+	int parent;		// adapter bus number
+	int addr;		// mux I2C address
+	int channel;
+} ConfigMuxType;
+
+#define MQTT_PORT_DEFAULT	1883
+#define MQTT_PREFIX_DEFAULT	"4relind"
+
+typedef struct
+{
+	char host[64];	// empty = no MQTT bridge
+	int port;
+	char prefix[32];	// topic root
+} ConfigMqttType;
+
+int configBusesGet(int* buses);
+int configMuxGet(int bus, ConfigMuxType* mux);
+int configBackendGet(void);
+int configModbusPortGet(void);
+int configHttpPortGet(void);
+int configMqttGet(ConfigMqttType* mqtt);
+
+#endif //CONFIG_H_
@@ -0,0 +1,422 @@
+/*
+ * daemon.c:
+ *	Background sampler for all the detected 4relind boards.
+ *	Every period the input port of each board is read once and the decoded
+ *	relay/input state is appended to the history log when it changes.
+ *	The same changes feed the on-time summaries used by "stats" and the
+ *	relay wear counters (catching writes done by other programs).
+ *	While the daemon runs the writers skip the read back: the sample checks
+ *	the pending writes and rewrites the boards that do not match.
+ *	Every bus is sampled by its own worker thread, the buses in parallel;
+ *	the samples are then processed here.
+ *	A board that stops answering is quarantined by the comm layer circuit
+ *	breaker, the sampling loop keeps serving the others and its periodic
+ *	read acts as the recovery probe.
+ *	Between two samples the daemon runs the event loop of the network
+ *	services: their reads are answered from the last samples and their
+ *	relay writes are applied here, batched per bus.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
+
+#include "relay.h"
+#include "comm.h"
+#include "thread.h"
+#include "history.h"
+#include "rollup.h"
+#include "wear.h"
+#include "journal.h"
+#include "shadow.h"
+#include "metrics.h"
+#include "worker.h"
+#include "evloop.h"
+#include "config.h"
+#include "modbus.h"
+#include "mqtt.h"
+#include "http.h"
+#include "daemon.h"
+
+typedef struct
+{
+	int id;
+	int dev;
+	int valid;
+	int offline;
+	u8 state;
+	u8 io;	// last sample
+	int ok;
+} DaemonBoardType;
+
+typedef struct
+{
+	DaemonBoardType* boards;
+	int cnt;
+} DaemonBusType;
+
+static volatile sig_atomic_t gStop = 0;
+static DaemonBoardType gBoards[BOARD_NR_MAX];
+static int gBoardCnt = 0;
+static int gBoardIdx[BOARD_NR_MAX];	// index in gBoards + 1, 0 = not sampled
+static int gPidFd = -1;	// holds the pid file lock while sampling
+
+static void daemonSignal(int sig)
+{
+	(void)sig;
+	gStop = 1;
+}
+
+/*
+ * daemonIsRunning:
+ *	1 if a sampler daemon is alive, i.e. holds the pid file lock
+ *********************************************************************************
+ */
+int daemonIsRunning(void)
+{
+	int fd = -1;
+	int running = 0;
+
+	fd = open(mmPath(DAEMON_PID_FILE), O_RDONLY);
+	if (fd < 0)
+	{
+		return 0;
+	}
+	if (flock(fd, LOCK_SH | LOCK_NB) == 0)
+	{
+		flock(fd, LOCK_UN);
+	}
+	else
+	{
+		running = (errno == EWOULDBLOCK);
+	}
+	close(fd);
+	return running;
+}
+
+/*
+ * pidFileLock:
+ *	Lock and write the pid file, kept locked until pidFileUnlock()
+ *********************************************************************************
+ */
+static int pidFileLock(void)
+{
+	char buff[16];
+	int len = 0;
+
+	if (0 != mmDirCreate(RUN_DIR))
+	{
+		return ERROR;
+	}
+	gPidFd = open(mmPath(DAEMON_PID_FILE), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (gPidFd < 0)
+	{
+		return ERROR;
+	}
+	if (flock(gPidFd, LOCK_EX | LOCK_NB) != 0)
+	{
+		close(gPidFd);
+		gPidFd = -1;
+		return ERROR;
+	}
+	len = snprintf(buff, sizeof(buff), "%d\n", (int)getpid());
+	if (ftruncate(gPidFd, 0) != 0 || write(gPidFd, buff, len) != len)
+	{
+		printf("Fail to write %s\n", mmPath(DAEMON_PID_FILE));
+	}
+	return OK;
+}
+
+static void pidFileUnlock(void)
+{
+	if (gPidFd < 0)
+	{
+		return;
+	}
+	unlink(mmPath(DAEMON_PID_FILE));
+	close(gPidFd);
+	gPidFd = -1;
+}
+
+/*
+ * daemonVerify:
+ *	Check the pending write of one board against the port sampled from
+ *	<sampleMs> on. Return 0 if a newer write makes the sample stale.
+ *********************************************************************************
+ */
+static int daemonVerify(DaemonBoardType* board, u8 io, uint64_t sampleMs)
+{
+	u8 expect = 0;
+
+	switch (shadowVerify(board->id, io & 0xf0, sampleMs, &expect))
+	{
+	case SHADOW_VERIFY_NEWER:
+		return 0;
+	case SHADOW_VERIFY_REWRITE:
+		if (OK == i2cMem8Write(board->dev, RELAY8_OUTPORT_REG_ADD, &expect, 1))
+		{
+			metricInc(METRIC_VERIFY_REWRITES, board->id);
+		}
+		break;
+	case SHADOW_VERIFY_FAIL:
+		printf("Fail to write relays on board #%s\n", boardIdStr(board->id));
+		break;
+	default:
+		break;
+	}
+	return 1;
+}
+
+/*
+ * busSampleJob:
+ *	Read the input port of every board on one bus (bus worker)
+ *********************************************************************************
+ */
+static void busSampleJob(void* arg)
+{
+	DaemonBusType* bus = (DaemonBusType*)arg;
+	int i = 0;
+
+	for (i = 0; i < bus->cnt; i++)
+	{
+		bus->boards[i].ok = (OK == i2cMem8Read(bus->boards[i].dev,
+			RELAY8_INPORT_REG_ADD, &bus->boards[i].io, 1));
+	}
+}
+
+/*
+ * daemonBoardGet:
+ *	Relays and inputs of board <id> from the last sample: DAEMON_BOARD_OK,
+ *	DAEMON_BOARD_OFFLINE (last sample failed) or DAEMON_BOARD_ABSENT
+ *********************************************************************************
+ */
+int daemonBoardGet(int id, u8* relays, u8* inputs)
+{
+	DaemonBoardType* b = NULL;
+
+	if (id < 0 || id >= BOARD_NR_MAX || gBoardIdx[id] == 0)
+	{
+		return DAEMON_BOARD_ABSENT;
+	}
+	b = &gBoards[gBoardIdx[id] - 1];
+	if (b->offline || !b->valid)
+	{
+		return DAEMON_BOARD_OFFLINE;
+	}
+	*relays = IOToRelay(b->io);
+	*inputs = IOToIn(b->io, boardPolInvGet(b->id));
+	return DAEMON_BOARD_OK;
+}
+
+/*
+ * daemonRelaysApply:
+ *	Change the relays in <masks>[i] of board <ids>[i] to <vals>[i], all the
+ *	boards with one batched write per bus. The other relays keep the value
+ *	of the shadow, which also holds CLI writes made since the last sample.
+ *	Boards absent or offline are skipped, the others are still written.
+ *	The sampled state is updated at once, the next sample verifies it.
+ *	Return the number of boards written.
+ *********************************************************************************
+ */
+int daemonRelaysApply(const int* ids, const u8* masks, const u8* vals, int n)
+{
+	int wIds[BOARD_NR_MAX];
+	u8 relays[BOARD_NR_MAX];
+	int ok[BOARD_NR_MAX];
+	u8 inputs = 0;
+	u8 io = 0;
+	uint64_t now = timeMsGet();
+	int cnt = 0;
+	int m = 0;
+	int i = 0;
+
+	if (n <= 0 || n > BOARD_NR_MAX)
+	{
+		return 0;
+	}
+	for (i = 0; i < n; i++)
+	{
+		if (DAEMON_BOARD_OK != daemonBoardGet(ids[i], &relays[m], &inputs))
+		{
+			continue;
+		}
+		if (OK == shadowGet(ids[i], &io, now))
+		{
+			relays[m] = IOToRelay(io);
+		}
+		relays[m] = (relays[m] & ~masks[i]) | (vals[i] & masks[i]);
+		wIds[m++] = ids[i];
+	}
+	if (m == 0)
+	{
+		return 0;
+	}
+	cnt = boardRelaysWrite(wIds, relays, ok, m);
+	for (i = 0; i < m; i++)
+	{
+		if (ok[i])
+		{
+			gBoards[gBoardIdx[wIds[i]] - 1].io = relayToIO(relays[i])
+				| (gBoards[gBoardIdx[wIds[i]] - 1].io & 0x0f);
+		}
+	}
+	return cnt;
+}
+
+/*
+ * daemonRun:
+ *	Sample all boards until SIGINT/SIGTERM
+ *********************************************************************************
+ */
+int daemonRun(int periodMs)
+{
+	DaemonBoardType* boards = gBoards;
+	DaemonBusType buses[I2C_BUS_NR_MAX];
+	DaemonBoardType* b = NULL;
+	ConfigMqttType mqtt;
+	int ids[BOARD_NR_MAX];
+	int cnt = 0;
+	int i = 0;
+	int bus = 0;
+	u8 state = 0;
+	uint64_t now = 0;
+	uint64_t sampleMs = 0;
+
+	if (OK != pidFileLock())
+	{
+		printf("A 4relind daemon is already running (%s)\n", mmPath(DAEMON_PID_FILE));
+		return ERROR;
+	}
+	memset(gBoards, 0, sizeof(gBoards));
+	memset(gBoardIdx, 0, sizeof(gBoardIdx));
+	memset(buses, 0, sizeof(buses));
+	cnt = boardListGet(ids);
+	if (cnt == 0)
+	{
+		printf("No 4relind board detected\n");
+		pidFileUnlock();
+		return ERROR;
+	}
+	for (i = 0; i < cnt; i++)
+	{
+		boards[i].id = ids[i];
+		boards[i].dev = doBoardInit(ids[i]);
+		if (boards[i].dev <= 0)
+		{
+			pidFileUnlock();
+			return ERROR;
+		}
+		gBoardIdx[ids[i]] = i + 1;
+		// boardListGet() returns the boards grouped by bus
+		bus = BOARD_BUS(ids[i]);
+		if (buses[bus].cnt == 0)
+		{
+			buses[bus].boards = &boards[i];
+		}
+		buses[bus].cnt++;
+	}
+	if (OK != histOpen())
+	{
+		printf("Fail to open the history log in %s\n", mmPath(HIST_DIR));
+		pidFileUnlock();
+		return ERROR;
+	}
+	if (OK != rollupOpen(1))
+	{
+		printf("Fail to open %s\n", mmPath(ROLLUP_FILE));
+		histClose();
+		pidFileUnlock();
+		return ERROR;
+	}
+
+	gBoardCnt = cnt;
+	if (configModbusPortGet() > 0 && OK != modbusStart(configModbusPortGet()))
+	{
+		printf("Fail to start the Modbus TCP server on port %d\n", configModbusPortGet());
+	}
+	if (configHttpPortGet() > 0 && OK != httpStart(configHttpPortGet()))
+	{
+		printf("Fail to start the HTTP server on port %d\n", configHttpPortGet());
+	}
+	if (OK == configMqttGet(&mqtt) && OK != mqttStart(&mqtt))
+	{
+		printf("Fail to resolve the MQTT broker %s\n", mqtt.host);
+	}
+	journalSyncDefer(1, 0); // journalFlush() after every sample
+	signal(SIGINT, daemonSignal);
+	signal(SIGTERM, daemonSignal);
+	while (!gStop)
+	{
+		sampleMs = timeMsGet();
+		for (bus = 0; bus < I2C_BUS_NR_MAX; bus++)
+		{
+			if (buses[bus].cnt > 0)
+			{
+				workerSubmit(bus, busSampleJob, &buses[bus]);
+			}
+		}
+		workerWait();
+		now = timeMsGet();
+		for (i = 0; i < gBoardCnt; i++)
+		{
+			b = &boards[i];
+			if (!b->ok)
+			{
+				if (!b->offline)
+				{
+					printf("Board %s not responding\n", boardIdStr(b->id));
+					b->offline = 1;
+				}
+				continue;
+			}
+			if (b->offline)
+			{
+				printf("Board %s recovered\n", boardIdStr(b->id));
+				b->offline = 0;
+				b->valid = 0;
+			}
+			if (daemonVerify(b, b->io, sampleMs))
+			{
+				shadowSet(b->id, b->io & 0xf0, now);
+			}
+			state = HIST_STATE(IOToRelay(b->io), IOToIn(b->io, boardPolInvGet(b->id)));
+			if (!b->valid || state != b->state)
+			{
+				histAppend(b->id, state, now);
+				rollupUpdate(b->id, state, now);
+				wearRecord(b->id, HIST_RELAYS(state), now);
+				journalRecord(b->id, HIST_RELAYS(state), now);
+				b->state = state;
+				b->valid = 1;
+			}
+		}
+		journalFlush(now);
+		mqttTick(now);
+		httpTick(now);
+		evRun(periodMs);
+	}
+	mqttStop();
+	httpStop();
+	modbusStop();
+	workerStopAll();
+	now = timeMsGet();
+	for (i = 0; i < gBoardCnt; i++) // close the summaries at the stop time
+	{
+		if (boards[i].valid && !boards[i].offline)
+		{
+			rollupUpdate(boards[i].id, boards[i].state, now);
+		}
+	}
+	journalSyncDefer(0, now);
+	pidFileUnlock();
+	rollupClose();
+	histClose();
+	return OK;
+}
@@ -0,0 +1,22 @@
+#ifndef DAEMON_H_
+#define DAEMON_H_
+
+#include "relay.h"
+#include "mmfile.h"
+
+#define DAEMON_PERIOD_MS_DEFAULT	20
+#define DAEMON_PERIOD_MS_MIN		1
+
+#define DAEMON_PID_FILE	RUN_DIR "/daemon.pid"
+
+// daemonBoardGet() results
+#define DAEMON_BOARD_OK			0
+#define DAEMON_BOARD_OFFLINE	1	// present but the last sample failed
+#define DAEMON_BOARD_ABSENT		-1	// not detected at start
+
+int daemonRun(int periodMs);
+int daemonIsRunning(void);
+int daemonBoardGet(int id, u8* relays, u8* inputs);
+int daemonRelaysApply(const int* ids, const u8* masks, const u8* vals, int n);
+
+#endif //DAEMON_H_
@@ -0,0 +1,147 @@
+/*
+ * evloop.c:
+ *	Single threaded epoll loop of the daemon. The network services register
+ *	their sockets with a handler; the daemon runs the loop between two
+ *	samples instead of sleeping, so every request is served from the
+ *	sampled state by the thread that owns it.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "relay.h"
+#include "thread.h"
+#include "gpio.h"
+#include "evloop.h"
+
+typedef struct
+{
+	EvHandlerType handler;
+	void* arg;
+} EvWatchType;
+
+static int gEpollFd = -1;
+static EvWatchType gWatch[EV_FD_MAX];
+
+static uint64_t evTimeMsGet(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int evInit(void)
+{
+	if (gEpollFd >= 0)
+	{
+		return OK;
+	}
+	gEpollFd = epoll_create1(EPOLL_CLOEXEC);
+	return (gEpollFd < 0) ? ERROR : OK;
+}
+
+/*
+ * evAdd, evMod, evDel:
+ *	Watch <fd> for <events> (EPOLLIN, EPOLLOUT ...) and call <handler>
+ *	with the ready events and <arg>
+ *********************************************************************************
+ */
+int evAdd(int fd, uint32_t events, EvHandlerType handler, void* arg)
+{
+	struct epoll_event ev;
+
+	if (fd < 0 || fd >= EV_FD_MAX || handler == NULL || OK != evInit())
+	{
+		return ERROR;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fd;
+	if (epoll_ctl(gEpollFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+	{
+		return ERROR;
+	}
+	gWatch[fd].handler = handler;
+	gWatch[fd].arg = arg;
+	return OK;
+}
+
+int evMod(int fd, uint32_t events)
+{
+	struct epoll_event ev;
+
+	if (fd < 0 || fd >= EV_FD_MAX || gWatch[fd].handler == NULL)
+	{
+		return ERROR;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fd;
+	return (epoll_ctl(gEpollFd, EPOLL_CTL_MOD, fd, &ev) < 0) ? ERROR : OK;
+}
+
+void evDel(int fd)
+{
+	if (fd < 0 || fd >= EV_FD_MAX || gWatch[fd].handler == NULL)
+	{
+		return;
+	}
+	epoll_ctl(gEpollFd, EPOLL_CTL_DEL, fd, NULL);
+	gWatch[fd].handler = NULL;
+	gWatch[fd].arg = NULL;
+}
+
+/*
+ * evRun:
+ *	Dispatch the ready descriptors for <ms> milliseconds, return earlier
+ *	on a signal. Without any watched descriptor this is a plain sleep.
+ *********************************************************************************
+ */
+void evRun(int ms)
+{
+	struct epoll_event ev[EV_BATCH_MAX];
+	uint64_t end = evTimeMsGet() + ms;
+	uint64_t now = 0;
+	int n = 0;
+	int i = 0;
+	int fd = 0;
+
+	if (OK != evInit())
+	{
+		gpioRelease();
+		busyWait(ms);
+		return;
+	}
+	while ( (now = evTimeMsGet()) < end)
+	{
+		gpioRelease(); // the lines are free for the other processes while waiting
+		n = epoll_wait(gEpollFd, ev, EV_BATCH_MAX, (int)(end - now));
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				return;
+			}
+			busyWait((int)(end - now));
+			return;
+		}
+		for (i = 0; i < n; i++)
+		{
+			fd = ev[i].data.fd;
+			// an earlier handler of this batch may have closed it
+			if (fd >= 0 && fd < EV_FD_MAX && gWatch[fd].handler != NULL)
+			{
+				gWatch[fd].handler(fd, ev[i].events, gWatch[fd].arg);
+			}
+		}
+	}
+}
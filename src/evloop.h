@@ -0,0 +1,18 @@
+#ifndef EVLOOP_H_
+#define EVLOOP_H_
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#define EV_FD_MAX		1024	// descriptors the loop can watch
+#define EV_BATCH_MAX	32		// events taken per epoll_wait()
+
+typedef void (*EvHandlerType)(int fd, uint32_t events, void* arg);
+
+int evInit(void);
+int evAdd(int fd, uint32_t events, EvHandlerType handler, void* arg);
+int evMod(int fd, uint32_t events);
+void evDel(int fd);
+void evRun(int ms);
+
+#endif //EVLOOP_H_
@@ -0,0 +1,529 @@
+/*
+ * fs.c:
+ *	4relind-fs, FUSE file system for the programs that can only read and
+ *	write files:
+ *		/stack<id>/relay<ch>	"1" or "0", write 1/0/on/off to change it
+ *		/stack<id>/input<ch>	"1" or "0", read only
+ *	<id> as on the command line ("0", "2.3"). A sampler thread reads all the
+ *	boards every FS_PERIOD_MS with one batched transfer per bus; the files
+ *	are read from the shadow and from this cache, never from the bus.
+ *	poll() on an input reports POLLIN | POLLPRI once the input changed since
+ *	the file was last read, so a reader can sleep until the next edge.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#define FUSE_USE_VERSION 31
+
+#include <fuse.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "relay.h"
+#include "thread.h"
+#include "shadow.h"
+#include "worker.h"
+#include "gpio.h"
+#include "fs.h"
+
+typedef struct FsFileType
+{
+	int id;
+	int ch;
+	int isIn;
+	unsigned gen;	// edge count of the input when last read
+	struct fuse_pollhandle* ph;
+	struct FsFileType* next;
+	struct FsFileType* prev;
+} FsFileType;
+
+typedef struct
+{
+	u8 valid;
+	u8 relays;
+	u8 inputs;
+	unsigned gen[IN_CH_NR_MAX];	// edges seen on every input
+	uint64_t wrMs;	// last write, older samples keep the written relays
+} FsBoardType;
+
+static int gIds[BOARD_NR_MAX];
+static int gCnt = 0;
+static FsBoardType gBoard[BOARD_NR_MAX];
+static FsFileType* gFiles = NULL;	// open inputs, for the poll wake up
+static pthread_mutex_t gLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t gSampler;
+static volatile int gStop = 0;
+
+/*
+ * pathParse:
+ *	"/stack<id>[/relay<ch>|/input<ch>]" to id and channel (0 for the
+ *	directory), ERROR if no such file
+ *********************************************************************************
+ */
+static int pathParse(const char* path, int* id, int* ch, int* isIn)
+{
+	char idStr[16];
+	const char* p = NULL;
+	int len = 0;
+	int i = 0;
+
+	if (strncmp(path, "/stack", 6) != 0)
+	{
+		return ERROR;
+	}
+	path += 6;
+	p = strchr(path, '/');
+	len = (p == NULL) ? (int)strlen(path) : p - path;
+	if (len <= 0 || len >= (int)sizeof(idStr))
+	{
+		return ERROR;
+	}
+	memcpy(idStr, path, len);
+	idStr[len] = 0;
+	*id = boardIdParse(idStr);
+	for (i = 0; i < gCnt && gIds[i] != *id; i++)
+		;
+	if (*id < 0 || i == gCnt)
+	{
+		return ERROR;
+	}
+	*ch = 0;
+	*isIn = 0;
+	if (p == NULL)
+	{
+		return OK;
+	}
+	if (sscanf(p, "/relay%d", ch) == 1)
+	{
+		*isIn = 0;
+	}
+	else if (sscanf(p, "/input%d", ch) == 1)
+	{
+		*isIn = 1;
+	}
+	else
+	{
+		return ERROR;
+	}
+	if (*ch < CHANNEL_NR_MIN || *ch > (*isIn ? IN_CH_NR_MAX : RELAY_CH_NR_MAX))
+	{
+		return ERROR;
+	}
+	// no leading zeros or trailing characters
+	snprintf(idStr, sizeof(idStr), "/%s%d", *isIn ? "input" : "relay", *ch);
+	return (strcmp(p, idStr) == 0) ? OK : ERROR;
+}
+
+/*
+ * relaysGet:
+ *	Relays of <id> from the shadow if recent, from the sampler otherwise
+ *********************************************************************************
+ */
+static int relaysGet(int id, u8* relays)
+{
+	u8 out = 0;
+
+	if (OK == shadowGet(id, &out, timeMsGet()))
+	{
+		*relays = IOToRelay(out);
+		return OK;
+	}
+	if (!gBoard[id].valid)
+	{
+		return ERROR;
+	}
+	*relays = gBoard[id].relays;
+	return OK;
+}
+
+static void* samplerThread(void* arg)
+{
+	BoardSnapshotType snaps[BOARD_NR_MAX];
+	FsBoardType* b = NULL;
+	FsFileType* f = NULL;
+	u8 changed = 0;
+	int i = 0;
+	int ch = 0;
+	uint64_t start = 0;
+
+	(void)arg;
+	while (!gStop)
+	{
+		start = timeMsGet();
+		boardSnapshotAll(gIds, snaps, gCnt);
+		pthread_mutex_lock(&gLock);
+		for (i = 0; i < gCnt; i++)
+		{
+			b = &gBoard[gIds[i]];
+			if (!snaps[i].ok)
+			{
+				b->valid = 0;
+				continue;
+			}
+			changed = b->valid ? (b->inputs ^ snaps[i].inputs) : 0;
+			for (ch = 0; ch < IN_CH_NR_MAX; ch++)
+			{
+				b->gen[ch] += (changed >> ch) & 1;
+			}
+			b->inputs = snaps[i].inputs;
+			b->valid = 1;
+			if (b->wrMs < start)
+			{
+				b->relays = snaps[i].relays;
+				shadowSet(gIds[i], relayToIO(snaps[i].relays), snaps[i].timeMs);
+			}
+		}
+		for (f = gFiles; f != NULL; f = f->next)
+		{
+			if (f->ph != NULL && f->gen != gBoard[f->id].gen[f->ch - 1])
+			{
+				fuse_notify_poll(f->ph);
+				fuse_pollhandle_destroy(f->ph);
+				f->ph = NULL;
+			}
+		}
+		gpioRelease(); // under gLock, no write is using the lines
+		pthread_mutex_unlock(&gLock);
+		usleep(FS_PERIOD_MS * 1000);
+	}
+	return NULL;
+}
+
+static void* fsInit(struct fuse_conn_info* conn, struct fuse_config* cfg)
+{
+	(void)conn;
+	// the tree never changes and every read goes to fsRead()
+	cfg->entry_timeout = FS_ATTR_TIMEOUT_S;
+	cfg->attr_timeout = FS_ATTR_TIMEOUT_S;
+	cfg->negative_timeout = FS_ATTR_TIMEOUT_S;
+	cfg->direct_io = 1;
+	cfg->kernel_cache = 0;
+	// started here, after fuse_main() went to the background
+	pthread_create(&gSampler, NULL, samplerThread, NULL);
+	return NULL;
+}
+
+static void fsDestroy(void* data)
+{
+	(void)data;
+	gStop = 1;
+	pthread_join(gSampler, NULL);
+}
+
+static int fsGetattr(const char* path, struct stat* st, struct fuse_file_info* fi)
+{
+	int id = 0;
+	int ch = 0;
+	int isIn = 0;
+
+	(void)fi;
+	memset(st, 0, sizeof(*st));
+	if (strcmp(path, "/") == 0)
+	{
+		st->st_mode = S_IFDIR | 0755;
+		st->st_nlink = 2 + gCnt;
+		return 0;
+	}
+	if (OK != pathParse(path, &id, &ch, &isIn))
+	{
+		return -ENOENT;
+	}
+	if (ch == 0)
+	{
+		st->st_mode = S_IFDIR | 0755;
+		st->st_nlink = 2;
+		return 0;
+	}
+	st->st_mode = S_IFREG | (isIn ? 0444 : 0666);
+	st->st_nlink = 1;
+	st->st_size = 2;
+	return 0;
+}
+
+static int fsReaddir(const char* path, void* buf, fuse_fill_dir_t filler, off_t off,
+	struct fuse_file_info* fi, enum fuse_readdir_flags flags)
+{
+	char name[24];
+	int id = 0;
+	int ch = 0;
+	int isIn = 0;
+	int i = 0;
+
+	(void)off;
+	(void)fi;
+	(void)flags;
+	filler(buf, ".", NULL, 0, 0);
+	filler(buf, "..", NULL, 0, 0);
+	if (strcmp(path, "/") == 0)
+	{
+		for (i = 0; i < gCnt; i++)
+		{
+			snprintf(name, sizeof(name), "stack%s", boardIdStr(gIds[i]));
+			filler(buf, name, NULL, 0, 0);
+		}
+		return 0;
+	}
+	if (OK != pathParse(path, &id, &ch, &isIn) || ch != 0)
+	{
+		return -ENOENT;
+	}
+	for (i = CHANNEL_NR_MIN; i <= RELAY_CH_NR_MAX; i++)
+	{
+		snprintf(name, sizeof(name), "relay%d", i);
+		filler(buf, name, NULL, 0, 0);
+	}
+	for (i = CHANNEL_NR_MIN; i <= IN_CH_NR_MAX; i++)
+	{
+		snprintf(name, sizeof(name), "input%d", i);
+		filler(buf, name, NULL, 0, 0);
+	}
+	return 0;
+}
+
+static int fsOpen(const char* path, struct fuse_file_info* fi)
+{
+	FsFileType* f = NULL;
+	int id = 0;
+	int ch = 0;
+	int isIn = 0;
+
+	if (OK != pathParse(path, &id, &ch, &isIn) || ch == 0)
+	{
+		return -ENOENT;
+	}
+	if (isIn && (fi->flags & O_ACCMODE) != O_RDONLY)
+	{
+		return -EACCES;
+	}
+	f = calloc(1, sizeof(FsFileType));
+	if (f == NULL)
+	{
+		return -ENOMEM;
+	}
+	f->id = id;
+	f->ch = ch;
+	f->isIn = isIn;
+	fi->fh = (uint64_t)(uintptr_t)f;
+	fi->direct_io = 1;
+	fi->nonseekable = 0;
+	pthread_mutex_lock(&gLock);
+	f->gen = isIn ? gBoard[id].gen[ch - 1] : 0;
+	if (isIn)
+	{
+		f->next = gFiles;
+		if (gFiles != NULL)
+		{
+			gFiles->prev = f;
+		}
+		gFiles = f;
+	}
+	pthread_mutex_unlock(&gLock);
+	return 0;
+}
+
+static int fsRelease(const char* path, struct fuse_file_info* fi)
+{
+	FsFileType* f = (FsFileType*)(uintptr_t)fi->fh;
+
+	(void)path;
+	pthread_mutex_lock(&gLock);
+	if (f->isIn)
+	{
+		if (f->prev != NULL)
+		{
+			f->prev->next = f->next;
+		}
+		else
+		{
+			gFiles = f->next;
+		}
+		if (f->next != NULL)
+		{
+			f->next->prev = f->prev;
+		}
+	}
+	if (f->ph != NULL)
+	{
+		fuse_pollhandle_destroy(f->ph);
+	}
+	pthread_mutex_unlock(&gLock);
+	free(f);
+	return 0;
+}
+
+static int fsRead(const char* path, char* buf, size_t size, off_t off,
+	struct fuse_file_info* fi)
+{
+	FsFileType* f = (FsFileType*)(uintptr_t)fi->fh;
+	char val[3];
+	u8 bits = 0;
+	int ret = OK;
+
+	(void)path;
+	pthread_mutex_lock(&gLock);
+	if (f->isIn)
+	{
+		ret = gBoard[f->id].valid ? OK : ERROR;
+		bits = gBoard[f->id].inputs;
+		f->gen = gBoard[f->id].gen[f->ch - 1];
+	}
+	else
+	{
+		ret = relaysGet(f->id, &bits);
+	}
+	pthread_mutex_unlock(&gLock);
+	if (OK != ret)
+	{
+		return -EIO;
+	}
+	snprintf(val, sizeof(val), "%d\n", (bits >> (f->ch - 1)) & 1);
+	if (off >= 2)
+	{
+		return 0;
+	}
+	if (size > (size_t)(2 - off))
+	{
+		size = 2 - off;
+	}
+	memcpy(buf, &val[off], size);
+	return size;
+}
+
+static int fsWrite(const char* path, const char* buf, size_t size, off_t off,
+	struct fuse_file_info* fi)
+{
+	FsFileType* f = (FsFileType*)(uintptr_t)fi->fh;
+	char val[8];
+	u8 relays = 0;
+	int ok = 0;
+	int on = 0;
+	int len = 0;
+
+	(void)path;
+	(void)off;
+	len = (size < sizeof(val)) ? (int)size : (int)sizeof(val) - 1;
+	memcpy(val, buf, len);
+	val[len] = 0;
+	while (len > 0 && (val[len - 1] == '\n' || val[len - 1] == '\r' || val[len - 1] == ' '))
+	{
+		val[--len] = 0;
+	}
+	if (strcasecmp(val, "on") == 0 || strcmp(val, "1") == 0)
+	{
+		on = 1;
+	}
+	else if (strcasecmp(val, "off") != 0 && strcmp(val, "0") != 0)
+	{
+		return -EINVAL;
+	}
+	// serialized: the other relays of the board are written back unchanged
+	pthread_mutex_lock(&gLock);
+	if (OK != relaysGet(f->id, &relays))
+	{
+		pthread_mutex_unlock(&gLock);
+		return -EIO;
+	}
+	if (on)
+	{
+		relays |= 1 << (f->ch - 1);
+	}
+	else
+	{
+		relays &= ~(1 << (f->ch - 1));
+	}
+	if (1 == boardRelaysWrite(&f->id, &relays, &ok, 1))
+	{
+		gBoard[f->id].relays = relays;
+		gBoard[f->id].wrMs = timeMsGet();
+	}
+	pthread_mutex_unlock(&gLock);
+	return ok ? (int)size : -EIO;
+}
+
+static int fsTruncate(const char* path, off_t size, struct fuse_file_info* fi)
+{
+	(void)path;
+	(void)size;
+	(void)fi;
+	return 0; // "echo 1 > relay1" opens with O_TRUNC
+}
+
+static int fsPoll(const char* path, struct fuse_file_info* fi,
+	struct fuse_pollhandle* ph, unsigned* reventsp)
+{
+	FsFileType* f = (FsFileType*)(uintptr_t)fi->fh;
+
+	(void)path;
+	*reventsp = 0;
+	pthread_mutex_lock(&gLock);
+	if (!f->isIn || f->gen != gBoard[f->id].gen[f->ch - 1])
+	{
+		*reventsp = POLLIN | POLLRDNORM | POLLPRI;
+		if (ph != NULL)
+		{
+			fuse_pollhandle_destroy(ph);
+		}
+	}
+	else if (ph != NULL)
+	{
+		if (f->ph != NULL)
+		{
+			fuse_pollhandle_destroy(f->ph);
+		}
+		f->ph = ph; // woken by the sampler on the next edge
+	}
+	pthread_mutex_unlock(&gLock);
+	return 0;
+}
+
+static const struct fuse_operations gFsOps =
+{
+	.init = fsInit,
+	.destroy = fsDestroy,
+	.getattr = fsGetattr,
+	.readdir = fsReaddir,
+	.open = fsOpen,
+	.release = fsRelease,
+	.read = fsRead,
+	.write = fsWrite,
+	.truncate = fsTruncate,
+	.poll = fsPoll,
+};
+
+int main(int argc, char* argv[])
+{
+	int i = 0;
+
+	if (argc < 2)
+	{
+		printf("Usage: 4relind-fs <mountpoint> [<fuse options>]\n");
+		return 1;
+	}
+	gCnt = boardListGet(gIds);
+	if (gCnt <= 0)
+	{
+		printf("No board detected\n");
+		return 1;
+	}
+	for (i = 0; i < gCnt; i++)
+	{
+		if (doBoardInit(gIds[i]) < 0)
+		{
+			printf("Board %s not responding\n", boardIdStr(gIds[i]));
+		}
+	}
+	// the bus workers would not survive the fork of fuse_main(), the
+	// sampler starts them again in the background process
+	workerStopAll();
+	return fuse_main(argc, argv, &gFsOps, NULL);
+}
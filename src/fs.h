@@ -0,0 +1,7 @@
+#ifndef FS_H_
+#define FS_H_
+
+#define FS_PERIOD_MS		20		// sampler period, input edges shorter than this are missed
+#define FS_ATTR_TIMEOUT_S	3600	// the tree is fixed at mount, only the contents change
+
+#endif //FS_H_
@@ -0,0 +1,330 @@
+/*
+ * gpio.c:
+ *	Register access through the mainline gpio-pca953x driver instead of
+ *	i2c-dev. The driver registers one gpiochip per expander labeled
+ *	"<bus>-<addr>" (e.g. "1-0027"), line n is pin n, so the port value used
+ *	by the relay/input remap tables is the bitmap of the 8 lines and every
+ *	port access is one multi-line request:
+ *		input port	GPIO_V2_LINE_GET_VALUES on all lines
+ *		output port	GPIO_V2_LINE_SET_VALUES on the output lines
+ *		configuration	line directions (GPIO_V2_LINE_SET_CONFIG)
+ *	The kernel owns the polarity register, only 0 can be written.
+ *	The chip stays open for the life of the process. The lines are requested
+ *	on the first access and kept, with their directions, until gpioRelease()
+ *	which the long running loops call before they wait, so the daemon and
+ *	the command line can still share the boards.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "relay.h"
+#include "config.h"
+#include "gpio.h"
+
+typedef struct
+{
+	int searched;	// chip looked up by label
+	int chipFd;		// -1 = no chip
+	int lineFd;		// the 8 lines, -1 = not requested
+	int cfgKnown;	// cfg read while lineFd is held, nobody else can change it
+	uint8_t cfg;
+} GpioDevType;
+
+static GpioDevType gDev[I2C_BUS_NR_MAX][128];
+static pthread_mutex_t gChipMutex = PTHREAD_MUTEX_INITIALIZER;
+
+int gpioEnabled(void)
+{
+	return configBackendGet() == CONFIG_BACKEND_GPIO;
+}
+
+/*
+ * chipOpen:
+ *	Open the gpiochip of the expander at <addr> on <bus>, found by label
+ *********************************************************************************
+ */
+static int chipOpen(int bus, int addr)
+{
+	struct gpiochip_info info;
+	char label[GPIO_MAX_NAME_SIZE];
+	char path[32];
+	int fd = -1;
+	int i = 0;
+
+	snprintf(label, sizeof(label), "%d-%04x", bus, addr);
+	for (i = 0; i < GPIO_CHIP_NR_MAX; i++)
+	{
+		snprintf(path, sizeof(path), "/dev/gpiochip%d", i);
+		if ( (fd = open(path, O_RDWR | O_CLOEXEC)) < 0)
+		{
+			continue;
+		}
+		if (ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &info) == 0
+			&& strcmp(info.label, label) == 0 && info.lines >= GPIO_LINE_NR)
+		{
+			return fd;
+		}
+		close(fd);
+	}
+	return -1;
+}
+
+/*
+ * linesRequest:
+ *	Request the 8 lines keeping their direction, return the request fd
+ *********************************************************************************
+ */
+static int linesRequest(int chipFd)
+{
+	struct gpio_v2_line_request req;
+	int i = 0;
+
+	memset(&req, 0, sizeof(req));
+	for (i = 0; i < GPIO_LINE_NR; i++)
+	{
+		req.offsets[i] = i;
+	}
+	strncpy(req.consumer, GPIO_CONSUMER, sizeof(req.consumer) - 1);
+	req.num_lines = GPIO_LINE_NR;
+	for (i = 0; i < GPIO_BUSY_RETRY; i++)
+	{
+		if (ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &req) == 0)
+		{
+			return req.fd;
+		}
+		if (errno != EBUSY)
+		{
+			break;
+		}
+		usleep(1000);
+	}
+	return -1;
+}
+
+/*
+ * cfgGet:
+ *	Direction of the lines as the PCA9534 configuration register: 1 = input
+ *********************************************************************************
+ */
+static int cfgGet(int chipFd, uint8_t* cfg)
+{
+	struct gpio_v2_line_info info;
+	int i = 0;
+
+	*cfg = 0;
+	for (i = 0; i < GPIO_LINE_NR; i++)
+	{
+		memset(&info, 0, sizeof(info));
+		info.offset = i;
+		if (ioctl(chipFd, GPIO_V2_GET_LINEINFO_IOCTL, &info) < 0)
+		{
+			return -1;
+		}
+		if (!(info.flags & GPIO_V2_LINE_FLAG_OUTPUT))
+		{
+			*cfg |= 1 << i;
+		}
+	}
+	return 0;
+}
+
+static int valuesGet(int lineFd, uint8_t mask, uint8_t* val)
+{
+	struct gpio_v2_line_values values;
+
+	values.mask = mask;
+	values.bits = 0;
+	if (ioctl(lineFd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+	{
+		return -1;
+	}
+	*val = values.bits & mask;
+	return 0;
+}
+
+/*
+ * cfgSet:
+ *	Make the lines with a 1 in <cfg> inputs and the others outputs, the new
+ *	outputs keep the level they have now
+ *********************************************************************************
+ */
+static int cfgSet(int lineFd, uint8_t cfg)
+{
+	struct gpio_v2_line_config config;
+	uint8_t level = 0;
+
+	if (0 != valuesGet(lineFd, 0xff, &level))
+	{
+		return -1;
+	}
+	memset(&config, 0, sizeof(config));
+	config.flags = GPIO_V2_LINE_FLAG_INPUT;
+	config.num_attrs = 2;
+	config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+	config.attrs[0].attr.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+	config.attrs[0].mask = (uint8_t)~cfg;
+	config.attrs[1].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+	config.attrs[1].attr.values = level;
+	config.attrs[1].mask = (uint8_t)~cfg;
+	return (ioctl(lineFd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0) ? -1 : 0;
+}
+
+/*
+ * devGet:
+ *	The expander at <addr> on <bus> with its chip open and its lines
+ *	requested. NULL if there is no such chip or the lines are busy.
+ *	The device of a bus is only used by the worker of that bus.
+ *********************************************************************************
+ */
+static GpioDevType* devGet(int bus, int addr)
+{
+	GpioDevType* dev = NULL;
+
+	if (bus < 0 || bus >= I2C_BUS_NR_MAX || addr < 0 || addr >= 128)
+	{
+		return NULL;
+	}
+	dev = &gDev[bus][addr];
+	pthread_mutex_lock(&gChipMutex);
+	if (!dev->searched)
+	{
+		dev->searched = 1;
+		dev->chipFd = chipOpen(bus, addr);
+		dev->lineFd = -1;
+	}
+	if (dev->chipFd >= 0 && dev->lineFd < 0)
+	{
+		dev->lineFd = linesRequest(dev->chipFd);
+		dev->cfgKnown = 0;
+	}
+	pthread_mutex_unlock(&gChipMutex);
+	return (dev->lineFd < 0) ? NULL : dev;
+}
+
+/*
+ * devCfgGet:
+ *	Line directions, asked to the kernel once per line request
+ *********************************************************************************
+ */
+static int devCfgGet(GpioDevType* dev, uint8_t* cfg)
+{
+	if (!dev->cfgKnown)
+	{
+		if (0 != cfgGet(dev->chipFd, &dev->cfg))
+		{
+			return -1;
+		}
+		dev->cfgKnown = 1;
+	}
+	*cfg = dev->cfg;
+	return 0;
+}
+
+/*
+ * gpioRelease:
+ *	Give the held lines back to the other processes, the chips stay open
+ *********************************************************************************
+ */
+void gpioRelease(void)
+{
+	int bus = 0;
+	int addr = 0;
+
+	pthread_mutex_lock(&gChipMutex);
+	for (bus = 0; bus < I2C_BUS_NR_MAX; bus++)
+	{
+		for (addr = 0; addr < 128; addr++)
+		{
+			if (gDev[bus][addr].searched && gDev[bus][addr].lineFd >= 0)
+			{
+				close(gDev[bus][addr].lineFd);
+				gDev[bus][addr].lineFd = -1;
+				gDev[bus][addr].cfgKnown = 0;
+			}
+		}
+	}
+	pthread_mutex_unlock(&gChipMutex);
+}
+
+/*
+ * gpioRegRead, gpioRegWrite:
+ *	PCA9534 register access over the gpiochip of the expander, 0 if OK
+ *********************************************************************************
+ */
+int gpioRegRead(int bus, int addr, int reg, uint8_t* val)
+{
+	GpioDevType* dev = NULL;
+	uint8_t cfg = 0;
+
+	if (reg == RELAY8_POLINV_REG_ADD)
+	{
+		*val = 0;
+		return 0;
+	}
+	if ( (dev = devGet(bus, addr)) == NULL)
+	{
+		return -1;
+	}
+	switch (reg)
+	{
+	case RELAY8_INPORT_REG_ADD:
+		return valuesGet(dev->lineFd, 0xff, val);
+	case RELAY8_OUTPORT_REG_ADD:
+		return (0 == devCfgGet(dev, &cfg)) ? valuesGet(dev->lineFd, ~cfg, val) : -1;
+	case RELAY8_CFG_REG_ADD:
+		return devCfgGet(dev, val);
+	default:
+		return -1;
+	}
+}
+
+int gpioRegWrite(int bus, int addr, int reg, uint8_t val)
+{
+	struct gpio_v2_line_values values;
+	GpioDevType* dev = NULL;
+	uint8_t cfg = 0;
+
+	if (reg == RELAY8_POLINV_REG_ADD)
+	{
+		return (val == 0) ? 0 : -1;
+	}
+	if ( (dev = devGet(bus, addr)) == NULL)
+	{
+		return -1;
+	}
+	switch (reg)
+	{
+	case RELAY8_OUTPORT_REG_ADD:
+		if (0 != devCfgGet(dev, &cfg))
+		{
+			return -1;
+		}
+		values.mask = (uint8_t)~cfg;
+		values.bits = val & values.mask;
+		return (values.mask == 0 || ioctl(dev->lineFd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) == 0)
+			? 0 : -1;
+	case RELAY8_CFG_REG_ADD:
+		dev->cfgKnown = 0;
+		if (0 != cfgSet(dev->lineFd, val))
+		{
+			return -1;
+		}
+		dev->cfg = val;
+		dev->cfgKnown = 1;
+		return 0;
+	default:
+		return -1;
+	}
+}
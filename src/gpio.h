@@ -0,0 +1,16 @@
+#ifndef GPIO_H_
+#define GPIO_H_
+
+#include <stdint.h>
+
+#define GPIO_CHIP_NR_MAX	64		// /dev/gpiochip0..63 are searched
+#define GPIO_LINE_NR		8		// PCA9534 pins = gpiochip lines 0..7
+#define GPIO_BUSY_RETRY		20		// requests retried while another process holds the lines
+#define GPIO_CONSUMER		"4relind"
+
+int gpioEnabled(void);
+int gpioRegRead(int bus, int addr, int reg, uint8_t* val);
+int gpioRegWrite(int bus, int addr, int reg, uint8_t val);
+void gpioRelease(void);
+
+#endif //GPIO_H_
@@ -0,0 +1,161 @@
+/*
+ * health.c:
+ *	Per device circuit breaker for the bus accesses.
+ *	After BREAKER_FAILURES consecutive errors a device is quarantined: all
+ *	accesses fail immediately, without touching the bus, for BREAKER_OPEN_MS.
+ *	Then a single access is let through as a probe (half-open), success
+ *	closes the breaker, failure opens it again. The state is shared by all
+ *	processes through a memory mapped file, the sampler daemon acts as the
+ *	background prober.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "relay.h"
+#include "thread.h"
+#include "health.h"
+
+#define HEALTH_ADDR_MAX	128
+
+typedef struct
+{
+	uint32_t state;
+	uint32_t failures;
+	uint64_t changeMs;
+	uint64_t okTotal;
+	uint64_t errTotal;
+} HealthEntryType;
+
+typedef struct
+{
+	HealthEntryType addr[I2C_BUS_NR_MAX][HEALTH_ADDR_MAX];
+} HealthFileType;
+
+static HealthFileType gLocal; // used if the shared file is not available
+static HealthFileType* gHealth = NULL;
+static pthread_once_t gHealthOnce = PTHREAD_ONCE_INIT; // bus workers share it
+
+static void healthOpen(void)
+{
+	if (0 == mmDirCreate(RUN_DIR))
+	{
+		gHealth = mmFileOpen(HEALTH_FILE, sizeof(HealthFileType), 1);
+	}
+	if (gHealth == NULL)
+	{
+		gHealth = &gLocal;
+	}
+}
+
+static HealthEntryType* entryGet(int bus, int addr)
+{
+	if (bus < 0 || bus >= I2C_BUS_NR_MAX || addr < 0 || addr >= HEALTH_ADDR_MAX)
+	{
+		return NULL;
+	}
+	pthread_once(&gHealthOnce, healthOpen);
+	return &gHealth->addr[bus][addr];
+}
+
+/*
+ * healthAllow:
+ *	1 if an access to <addr> on <bus> may use the bus
+ *********************************************************************************
+ */
+int healthAllow(int bus, int addr)
+{
+	HealthEntryType* e = entryGet(bus, addr);
+	uint32_t state = 0;
+	uint64_t now = 0;
+
+	if (e == NULL)
+	{
+		return 1;
+	}
+	state = __atomic_load_n(&e->state, __ATOMIC_ACQUIRE);
+	if (state == BREAKER_CLOSED)
+	{
+		return 1;
+	}
+	now = timeMsGet();
+	if (now - __atomic_load_n(&e->changeMs, __ATOMIC_RELAXED) < BREAKER_OPEN_MS)
+	{
+		return 0;
+	}
+	// quarantine over (or a probe never reported back): this caller probes
+	if (__atomic_compare_exchange_n(&e->state, &state, BREAKER_HALF_OPEN, 0,
+		__ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+	{
+		__atomic_store_n(&e->changeMs, now, __ATOMIC_RELAXED);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * healthResult:
+ *	Account the result of an access to <addr> on <bus>
+ *********************************************************************************
+ */
+void healthResult(int bus, int addr, int ok)
+{
+	HealthEntryType* e = entryGet(bus, addr);
+	uint32_t failures = 0;
+
+	if (e == NULL)
+	{
+		return;
+	}
+	if (ok)
+	{
+		__atomic_fetch_add(&e->okTotal, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&e->failures, 0, __ATOMIC_RELAXED);
+		if (__atomic_load_n(&e->state, __ATOMIC_RELAXED) != BREAKER_CLOSED)
+		{
+			__atomic_store_n(&e->state, BREAKER_CLOSED, __ATOMIC_RELEASE);
+		}
+		return;
+	}
+	__atomic_fetch_add(&e->errTotal, 1, __ATOMIC_RELAXED);
+	failures = __atomic_add_fetch(&e->failures, 1, __ATOMIC_RELAXED);
+	if (failures >= BREAKER_FAILURES
+		|| __atomic_load_n(&e->state, __ATOMIC_RELAXED) == BREAKER_HALF_OPEN)
+	{
+		__atomic_store_n(&e->changeMs, timeMsGet(), __ATOMIC_RELAXED);
+		__atomic_store_n(&e->state, BREAKER_OPEN, __ATOMIC_RELEASE);
+	}
+}
+
+void healthMetricsPrint(FILE* out)
+{
+	HealthEntryType* e = NULL;
+	int bus = 0;
+	int addr = 0;
+
+	fprintf(out, "# HELP sm4relind_bus_breaker_state 0 closed, 1 open (quarantined), 2 half-open\n");
+	fprintf(out, "# TYPE sm4relind_bus_breaker_state gauge\n");
+	fprintf(out, "# TYPE sm4relind_bus_transfers_total counter\n");
+	fprintf(out, "# TYPE sm4relind_bus_errors_total counter\n");
+	for (bus = 0; bus < I2C_BUS_NR_MAX; bus++)
+	{
+		for (addr = 0; addr < HEALTH_ADDR_MAX; addr++)
+		{
+			e = entryGet(bus, addr);
+			if (e->okTotal == 0 && e->errTotal == 0)
+			{
+				continue;
+			}
+			fprintf(out, "sm4relind_bus_breaker_state{bus=\"%d\",addr=\"0x%02x\"} %u\n",
+				bus, addr, e->state);
+			fprintf(out, "sm4relind_bus_transfers_total{bus=\"%d\",addr=\"0x%02x\"} %llu\n",
+				bus, addr, (unsigned long long)(e->okTotal + e->errTotal));
+			fprintf(out, "sm4relind_bus_errors_total{bus=\"%d\",addr=\"0x%02x\"} %llu\n",
+				bus, addr, (unsigned long long)e->errTotal);
+		}
+	}
+}
@@ -0,0 +1,22 @@
+#ifndef HEALTH_H_
+#define HEALTH_H_
+
+#include <stdio.h>
+#include "mmfile.h"
+
+#define HEALTH_FILE			RUN_DIR "/health"
+#define BREAKER_FAILURES	3		// consecutive errors that open the breaker
+#define BREAKER_OPEN_MS		2000	// quarantine time before a probe is allowed
+
+typedef enum
+{
+	BREAKER_CLOSED = 0,
+	BREAKER_OPEN,
+	BREAKER_HALF_OPEN
+} BreakerStateType;
+
+int healthAllow(int bus, int addr);
+void healthResult(int bus, int addr, int ok);
+void healthMetricsPrint(FILE* out);
+
+#endif //HEALTH_H_
@@ -0,0 +1,310 @@
+/*
+ * history.c:
+ *	Compact on-disk log of the board state changes.
+ *	The log is a ring of fixed size memory mapped segments. Every record
+ *	holds the time since the previous record (varint, ms), the board id and
+ *	the 8-bit board state. Segment headers keep the time range covered so a
+ *	query only maps the segments it needs.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "relay.h"
+#include "history.h"
+
+#define HIST_MAGIC		0x31485234	// "4RH1"
+#define HIST_REC_MAX	12	// 10 bytes varint + board + state
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t seq;
+	uint64_t firstMs;
+	uint64_t lastMs;
+	uint32_t used;
+	uint32_t count;
+} HistSegHeaderType;
+
+#define HIST_DATA_SIZE	(HIST_SEG_SIZE - sizeof(HistSegHeaderType))
+
+static uint8_t* gSeg = NULL;
+static int gSegIdx = 0;
+
+static void segPath(char* path, size_t size, int idx)
+{
+	snprintf(path, size, "%s/seg%02d.hist", mmPath(HIST_DIR), idx);
+}
+
+static int segHeaderRead(int idx, HistSegHeaderType* hdr)
+{
+	char path[128];
+	int fd = 0;
+	int ret = ERROR;
+
+	segPath(path, sizeof(path), idx);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return ERROR;
+	}
+	if (pread(fd, hdr, sizeof(HistSegHeaderType), 0)
+		== sizeof(HistSegHeaderType) && hdr->magic == HIST_MAGIC)
+	{
+		ret = OK;
+	}
+	close(fd);
+	return ret;
+}
+
+static int segMap(int idx)
+{
+	char path[128];
+
+	segPath(path, sizeof(path), idx);
+	gSeg = mmFileOpen(path, HIST_SEG_SIZE, 1);
+	if (gSeg == NULL)
+	{
+		return ERROR;
+	}
+	gSegIdx = idx;
+	return OK;
+}
+
+static int segRotate(void)
+{
+	HistSegHeaderType* hdr = (HistSegHeaderType*)gSeg;
+	uint32_t seq = hdr->seq;
+
+	mmFileClose(gSeg, HIST_SEG_SIZE);
+	if (OK != segMap( (gSegIdx + 1) % HIST_SEG_COUNT))
+	{
+		gSeg = NULL;
+		return ERROR;
+	}
+	hdr = (HistSegHeaderType*)gSeg;
+	memset(hdr, 0, sizeof(HistSegHeaderType));
+	hdr->seq = seq + 1;
+	hdr->magic = HIST_MAGIC;
+	return OK;
+}
+
+/*
+ * histOpen:
+ *	Map the newest segment for append
+ *********************************************************************************
+ */
+int histOpen(void)
+{
+	HistSegHeaderType hdr;
+	HistSegHeaderType* pHdr = NULL;
+	uint32_t maxSeq = 0;
+	int idx = 0;
+	int i = 0;
+
+	if (0 != mmDirCreate(HIST_DIR))
+	{
+		return ERROR;
+	}
+	for (i = 0; i < HIST_SEG_COUNT; i++)
+	{
+		if (OK == segHeaderRead(i, &hdr) && hdr.seq > maxSeq)
+		{
+			maxSeq = hdr.seq;
+			idx = i;
+		}
+	}
+	if (OK != segMap(idx))
+	{
+		return ERROR;
+	}
+	pHdr = (HistSegHeaderType*)gSeg;
+	if (pHdr->magic != HIST_MAGIC || pHdr->used > HIST_DATA_SIZE)
+	{
+		memset(pHdr, 0, sizeof(HistSegHeaderType));
+		pHdr->seq = maxSeq + 1;
+		pHdr->magic = HIST_MAGIC;
+	}
+	return OK;
+}
+
+void histClose(void)
+{
+	mmFileClose(gSeg, HIST_SEG_SIZE);
+	gSeg = NULL;
+}
+
+static int recEncode(uint8_t* rec, uint64_t delta, uint8_t board, uint8_t state)
+{
+	int len = 0;
+
+	while (delta >= 0x80)
+	{
+		rec[len++] = (uint8_t)(delta | 0x80);
+		delta >>= 7;
+	}
+	rec[len++] = (uint8_t)delta;
+	rec[len++] = board;
+	rec[len++] = state;
+	return len;
+}
+
+/*
+ * histAppend:
+ *	Add one state change record to the log
+ *********************************************************************************
+ */
+int histAppend(uint8_t board, uint8_t state, uint64_t ms)
+{
+	HistSegHeaderType* hdr = NULL;
+	uint8_t rec[HIST_REC_MAX];
+	int len = 0;
+
+	if (gSeg == NULL)
+	{
+		return ERROR;
+	}
+	hdr = (HistSegHeaderType*)gSeg;
+	if (hdr->count == 0)
+	{
+		hdr->firstMs = ms;
+		hdr->lastMs = ms;
+	}
+	if (ms < hdr->lastMs) // keep the log monotonic if the clock steps back
+	{
+		ms = hdr->lastMs;
+	}
+	len = recEncode(rec, ms - hdr->lastMs, board, state);
+	if (hdr->used + len > HIST_DATA_SIZE)
+	{
+		if (OK != segRotate())
+		{
+			return ERROR;
+		}
+		hdr = (HistSegHeaderType*)gSeg;
+		hdr->firstMs = ms;
+		hdr->lastMs = ms;
+		len = recEncode(rec, 0, board, state);
+	}
+	memcpy(gSeg + sizeof(HistSegHeaderType) + hdr->used, rec, len);
+	hdr->lastMs = ms;
+	hdr->count++;
+	hdr->used += len; // publish the record last
+	return OK;
+}
+
+static void segScan(int idx, int board, uint64_t fromMs, uint64_t toMs,
+	HistCbType cb, void* arg)
+{
+	char path[128];
+	uint8_t* seg = NULL;
+	HistSegHeaderType* hdr = NULL;
+	uint32_t pos = 0;
+	uint64_t ms = 0;
+	uint64_t delta = 0;
+	int shift = 0;
+	uint8_t* data = NULL;
+
+	segPath(path, sizeof(path), idx);
+	seg = mmFileOpen(path, HIST_SEG_SIZE, 0);
+	if (seg == NULL)
+	{
+		return;
+	}
+	hdr = (HistSegHeaderType*)seg;
+	data = seg + sizeof(HistSegHeaderType);
+	ms = hdr->firstMs;
+	while (pos < hdr->used && hdr->used <= HIST_DATA_SIZE)
+	{
+		delta = 0;
+		shift = 0;
+		while (pos < hdr->used && (data[pos] & 0x80) && shift < 63)
+		{
+			delta |= (uint64_t)(data[pos++] & 0x7f) << shift;
+			shift += 7;
+		}
+		if (pos + 3 > hdr->used)
+		{
+			break;
+		}
+		delta |= (uint64_t)data[pos++] << shift;
+		ms += delta;
+		if (ms > toMs)
+		{
+			break;
+		}
+		if (ms >= fromMs && (board < 0 || board == data[pos]))
+		{
+			cb(ms, data[pos], data[pos + 1], arg);
+		}
+		pos += 2;
+	}
+	mmFileClose(seg, HIST_SEG_SIZE);
+}
+
+/*
+ * histQuery:
+ *	Call <cb> for every record of <board> (-1 = all boards) in [fromMs, toMs].
+ *	Segments are ordered by sequence number, the first one of interest is
+ *	found by binary search over the segment time ranges.
+ *********************************************************************************
+ */
+int histQuery(int board, uint64_t fromMs, uint64_t toMs, HistCbType cb,
+	void* arg)
+{
+	HistSegHeaderType hdr[HIST_SEG_COUNT];
+	int order[HIST_SEG_COUNT];
+	int n = 0;
+	int i = 0;
+	int j = 0;
+	int lo = 0;
+	int hi = 0;
+	int mid = 0;
+
+	if (cb == NULL)
+	{
+		return ERROR;
+	}
+	for (i = 0; i < HIST_SEG_COUNT; i++)
+	{
+		if (OK != segHeaderRead(i, &hdr[i]) || hdr[i].count == 0)
+		{
+			continue;
+		}
+		for (j = n; j > 0 && hdr[order[j - 1]].seq > hdr[i].seq; j--)
+		{
+			order[j] = order[j - 1];
+		}
+		order[j] = i;
+		n++;
+	}
+	if (n == 0)
+	{
+		return ERROR;
+	}
+
+	lo = 0;
+	hi = n;
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if (hdr[order[mid]].lastMs < fromMs)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	for (i = lo; i < n && hdr[order[i]].firstMs <= toMs; i++)
+	{
+		segScan(order[i], board, fromMs, toMs, cb, arg);
+	}
+	return OK;
+}
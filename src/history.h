@@ -0,0 +1,23 @@
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <stdint.h>
+#include "mmfile.h"
+
+#define HIST_DIR		STATE_DIR "/history"
+#define HIST_SEG_SIZE	(64 * 1024)
+#define HIST_SEG_COUNT	16
+
+// board state byte: relays on the high nibble, inputs on the low nibble
+#define HIST_STATE(relays, inputs)	((uint8_t)((((relays) & 0x0f) << 4) | ((inputs) & 0x0f)))
+#define HIST_RELAYS(state)	(((state) >> 4) & 0x0f)
+#define HIST_INPUTS(state)	((state) & 0x0f)
+
+typedef void (*HistCbType)(uint64_t ms, uint8_t board, uint8_t state, void* arg);
+
+int histOpen(void);
+int histAppend(uint8_t board, uint8_t state, uint64_t ms);
+void histClose(void);
+int histQuery(int board, uint64_t fromMs, uint64_t toMs, HistCbType cb, void* arg);
+
+#endif //HISTORY_H_
@@ -0,0 +1,831 @@
+/*
+ * http.c:
+ *	HTTP/1.1 server of the daemon (keep-alive, JSON answers), every read is
+ *	answered from the daemon samples:
+ *		GET  /boards				all boards
+ *		GET  /boards/<id>			one board
+ *		GET  /boards/<id>/relays[/<ch>]		relays bitmap or one relay
+ *		GET  /boards/<id>/inputs[/<ch>]		inputs bitmap or one input
+ *		PUT  /boards/<id>/relays		body: bitmap
+ *		PUT  /boards/<id>/relays/<ch>		body: on/off or 1/0
+ *		POST /scene				body: <id>=<bitmap>[/<mask>]&...
+ *							all boards in one batched write
+ *		GET  /events				Server-Sent Events, one "state" event
+ *							per board change that held HTTP_DEBOUNCE_MS
+ *	POST is accepted in place of PUT. <id> as on the command line ("0", "2.3").
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "relay.h"
+#include "thread.h"
+#include "daemon.h"
+#include "evloop.h"
+#include "http.h"
+
+typedef struct
+{
+	int fd;			// -1 = free slot
+	int sse;		// event stream, no more requests
+	int closeAfter;	// close once the answer is sent
+	int rxLen;
+	int txLen;
+	int txOff;
+	uint64_t lastTxMs;
+	char rx[HTTP_RX_MAX + 1];
+	char tx[HTTP_TX_MAX];
+} HttpConnType;
+
+typedef struct
+{
+	u8 valid;	// state sent to the event streams
+	u8 relays;
+	u8 inputs;
+	u8 pendValid;	// new state waiting for the debounce time
+	u8 pendRelays;
+	u8 pendInputs;
+	uint64_t pendMs;
+} HttpBoardType;
+
+static HttpConnType gConn[HTTP_CONN_MAX];
+static HttpBoardType gBoard[BOARD_NR_MAX];
+static int gListenFd = -1;
+
+static void connClose(HttpConnType* c)
+{
+	evDel(c->fd);
+	close(c->fd);
+	c->fd = -1;
+}
+
+/*
+ * txPut:
+ *	Queue <len> bytes for the client, ERROR if it is too far behind
+ *********************************************************************************
+ */
+static int txPut(HttpConnType* c, const char* data, int len)
+{
+	if (c->txLen + len > HTTP_TX_MAX)
+	{
+		return ERROR;
+	}
+	memcpy(&c->tx[c->txLen], data, len);
+	c->txLen += len;
+	return OK;
+}
+
+static const char* statusText(int code)
+{
+	switch (code)
+	{
+	case 200:
+		return "OK";
+	case 400:
+		return "Bad Request";
+	case 404:
+		return "Not Found";
+	case 405:
+		return "Method Not Allowed";
+	case 413:
+		return "Payload Too Large";
+	case 503:
+		return "Service Unavailable";
+	default:
+		return "Internal Server Error";
+	}
+}
+
+static int respond(HttpConnType* c, int code, const char* body)
+{
+	char hdr[192];
+	int len = strlen(body);
+	int n = 0;
+
+	n = snprintf(hdr, sizeof(hdr), "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\n"
+		"Content-Length: %d\r\n%s\r\n", code, statusText(code), len + 1,
+		c->closeAfter ? "Connection: close\r\n" : "");
+	if (OK != txPut(c, hdr, n) || OK != txPut(c, body, len) || OK != txPut(c, "\n", 1))
+	{
+		return ERROR;
+	}
+	return OK;
+}
+
+static int boardJson(char* buf, int size, int id, u8 relays, u8 inputs)
+{
+	return snprintf(buf, size, "{\"id\":\"%s\",\"bus\":%d,\"stack\":%d,\"relays\":%d,\"inputs\":%d}",
+		boardIdStr(id), BOARD_BUS(id), BOARD_STACK(id), relays, inputs);
+}
+
+static int boardsJson(char* buf, int size)
+{
+	u8 relays = 0;
+	u8 inputs = 0;
+	int n = 0;
+	int id = 0;
+	int ret = 0;
+
+	n = snprintf(buf, size, "[");
+	for (id = 0; id < BOARD_NR_MAX && n < size; id++)
+	{
+		ret = daemonBoardGet(id, &relays, &inputs);
+		if (ret == DAEMON_BOARD_ABSENT)
+		{
+			continue;
+		}
+		if (n > 1)
+		{
+			n += snprintf(&buf[n], size - n, ",");
+		}
+		if (ret == DAEMON_BOARD_OK)
+		{
+			n += boardJson(&buf[n], size - n, id, relays, inputs);
+		}
+		else
+		{
+			n += snprintf(&buf[n], size - n, "{\"id\":\"%s\",\"bus\":%d,\"stack\":%d,\"offline\":true}",
+				boardIdStr(id), BOARD_BUS(id), BOARD_STACK(id));
+		}
+	}
+	if (n < size)
+	{
+		n += snprintf(&buf[n], size - n, "]");
+	}
+	return n;
+}
+
+/*
+ * relaysApply:
+ *	One batched write of <n> boards, HTTP status code
+ *********************************************************************************
+ */
+static int relaysApply(const int* ids, const u8* masks, const u8* vals, int n, char* body, int size)
+{
+	u8 relays = 0;
+	u8 inputs = 0;
+	int i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+		switch (daemonBoardGet(ids[i], &relays, &inputs))
+		{
+		case DAEMON_BOARD_OK:
+			break;
+		case DAEMON_BOARD_OFFLINE:
+			snprintf(body, size, "{\"error\":\"board %s not responding\"}", boardIdStr(ids[i]));
+			return 503;
+		default:
+			snprintf(body, size, "{\"error\":\"no board %s\"}", boardIdStr(ids[i]));
+			return 404;
+		}
+	}
+	if (daemonRelaysApply(ids, masks, vals, n) != n)
+	{
+		snprintf(body, size, "{\"error\":\"write failed\"}");
+		return 500;
+	}
+	snprintf(body, size, "{\"ok\":true}");
+	return 200;
+}
+
+static int onOffParse(const char* str, u8* val)
+{
+	if (strcasecmp(str, "on") == 0 || strcmp(str, "1") == 0)
+	{
+		*val = 0x0f;
+	}
+	else if (strcasecmp(str, "off") == 0 || strcmp(str, "0") == 0)
+	{
+		*val = 0;
+	}
+	else
+	{
+		return ERROR;
+	}
+	return OK;
+}
+
+/*
+ * decParse:
+ *	Decimal number of at most <max>, digits only; <end> is the first
+ *	character after the digits
+ *********************************************************************************
+ */
+static int decParse(const char* str, long max, long* val, char** end)
+{
+	if (!isdigit((unsigned char)str[0]))
+	{
+		return ERROR;
+	}
+	errno = 0;
+	*val = strtol(str, end, 10);
+	return (errno != 0 || *val > max) ? ERROR : OK;
+}
+
+static int bitmapParse(const char* str, u8* val)
+{
+	char* end = NULL;
+	long v = strtol(str, &end, 0);
+
+	if (end == str || *end != 0 || v < 0 || v > 0x0f)
+	{
+		return ERROR;
+	}
+	*val = v;
+	return OK;
+}
+
+/*
+ * sceneApply:
+ *	POST /scene: "<id>=<bitmap>[/<mask>]" entries separated by '&', ',',
+ *	spaces or new lines
+ *********************************************************************************
+ */
+static int sceneApply(char* req, char* body, int size)
+{
+	int ids[BOARD_NR_MAX];
+	u8 masks[BOARD_NR_MAX];
+	u8 vals[BOARD_NR_MAX];
+	char* save = NULL;
+	char* tok = NULL;
+	char* eq = NULL;
+	char* sl = NULL;
+	int n = 0;
+
+	for (tok = strtok_r(req, "&, \r\n", &save); tok != NULL; tok = strtok_r(NULL, "&, \r\n", &save))
+	{
+		masks[n] = 0x0f;
+		if ( (eq = strchr(tok, '=')) == NULL || n >= BOARD_NR_MAX)
+		{
+			break;
+		}
+		*eq++ = 0;
+		if ( (sl = strchr(eq, '/')) != NULL)
+		{
+			*sl++ = 0;
+			if (OK != bitmapParse(sl, &masks[n]))
+			{
+				break;
+			}
+		}
+		if ( (ids[n] = boardIdParse(tok)) < 0 || OK != bitmapParse(eq, &vals[n]))
+		{
+			break;
+		}
+		n++;
+	}
+	if (tok != NULL || n == 0)
+	{
+		snprintf(body, size, "{\"error\":\"scene syntax: <id>=<bitmap>[/<mask>]&...\"}");
+		return 400;
+	}
+	return relaysApply(ids, masks, vals, n, body, size);
+}
+
+/*
+ * boardRoute:
+ *	/boards/<id>[/relays|inputs[/<ch>]] with <rest> the part after <id>
+ *********************************************************************************
+ */
+static int boardRoute(int write, int id, const char* rest, char* req, char* body, int size)
+{
+	u8 relays = 0;
+	u8 inputs = 0;
+	u8 val = 0;
+	u8 mask = 0;
+	char* end = NULL;
+	long v = 0;
+	int ch = 0;
+	int isIn = 0;
+	int ret = 0;
+
+	if (rest[0] == 0)
+	{
+		isIn = -1;
+	}
+	else if (strncmp(rest, "/relays", 7) == 0)
+	{
+		rest += 7;
+	}
+	else if (strncmp(rest, "/inputs", 7) == 0)
+	{
+		rest += 7;
+		isIn = 1;
+	}
+	else
+	{
+		return 404;
+	}
+	if (rest[0] == '/')
+	{
+		if (OK != decParse(&rest[1], isIn ? IN_CH_NR_MAX : RELAY_CH_NR_MAX, &v, &end)
+			|| *end != 0 || v < CHANNEL_NR_MIN)
+		{
+			return 404;
+		}
+		ch = v;
+	}
+	else if (rest[0] != 0)
+	{
+		return 404;
+	}
+	if (write)
+	{
+		if (isIn != 0)
+		{
+			return 405;
+		}
+		mask = (ch == 0) ? 0x0f : 1 << (ch - 1);
+		if (OK != ((ch == 0) ? bitmapParse(req, &val) : onOffParse(req, &val)))
+		{
+			snprintf(body, size, "{\"error\":\"body: %s\"}", (ch == 0) ? "bitmap" : "on/off");
+			return 400;
+		}
+		return relaysApply(&id, &mask, &val, 1, body, size);
+	}
+	ret = daemonBoardGet(id, &relays, &inputs);
+	if (ret == DAEMON_BOARD_ABSENT)
+	{
+		return 404;
+	}
+	if (ret == DAEMON_BOARD_OFFLINE)
+	{
+		snprintf(body, size, "{\"error\":\"board %s not responding\"}", boardIdStr(id));
+		return 503;
+	}
+	if (isIn < 0)
+	{
+		boardJson(body, size, id, relays, inputs);
+	}
+	else if (ch == 0)
+	{
+		snprintf(body, size, "{\"%s\":%d}", isIn ? "inputs" : "relays", isIn ? inputs : relays);
+	}
+	else
+	{
+		snprintf(body, size, "{\"%s\":%d,\"state\":%d}", isIn ? "input" : "relay", ch,
+			((isIn ? inputs : relays) >> (ch - 1)) & 1);
+	}
+	return 200;
+}
+
+static int sseStart(HttpConnType* c)
+{
+	const char* hdr = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+		"Cache-Control: no-cache\r\n\r\n";
+	char ev[160];
+	u8 relays = 0;
+	u8 inputs = 0;
+	int id = 0;
+	int n = 0;
+
+	c->sse = 1;
+	if (OK != txPut(c, hdr, strlen(hdr)))
+	{
+		return ERROR;
+	}
+	for (id = 0; id < BOARD_NR_MAX; id++)
+	{
+		if (DAEMON_BOARD_OK != daemonBoardGet(id, &relays, &inputs))
+		{
+			continue;
+		}
+		n = snprintf(ev, sizeof(ev), "event: state\ndata: ");
+		n += boardJson(&ev[n], sizeof(ev) - n, id, relays, inputs);
+		n += snprintf(&ev[n], sizeof(ev) - n, "\n\n");
+		if (OK != txPut(c, ev, n))
+		{
+			return ERROR;
+		}
+	}
+	return OK;
+}
+
+/*
+ * requestHandle:
+ *	Route one request, queue the answer. ERROR closes the connection.
+ *********************************************************************************
+ */
+static int requestHandle(HttpConnType* c, const char* method, char* path, char* req)
+{
+	char body[HTTP_TX_MAX / 2];
+	char idStr[16];
+	char* q = NULL;
+	char* rest = NULL;
+	int write = 0;
+	int code = 404;
+	int id = 0;
+
+	body[0] = 0;
+	if ( (q = strchr(path, '?')) != NULL)
+	{
+		*q = 0;
+	}
+	if (strcmp(method, "PUT") == 0 || strcmp(method, "POST") == 0)
+	{
+		write = 1;
+	}
+	else if (strcmp(method, "GET") != 0)
+	{
+		return respond(c, 405, "{\"error\":\"method\"}");
+	}
+	if (strcmp(path, "/events") == 0 && !write)
+	{
+		return sseStart(c);
+	}
+	if (strcmp(path, "/boards") == 0 || strcmp(path, "/boards/") == 0)
+	{
+		if (write)
+		{
+			return respond(c, 405, "{\"error\":\"method\"}");
+		}
+		boardsJson(body, sizeof(body));
+		return respond(c, 200, body);
+	}
+	if (strcmp(path, "/scene") == 0)
+	{
+		if (!write)
+		{
+			return respond(c, 405, "{\"error\":\"method\"}");
+		}
+		code = sceneApply(req, body, sizeof(body));
+		return respond(c, code, body);
+	}
+	if (strncmp(path, "/boards/", 8) == 0)
+	{
+		rest = strchr(&path[8], '/');
+		if (rest == NULL)
+		{
+			rest = &path[strlen(path)];
+		}
+		if (rest - &path[8] < (int)sizeof(idStr))
+		{
+			memcpy(idStr, &path[8], rest - &path[8]);
+			idStr[rest - &path[8]] = 0;
+			if ( (id = boardIdParse(idStr)) >= 0)
+			{
+				code = boardRoute(write, id, rest, req, body, sizeof(body));
+			}
+		}
+	}
+	if (body[0] == 0)
+	{
+		snprintf(body, sizeof(body), "{\"error\":\"%s\"}", statusText(code));
+	}
+	return respond(c, code, body);
+}
+
+static char* headerGet(char* headers, const char* name)
+{
+	char* p = headers;
+	int len = strlen(name);
+
+	while ( (p = strstr(p, "\r\n")) != NULL)
+	{
+		p += 2;
+		if (strncasecmp(p, name, len) == 0 && p[len] == ':')
+		{
+			p += len + 1;
+			while (*p == ' ' || *p == '\t')
+			{
+				p++;
+			}
+			return p;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * connProcess:
+ *	Answer the complete requests received while the answers fit
+ *********************************************************************************
+ */
+static int connProcess(HttpConnType* c)
+{
+	char method[8];
+	char path[128];
+	char req[HTTP_BODY_MAX + 1];
+	char* end = NULL;
+	char* h = NULL;
+	long len = 0;
+	int major = 0;
+	int minor = 0;
+	int hdrLen = 0;
+	int bodyLen = 0;
+	int closeAfter = 0;
+
+	while (!c->sse && !c->closeAfter && c->txLen <= HTTP_TX_MAX / 4)
+	{
+		c->rx[c->rxLen] = 0;
+		if ( (end = strstr(c->rx, "\r\n\r\n")) == NULL)
+		{
+			return (c->rxLen >= HTTP_RX_MAX) ? ERROR : OK;
+		}
+		*end = 0;
+		hdrLen = end - c->rx + 4;
+		if (sscanf(c->rx, "%7s %127s HTTP/%d.%d", method, path, &major, &minor) != 4)
+		{
+			c->closeAfter = 1;
+			return respond(c, 400, "{\"error\":\"request\"}");
+		}
+		len = 0;
+		if ( (h = headerGet(c->rx, "Content-Length")) != NULL)
+		{
+			if (OK != decParse(h, INT_MAX, &len, &h))
+			{
+				c->closeAfter = 1;
+				return respond(c, 400, "{\"error\":\"Content-Length\"}");
+			}
+			while (*h == ' ' || *h == '\t')
+			{
+				h++;
+			}
+			if (*h != '\r' && *h != 0)
+			{
+				c->closeAfter = 1;
+				return respond(c, 400, "{\"error\":\"Content-Length\"}");
+			}
+		}
+		if (len > HTTP_BODY_MAX)
+		{
+			c->closeAfter = 1;
+			return respond(c, 413, "{\"error\":\"body\"}");
+		}
+		bodyLen = len;
+		if (c->rxLen < hdrLen + bodyLen)
+		{
+			*end = '\r'; // wait for the body
+			return OK;
+		}
+		// only once the body is in, a close would drop it
+		h = headerGet(c->rx, "Connection");
+		closeAfter = (minor == 0 && (h == NULL || strncasecmp(h, "keep-alive", 10) != 0))
+			|| (h != NULL && strncasecmp(h, "close", 5) == 0);
+		memcpy(req, &c->rx[hdrLen], bodyLen);
+		req[bodyLen] = 0;
+		c->rxLen -= hdrLen + bodyLen;
+		memmove(c->rx, &c->rx[hdrLen + bodyLen], c->rxLen);
+		while (bodyLen > 0 && (req[bodyLen - 1] == '\n' || req[bodyLen - 1] == '\r'))
+		{
+			req[--bodyLen] = 0;
+		}
+		c->closeAfter = closeAfter;
+		if (OK != requestHandle(c, method, path, req))
+		{
+			return ERROR;
+		}
+	}
+	return OK;
+}
+
+static int connFlush(HttpConnType* c)
+{
+	ssize_t n = 0;
+
+	while (c->txOff < c->txLen)
+	{
+		n = send(c->fd, &c->tx[c->txOff], c->txLen - c->txOff, MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? OK : ERROR;
+		}
+		c->txOff += n;
+		c->lastTxMs = timeMsGet();
+	}
+	c->txOff = 0;
+	c->txLen = 0;
+	return OK;
+}
+
+static void connUpdate(HttpConnType* c)
+{
+	if (OK != connFlush(c) || (c->closeAfter && c->txLen == 0))
+	{
+		connClose(c);
+		return;
+	}
+	evMod(c->fd, (c->txLen > 0) ? EPOLLOUT : EPOLLIN);
+}
+
+static void connHandler(int fd, uint32_t events, void* arg)
+{
+	HttpConnType* c = (HttpConnType*)arg;
+	ssize_t n = 0;
+
+	if (events & (EPOLLERR | EPOLLHUP))
+	{
+		connClose(c);
+		return;
+	}
+	if (events & EPOLLIN)
+	{
+		n = recv(fd, &c->rx[c->rxLen], HTTP_RX_MAX - c->rxLen, 0);
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+		{
+			connClose(c);
+			return;
+		}
+		if (c->sse)
+		{
+			return; // nothing expected from an event stream client
+		}
+		c->rxLen += (n > 0) ? n : 0;
+	}
+	if (OK != connProcess(c))
+	{
+		connClose(c);
+		return;
+	}
+	connUpdate(c);
+}
+
+static void acceptHandler(int fd, uint32_t events, void* arg)
+{
+	int conn = 0;
+	int one = 1;
+	int i = 0;
+
+	(void)events;
+	(void)arg;
+	while ( (conn = accept(fd, NULL, NULL)) >= 0)
+	{
+		fcntl(conn, F_SETFL, O_NONBLOCK);
+		fcntl(conn, F_SETFD, FD_CLOEXEC);
+		for (i = 0; i < HTTP_CONN_MAX && gConn[i].fd >= 0; i++)
+			;
+		if (i == HTTP_CONN_MAX)
+		{
+			close(conn); // too many clients
+			continue;
+		}
+		setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		memset(&gConn[i], 0, offsetof(HttpConnType, rx));
+		gConn[i].fd = conn;
+		gConn[i].lastTxMs = timeMsGet();
+		if (OK != evAdd(conn, EPOLLIN, connHandler, &gConn[i]))
+		{
+			close(conn);
+			gConn[i].fd = -1;
+		}
+	}
+}
+
+/*
+ * eventSend:
+ *	Queue one event (or comment) on every event stream, a client that
+ *	cannot take it is dropped (EventSource reconnects)
+ *********************************************************************************
+ */
+static void eventSend(const char* ev, int len, uint64_t nowMs, int ping)
+{
+	HttpConnType* c = NULL;
+	int i = 0;
+
+	for (i = 0; i < HTTP_CONN_MAX; i++)
+	{
+		c = &gConn[i];
+		if (c->fd < 0 || !c->sse || (ping && nowMs < c->lastTxMs + HTTP_PING_MS))
+		{
+			continue;
+		}
+		if (OK != txPut(c, ev, len))
+		{
+			connClose(c);
+			continue;
+		}
+		connUpdate(c);
+	}
+}
+
+int httpStart(int port)
+{
+	struct sockaddr_in addr;
+	int one = 1;
+	int i = 0;
+
+	for (i = 0; i < HTTP_CONN_MAX; i++)
+	{
+		gConn[i].fd = -1;
+	}
+	memset(gBoard, 0, sizeof(gBoard));
+	gListenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (gListenFd < 0)
+	{
+		return ERROR;
+	}
+	setsockopt(gListenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(gListenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+		|| listen(gListenFd, 64) < 0
+		|| OK != evAdd(gListenFd, EPOLLIN, acceptHandler, NULL))
+	{
+		close(gListenFd);
+		gListenFd = -1;
+		return ERROR;
+	}
+	return OK;
+}
+
+/*
+ * httpTick:
+ *	Called by the daemon after every sample: debounce the board changes
+ *	and send them to the event streams
+ *********************************************************************************
+ */
+void httpTick(uint64_t nowMs)
+{
+	HttpBoardType* b = NULL;
+	char ev[160];
+	u8 relays = 0;
+	u8 inputs = 0;
+	int id = 0;
+	int n = 0;
+
+	if (gListenFd < 0)
+	{
+		return;
+	}
+	for (id = 0; id < BOARD_NR_MAX; id++)
+	{
+		b = &gBoard[id];
+		if (DAEMON_BOARD_OK != daemonBoardGet(id, &relays, &inputs))
+		{
+			continue;
+		}
+		if (!b->valid)
+		{
+			b->valid = 1; // the streams get the state when they connect
+			b->relays = relays;
+			b->inputs = inputs;
+			continue;
+		}
+		if (relays == b->relays && inputs == b->inputs)
+		{
+			b->pendValid = 0; // a bounce, back to the sent state
+			continue;
+		}
+		if (!b->pendValid || relays != b->pendRelays || inputs != b->pendInputs)
+		{
+			b->pendValid = 1;
+			b->pendRelays = relays;
+			b->pendInputs = inputs;
+			b->pendMs = nowMs;
+		}
+		if (nowMs < b->pendMs + HTTP_DEBOUNCE_MS)
+		{
+			continue;
+		}
+		b->pendValid = 0;
+		b->relays = relays;
+		b->inputs = inputs;
+		n = snprintf(ev, sizeof(ev), "event: state\ndata: ");
+		n += boardJson(&ev[n], sizeof(ev) - n, id, relays, inputs);
+		n += snprintf(&ev[n], sizeof(ev) - n, "\n\n");
+		eventSend(ev, n, nowMs, 0);
+	}
+	eventSend(": ping\n\n", 8, nowMs, 1);
+}
+
+void httpStop(void)
+{
+	int i = 0;
+
+	if (gListenFd < 0)
+	{
+		return;
+	}
+	for (i = 0; i < HTTP_CONN_MAX; i++)
+	{
+		if (gConn[i].fd >= 0)
+		{
+			connClose(&gConn[i]);
+		}
+	}
+	evDel(gListenFd);
+	close(gListenFd);
+	gListenFd = -1;
+}
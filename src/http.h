@@ -0,0 +1,17 @@
+#ifndef HTTP_H_
+#define HTTP_H_
+
+#include <stdint.h>
+
+#define HTTP_CONN_MAX		256		// clients served at the same time
+#define HTTP_RX_MAX			2048	// request line + headers + body
+#define HTTP_TX_MAX			8192	// pending answer / events of one client
+#define HTTP_BODY_MAX		1024
+#define HTTP_DEBOUNCE_MS	50		// a state must hold this long to make an event
+#define HTTP_PING_MS		15000	// SSE comment that keeps proxies from closing the stream
+
+int httpStart(int port);
+void httpTick(uint64_t nowMs);
+void httpStop(void);
+
+#endif //HTTP_H_
@@ -0,0 +1,189 @@
+/*
+ * journal.c:
+ *	Opt-in journal of the last relay state written on every board, used to
+ *	restore the outputs after a power cycle. The journal is a small memory
+ *	mapped file; every change is written to it immediately. The daemon
+ *	(journalSyncDefer()) syncs it to the storage at most once every
+ *	JOURNAL_SYNC_MS, any other process syncs every change before returning.
+ *	The file is created only by "-journal on", a relay write with the
+ *	journal off only maps it read-only when it exists.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "relay.h"
+#include "journal.h"
+
+#define JOURNAL_MAGIC	0x324a5234	// "4RJ2"
+
+typedef struct
+{
+	uint32_t magic;
+	uint8_t enabled;
+	uint8_t dirty;
+	uint8_t reserved[2];
+	uint64_t syncMs;
+	uint8_t valid[BOARD_NR_MAX];
+	uint8_t relays[BOARD_NR_MAX];
+} JournalFileType;
+
+static JournalFileType* gJournal = NULL;
+static int gJournalWritable = 0;
+static int gJournalFailed = 0;
+static int gJournalDefer = 0;	// the syncs are left to journalFlush()
+
+/*
+ * journalOpen:
+ *	Map the journal, <writable> creates it if needed
+ *********************************************************************************
+ */
+static int journalOpen(int writable)
+{
+	if (gJournal != NULL && (gJournalWritable || !writable))
+	{
+		return OK;
+	}
+	if (gJournal != NULL)
+	{
+		mmFileClose(gJournal, sizeof(JournalFileType));
+		gJournal = NULL;
+	}
+	if (gJournalFailed)
+	{
+		return ERROR;
+	}
+	if (!writable)
+	{
+		gJournal = mmFileOpen(JOURNAL_FILE, sizeof(JournalFileType), 0);
+		if (gJournal == NULL)
+		{
+			return ERROR; // no journal yet
+		}
+		if (gJournal->magic == JOURNAL_MAGIC)
+		{
+			gJournalWritable = 0;
+			return OK;
+		}
+		mmFileClose(gJournal, sizeof(JournalFileType)); // reset below
+		gJournal = NULL;
+	}
+	if (0 != mmDirCreate(STATE_DIR))
+	{
+		gJournalFailed = 1;
+		return ERROR;
+	}
+	gJournal = mmFileOpen(JOURNAL_FILE, sizeof(JournalFileType), 1);
+	if (gJournal == NULL)
+	{
+		gJournalFailed = 1;
+		return ERROR;
+	}
+	gJournalWritable = 1;
+	if (gJournal->magic != JOURNAL_MAGIC)
+	{
+		memset(gJournal, 0, sizeof(JournalFileType));
+		gJournal->magic = JOURNAL_MAGIC;
+	}
+	return OK;
+}
+
+int journalEnable(int enable)
+{
+	if (OK != journalOpen(1))
+	{
+		return ERROR;
+	}
+	gJournal->enabled = enable ? 1 : 0;
+	if (!enable)
+	{
+		memset(gJournal->valid, 0, sizeof(gJournal->valid));
+	}
+	msync(gJournal, sizeof(JournalFileType), MS_SYNC);
+	return OK;
+}
+
+int journalIsEnabled(void)
+{
+	return (OK == journalOpen(0)) && gJournal->enabled;
+}
+
+static void journalSync(uint64_t ms)
+{
+	gJournal->dirty = 0;
+	gJournal->syncMs = ms;
+	msync(gJournal, sizeof(JournalFileType), MS_SYNC);
+}
+
+/*
+ * journalSyncDefer:
+ *	<defer> = 1 in the daemon, which calls journalFlush() after every
+ *	sample; 0 syncs the pending changes at once
+ *********************************************************************************
+ */
+void journalSyncDefer(int defer, uint64_t ms)
+{
+	gJournalDefer = defer;
+	if (!defer && gJournal != NULL && gJournalWritable && gJournal->dirty)
+	{
+		journalSync(ms);
+	}
+}
+
+/*
+ * journalFlush:
+ *	Sync the pending changes if the last sync is older than JOURNAL_SYNC_MS
+ *********************************************************************************
+ */
+void journalFlush(uint64_t ms)
+{
+	if (gJournal == NULL || !gJournal->dirty || OK != journalOpen(1))
+	{
+		return;
+	}
+	if (ms - gJournal->syncMs >= JOURNAL_SYNC_MS || ms < gJournal->syncMs)
+	{
+		journalSync(ms);
+	}
+}
+
+int journalRecord(int id, uint8_t relays, uint64_t ms)
+{
+	if ( (id < 0) || (id >= BOARD_NR_MAX) || !journalIsEnabled())
+	{
+		return ERROR;
+	}
+	if (gJournal->valid[id] && gJournal->relays[id] == relays)
+	{
+		return OK;
+	}
+	if (OK != journalOpen(1))
+	{
+		return ERROR;
+	}
+	gJournal->relays[id] = relays;
+	gJournal->valid[id] = 1;
+	gJournal->dirty = 1;
+	if (!gJournalDefer) // nobody would sync it after this process
+	{
+		journalSync(ms);
+		return OK;
+	}
+	journalFlush(ms);
+	return OK;
+}
+
+int journalGet(int id, uint8_t* relays)
+{
+	if ( (id < 0) || (id >= BOARD_NR_MAX) || relays == NULL
+		|| !journalIsEnabled() || !gJournal->valid[id])
+	{
+		return ERROR;
+	}
+	*relays = gJournal->relays[id];
+	return OK;
+}
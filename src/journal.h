@@ -0,0 +1,17 @@
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include <stdint.h>
+#include "mmfile.h"
+
+#define JOURNAL_FILE	STATE_DIR "/journal.dat"
+#define JOURNAL_SYNC_MS	1000	// at most one fsync per second, the rest is coalesced
+
+int journalEnable(int enable);
+int journalIsEnabled(void);
+int journalRecord(int id, uint8_t relays, uint64_t ms);
+void journalSyncDefer(int defer, uint64_t ms);
+void journalFlush(uint64_t ms);
+int journalGet(int id, uint8_t* relays);
+
+#endif //JOURNAL_H_
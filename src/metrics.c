@@ -0,0 +1,107 @@
+/*
+ * metrics.c:
+ *	Operation counters shared by all the processes using the boards,
+ *	kept in a memory mapped file under /run (reset at boot)
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+#include "relay.h"
+#include "wear.h"
+#include "health.h"
+#include "mux.h"
+#include "adapter.h"
+#include "sim.h"
+#include "metrics.h"
+
+typedef struct
+{
+	uint64_t counter[METRIC_COUNT][BOARD_NR_MAX];
+} MetricsFileType;
+
+typedef struct
+{
+	const char* name;
+	const char* help;
+} MetricDescType;
+
+static const MetricDescType gMetricDesc[METRIC_COUNT] =
+{
+	{"sm4relind_relay_writes_total", "Output port writes sent to the board"},
+	{"sm4relind_relay_writes_suppressed_total",
+		"Output port writes skipped because the relays already had the value"},
+	{"sm4relind_relay_verify_rewrites_total",
+		"Output port writes repeated because the sampled relays did not match"}};
+
+static MetricsFileType* gMetrics = NULL;
+static int gMetricsFailed = 0;
+
+static int metricsOpen(void)
+{
+	if (gMetrics != NULL)
+	{
+		return OK;
+	}
+	if (gMetricsFailed || 0 != mmDirCreate(RUN_DIR))
+	{
+		gMetricsFailed = 1;
+		return ERROR;
+	}
+	gMetrics = mmFileOpen(METRICS_FILE, sizeof(MetricsFileType), 1);
+	if (gMetrics == NULL)
+	{
+		gMetricsFailed = 1;
+		return ERROR;
+	}
+	return OK;
+}
+
+void metricInc(MetricIdType id, int board)
+{
+	if (id >= METRIC_COUNT || board < 0 || board >= BOARD_NR_MAX
+		|| OK != metricsOpen())
+	{
+		return;
+	}
+	__atomic_fetch_add(&gMetrics->counter[id][board], 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * metricsPrint:
+ *	All the counters in Prometheus text exposition format
+ *********************************************************************************
+ */
+void metricsPrint(FILE* out)
+{
+	int id = 0;
+	int board = 0;
+	uint64_t val = 0;
+
+	if (OK == metricsOpen())
+	{
+		for (id = 0; id < METRIC_COUNT; id++)
+		{
+			fprintf(out, "# HELP %s %s\n", gMetricDesc[id].name, gMetricDesc[id].help);
+			fprintf(out, "# TYPE %s counter\n", gMetricDesc[id].name);
+			for (board = 0; board < BOARD_NR_MAX; board++)
+			{
+				val = __atomic_load_n(&gMetrics->counter[id][board], __ATOMIC_RELAXED);
+				if (val == 0 && BOARD_BUS(board) != I2C_BUS_DEFAULT)
+				{
+					continue; // the other buses only when used
+				}
+				fprintf(out, "%s{bus=\"%d\",stack=\"%d\"} %llu\n", gMetricDesc[id].name,
+					BOARD_BUS(board), BOARD_STACK(board), (unsigned long long)val);
+			}
+		}
+	}
+	wearMetricsPrint(out);
+	healthMetricsPrint(out);
+	muxMetricsPrint(out);
+	adapterMetricsPrint(out);
+	simMetricsPrint(out);
+}
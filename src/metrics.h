@@ -0,0 +1,20 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdio.h>
+#include "mmfile.h"
+
+#define METRICS_FILE	RUN_DIR "/metrics"
+
+typedef enum
+{
+	METRIC_WRITES = 0,
+	METRIC_WRITES_SUPPRESSED,
+	METRIC_VERIFY_REWRITES,
+	METRIC_COUNT
+} MetricIdType;
+
+void metricInc(MetricIdType id, int board);
+void metricsPrint(FILE* out);
+
+#endif //METRICS_H_
@@ -0,0 +1,153 @@
+/*
+ * mmfile.c:
+ *	Small helpers for the fixed size memory mapped files used to keep
+ *	persistent state (history, counters) between runs. With the simulator
+ *	on, the files of RUN_DIR and STATE_DIR live under SIM_DIR instead, so
+ *	simulated boards never leave state for the real ones.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mmfile.h"
+#include "sim.h"
+
+#define MM_PATH_RING	4	// mmPath() results usable at the same time by one thread
+
+static const char* dirMap(const char* path, const char* dir)
+{
+	size_t len = strlen(dir);
+
+	if (strncmp(path, dir, len) != 0 || (path[len] != '/' && path[len] != 0))
+	{
+		return NULL;
+	}
+	return &path[len];
+}
+
+/*
+ * mmPath:
+ *	The path to use for a RUN_DIR or STATE_DIR file, moved under SIM_DIR
+ *	when SM4RELIND_SIM is set. Other paths are returned as they are.
+ *********************************************************************************
+ */
+const char* mmPath(const char* path)
+{
+	static __thread char buf[MM_PATH_RING][MM_PATH_MAX];
+	static __thread int next = 0;
+	const char* sim = getenv(SIM_ENV);
+	const char* rest = NULL;
+	char* out = NULL;
+
+	if (sim == NULL || *sim == 0)
+	{
+		return path;
+	}
+	out = buf[next];
+	next = (next + 1) % MM_PATH_RING;
+	if ( (rest = dirMap(path, RUN_DIR)) != NULL)
+	{
+		snprintf(out, MM_PATH_MAX, "%s%s", SIM_DIR, rest);
+	}
+	else if ( (rest = dirMap(path, STATE_DIR)) != NULL)
+	{
+		snprintf(out, MM_PATH_MAX, "%s/state%s", SIM_DIR, rest);
+	}
+	else
+	{
+		return path;
+	}
+	return out;
+}
+
+/*
+ * mmDirCreate:
+ *	Create a directory (and its parents) if it does not exist
+ *********************************************************************************
+ */
+int mmDirCreate(const char* dir)
+{
+	char path[MM_PATH_MAX];
+	char* p = NULL;
+
+	dir = mmPath(dir);
+	if (strlen(dir) >= sizeof(path))
+	{
+		return -1;
+	}
+	strcpy(path, dir);
+	for (p = path + 1; *p; p++)
+	{
+		if (*p == '/')
+		{
+			*p = 0;
+			if ( (mkdir(path, 0755) != 0) && (errno != EEXIST))
+			{
+				return -1;
+			}
+			*p = '/';
+		}
+	}
+	if ( (mkdir(path, 0755) != 0) && (errno != EEXIST))
+	{
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * mmFileOpen:
+ *	Map a file of exactly <size> bytes, creating it (zero filled) if needed.
+ *	Return NULL on failure
+ *********************************************************************************
+ */
+void* mmFileOpen(const char* path, size_t size, int writable)
+{
+	int fd = 0;
+	void* addr = NULL;
+	struct stat st;
+
+	fd = open(mmPath(path), writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return NULL;
+	}
+	if ((size_t)st.st_size != size)
+	{
+		if (!writable || ftruncate(fd, size) != 0)
+		{
+			close(fd);
+			return NULL;
+		}
+	}
+	addr = mmap(NULL, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+	MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+	{
+		return NULL;
+	}
+	return addr;
+}
+
+void mmFileClose(void* addr, size_t size)
+{
+	if (addr != NULL)
+	{
+		munmap(addr, size);
+	}
+}
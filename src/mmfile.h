@@ -0,0 +1,16 @@
+#ifndef MMFILE_H_
+#define MMFILE_H_
+
+#include <stddef.h>
+
+#define STATE_DIR	"/var/lib/4relind"
+#define RUN_DIR		"/run/4relind"
+#define SIM_DIR		"/run/4relind-sim"	// RUN_DIR and STATE_DIR (SIM_DIR/state) of the simulator
+#define MM_PATH_MAX	256
+
+const char* mmPath(const char* path);
+int mmDirCreate(const char* dir);
+void* mmFileOpen(const char* path, size_t size, int writable);
+void mmFileClose(void* addr, size_t size);
+
+#endif //MMFILE_H_
@@ -0,0 +1,409 @@
+/*
+ * modbus.c:
+ *	Modbus TCP server of the daemon. Every detected board gets
+ *	RELAY_CH_NR_MAX coils (relays) and IN_CH_NR_MAX discrete inputs (opto
+ *	inputs) starting at <board id> * 4, so the boards of the default bus
+ *	are at 0..31. Reads are answered from the daemon samples and cost no bus
+ *	traffic however many masters poll; a write multiple coils request is
+ *	applied as one write per board, the boards batched per bus.
+ *	Function codes: 1 read coils, 2 read discrete inputs, 5 write single
+ *	coil, 15 write multiple coils. The unit id is echoed, not checked.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "relay.h"
+#include "daemon.h"
+#include "evloop.h"
+#include "modbus.h"
+
+typedef struct
+{
+	int fd;		// -1 = free slot
+	int rxLen;
+	int txLen;
+	int txOff;
+	uint8_t rx[2 * MODBUS_ADU_MAX];
+	uint8_t tx[4 * MODBUS_ADU_MAX];
+} ModbusConnType;
+
+static ModbusConnType gConn[MODBUS_CONN_MAX];
+static int gListenFd = -1;
+
+static int exception(uint8_t* rsp, int fc, int code)
+{
+	rsp[0] = 0x80 | fc;
+	rsp[1] = code;
+	return 2;
+}
+
+static int get16(const uint8_t* p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+/*
+ * bitsRead:
+ *	Read coils / read discrete inputs. A board that was not detected reads
+ *	as 0, one that stopped answering fails the request.
+ *********************************************************************************
+ */
+static int bitsRead(const uint8_t* req, int n, uint8_t* rsp)
+{
+	int fc = req[0];
+	int per = (fc == MODBUS_FC_READ_COILS) ? RELAY_CH_NR_MAX : IN_CH_NR_MAX;
+	int start = 0;
+	int qty = 0;
+	int lastId = -1;
+	int id = 0;
+	int i = 0;
+	u8 relays = 0;
+	u8 inputs = 0;
+	u8 bits = 0;
+
+	if (n != 5)
+	{
+		return exception(rsp, fc, MODBUS_EX_VALUE);
+	}
+	start = get16(&req[1]);
+	qty = get16(&req[3]);
+	if (qty < 1 || qty > MODBUS_BITS_MAX)
+	{
+		return exception(rsp, fc, MODBUS_EX_VALUE);
+	}
+	if (start + qty > BOARD_NR_MAX * per)
+	{
+		return exception(rsp, fc, MODBUS_EX_ADDRESS);
+	}
+	rsp[0] = fc;
+	rsp[1] = (qty + 7) / 8;
+	memset(&rsp[2], 0, rsp[1]);
+	for (i = 0; i < qty; i++)
+	{
+		id = (start + i) / per;
+		if (id != lastId)
+		{
+			switch (daemonBoardGet(id, &relays, &inputs))
+			{
+			case DAEMON_BOARD_OK:
+				bits = (fc == MODBUS_FC_READ_COILS) ? relays : inputs;
+				break;
+			case DAEMON_BOARD_OFFLINE:
+				return exception(rsp, fc, MODBUS_EX_TARGET);
+			default:
+				bits = 0;
+				break;
+			}
+			lastId = id;
+		}
+		if (bits & (1 << ((start + i) % per)))
+		{
+			rsp[2 + i / 8] |= 1 << (i % 8);
+		}
+	}
+	return 2 + rsp[1];
+}
+
+/*
+ * coilsWrite:
+ *	Write <qty> coils from <start>, bit i of <data> for coil <start> + i.
+ *	Group the coils per board and apply all of them with one daemon call.
+ *	Return 0 or a Modbus exception code.
+ *********************************************************************************
+ */
+static int coilsWrite(int start, int qty, const uint8_t* data)
+{
+	int ids[BOARD_NR_MAX];
+	u8 masks[BOARD_NR_MAX];
+	u8 vals[BOARD_NR_MAX];
+	u8 relays = 0;
+	u8 inputs = 0;
+	int m = 0;
+	int id = 0;
+	int ch = 0;
+	int i = 0;
+
+	if (start + qty > BOARD_NR_MAX * RELAY_CH_NR_MAX)
+	{
+		return MODBUS_EX_ADDRESS;
+	}
+	for (i = 0; i < qty; i++)
+	{
+		id = (start + i) / RELAY_CH_NR_MAX;
+		ch = (start + i) % RELAY_CH_NR_MAX;
+		if (m == 0 || ids[m - 1] != id)
+		{
+			switch (daemonBoardGet(id, &relays, &inputs))
+			{
+			case DAEMON_BOARD_OK:
+				break;
+			case DAEMON_BOARD_OFFLINE:
+				return MODBUS_EX_TARGET;
+			default:
+				return MODBUS_EX_ADDRESS;
+			}
+			ids[m] = id;
+			masks[m] = 0;
+			vals[m++] = 0;
+		}
+		masks[m - 1] |= 1 << ch;
+		if (data[i / 8] & (1 << (i % 8)))
+		{
+			vals[m - 1] |= 1 << ch;
+		}
+	}
+	if (daemonRelaysApply(ids, masks, vals, m) != m)
+	{
+		return MODBUS_EX_FAILURE;
+	}
+	return 0;
+}
+
+/*
+ * pduHandle:
+ *	Answer the request PDU <req> (<n> bytes) in <rsp>, return its length
+ *********************************************************************************
+ */
+static int pduHandle(const uint8_t* req, int n, uint8_t* rsp)
+{
+	uint8_t coil = 0;
+	int qty = 0;
+	int ex = 0;
+
+	switch (req[0])
+	{
+	case MODBUS_FC_READ_COILS:
+	case MODBUS_FC_READ_INPUTS:
+		return bitsRead(req, n, rsp);
+	case MODBUS_FC_WRITE_COIL:
+		if (n != 5 || (get16(&req[3]) != 0xff00 && get16(&req[3]) != 0))
+		{
+			return exception(rsp, req[0], MODBUS_EX_VALUE);
+		}
+		coil = (req[3] == 0xff) ? 1 : 0;
+		if ( (ex = coilsWrite(get16(&req[1]), 1, &coil)) != 0)
+		{
+			return exception(rsp, req[0], ex);
+		}
+		memcpy(rsp, req, 5);
+		return 5;
+	case MODBUS_FC_WRITE_COILS:
+		qty = (n >= 6) ? get16(&req[3]) : 0;
+		if (qty < 1 || qty > MODBUS_WR_BITS_MAX || req[5] != (qty + 7) / 8
+			|| n != 6 + req[5])
+		{
+			return exception(rsp, req[0], MODBUS_EX_VALUE);
+		}
+		if ( (ex = coilsWrite(get16(&req[1]), qty, &req[6])) != 0)
+		{
+			return exception(rsp, req[0], ex);
+		}
+		memcpy(rsp, req, 5);
+		return 5;
+	default:
+		return exception(rsp, req[0], MODBUS_EX_FUNCTION);
+	}
+}
+
+static void connClose(ModbusConnType* c)
+{
+	evDel(c->fd);
+	close(c->fd);
+	c->fd = -1;
+}
+
+/*
+ * connProcess:
+ *	Answer the complete requests received, as long as the answers fit in
+ *	the transmit buffer. ERROR if the stream is not Modbus TCP.
+ *********************************************************************************
+ */
+static int connProcess(ModbusConnType* c)
+{
+	uint8_t* rsp = NULL;
+	int len = 0;
+	int pduLen = 0;
+
+	while (c->rxLen >= MODBUS_MBAP_LEN
+		&& c->txLen + MODBUS_ADU_MAX <= (int)sizeof(c->tx))
+	{
+		len = get16(&c->rx[4]); // unit id + PDU
+		if (get16(&c->rx[2]) != 0 || len < 2 || len > MODBUS_ADU_MAX - 6)
+		{
+			return ERROR;
+		}
+		if (c->rxLen < 6 + len)
+		{
+			break;
+		}
+		rsp = &c->tx[c->txLen];
+		memcpy(rsp, c->rx, MODBUS_MBAP_LEN); // transaction, protocol, unit
+		pduLen = pduHandle(&c->rx[MODBUS_MBAP_LEN], len - 1, &rsp[MODBUS_MBAP_LEN]);
+		rsp[4] = (pduLen + 1) >> 8;
+		rsp[5] = (pduLen + 1) & 0xff;
+		c->txLen += MODBUS_MBAP_LEN + pduLen;
+		c->rxLen -= 6 + len;
+		memmove(c->rx, &c->rx[6 + len], c->rxLen);
+	}
+	return OK;
+}
+
+static int connFlush(ModbusConnType* c)
+{
+	ssize_t n = 0;
+
+	while (c->txOff < c->txLen)
+	{
+		n = send(c->fd, &c->tx[c->txOff], c->txLen - c->txOff, MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? OK : ERROR;
+		}
+		c->txOff += n;
+	}
+	c->txOff = 0;
+	c->txLen = 0;
+	return OK;
+}
+
+/*
+ * connHandler:
+ *	A master socket is ready. While answers are pending only the output is
+ *	watched, so a master that does not read cannot make the server buffer.
+ *********************************************************************************
+ */
+static void connHandler(int fd, uint32_t events, void* arg)
+{
+	ModbusConnType* c = (ModbusConnType*)arg;
+	ssize_t n = 0;
+	int rxLen = 0;
+
+	if (events & (EPOLLERR | EPOLLHUP))
+	{
+		connClose(c);
+		return;
+	}
+	if (events & EPOLLIN)
+	{
+		n = recv(fd, &c->rx[c->rxLen], sizeof(c->rx) - c->rxLen, 0);
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+		{
+			connClose(c);
+			return;
+		}
+		c->rxLen += (n > 0) ? n : 0;
+	}
+	do
+	{
+		rxLen = c->rxLen;
+		if (OK != connProcess(c) || OK != connFlush(c))
+		{
+			connClose(c);
+			return;
+		}
+	} while (c->txLen == 0 && c->rxLen > 0 && c->rxLen < rxLen);
+	evMod(fd, (c->txLen > 0) ? EPOLLOUT : EPOLLIN);
+}
+
+static void acceptHandler(int fd, uint32_t events, void* arg)
+{
+	int conn = 0;
+	int one = 1;
+	int i = 0;
+
+	(void)events;
+	(void)arg;
+	while ( (conn = accept(fd, NULL, NULL)) >= 0)
+	{
+		fcntl(conn, F_SETFL, O_NONBLOCK);
+		fcntl(conn, F_SETFD, FD_CLOEXEC);
+		for (i = 0; i < MODBUS_CONN_MAX && gConn[i].fd >= 0; i++)
+			;
+		if (i == MODBUS_CONN_MAX)
+		{
+			close(conn); // too many masters
+			continue;
+		}
+		setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		gConn[i].fd = conn;
+		gConn[i].rxLen = 0;
+		gConn[i].txLen = 0;
+		gConn[i].txOff = 0;
+		if (OK != evAdd(conn, EPOLLIN, connHandler, &gConn[i]))
+		{
+			close(conn);
+			gConn[i].fd = -1;
+		}
+	}
+}
+
+/*
+ * modbusStart:
+ *	Listen on TCP <port> of all interfaces, the daemon event loop serves it
+ *********************************************************************************
+ */
+int modbusStart(int port)
+{
+	struct sockaddr_in addr;
+	int one = 1;
+	int i = 0;
+
+	for (i = 0; i < MODBUS_CONN_MAX; i++)
+	{
+		gConn[i].fd = -1;
+	}
+	gListenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (gListenFd < 0)
+	{
+		return ERROR;
+	}
+	setsockopt(gListenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(gListenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+		|| listen(gListenFd, MODBUS_CONN_MAX) < 0
+		|| OK != evAdd(gListenFd, EPOLLIN, acceptHandler, NULL))
+	{
+		close(gListenFd);
+		gListenFd = -1;
+		return ERROR;
+	}
+	return OK;
+}
+
+void modbusStop(void)
+{
+	int i = 0;
+
+	if (gListenFd < 0)
+	{
+		return;
+	}
+	for (i = 0; i < MODBUS_CONN_MAX; i++)
+	{
+		if (gConn[i].fd >= 0)
+		{
+			connClose(&gConn[i]);
+		}
+	}
+	evDel(gListenFd);
+	close(gListenFd);
+	gListenFd = -1;
+}
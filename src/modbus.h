@@ -0,0 +1,26 @@
+#ifndef MODBUS_H_
+#define MODBUS_H_
+
+#define MODBUS_CONN_MAX		64		// masters served at the same time
+#define MODBUS_ADU_MAX		260		// MBAP header + PDU
+#define MODBUS_MBAP_LEN		7
+#define MODBUS_BITS_MAX		2000	// coils/inputs per read
+#define MODBUS_WR_BITS_MAX	1968	// coils per write multiple
+
+// function codes
+#define MODBUS_FC_READ_COILS		0x01
+#define MODBUS_FC_READ_INPUTS		0x02
+#define MODBUS_FC_WRITE_COIL		0x05
+#define MODBUS_FC_WRITE_COILS		0x0f
+
+// exception codes
+#define MODBUS_EX_FUNCTION		0x01
+#define MODBUS_EX_ADDRESS		0x02
+#define MODBUS_EX_VALUE			0x03
+#define MODBUS_EX_FAILURE		0x04
+#define MODBUS_EX_TARGET		0x0b	// gateway target failed to respond
+
+int modbusStart(int port);
+void modbusStop(void);
+
+#endif //MODBUS_H_
@@ -0,0 +1,654 @@
+/*
+ * mqtt.c:
+ *	MQTT 3.1.1 bridge of the daemon (QoS 0, no library needed). Topics under
+ *	<prefix>/<id>, <id> as typed on the command line ("0", "2.3"):
+ *		relays, inputs		board bitmap, decimal
+ *		relay/<ch>, input/<ch>	channel state, "1" or "0"
+ *	are published retained, and only when they change, from the daemon
+ *	samples. <prefix>/status is "online" or "offline" (the will).
+ *	Commands:
+ *		<prefix>/<id>/relays/set	bitmap
+ *		<prefix>/<id>/relay/<ch>/set	"1"/"on" or "0"/"off"
+ *	The commands of one board are collected for MQTT_COALESCE_MS and applied
+ *	with one write, the boards due together in one batched transfer.
+ *	A lost broker connection is retried every MQTT_RECONNECT_MS and the full
+ *	state is published again once it is back.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "relay.h"
+#include "thread.h"
+#include "daemon.h"
+#include "evloop.h"
+#include "mqtt.h"
+
+typedef enum
+{
+	MQTT_IDLE = 0,		// not connected, retry at gRetryMs
+	MQTT_CONNECTING,	// TCP connect in progress
+	MQTT_WAIT_ACK,		// CONNECT sent
+	MQTT_UP
+} MqttStateType;
+
+typedef struct
+{
+	u8 valid;		// published on this connection
+	u8 relays;
+	u8 inputs;
+	u8 pendMask;	// relays commanded in the current window
+	u8 pendVal;
+	uint64_t pendMs;	// first command of the window
+} MqttBoardType;
+
+static ConfigMqttType gCfg;
+static int gStarted = 0;
+static MqttBoardType gBoard[BOARD_NR_MAX];
+static MqttStateType gState = MQTT_IDLE;
+static int gFd = -1;
+static uint64_t gRetryMs = 0;
+static struct sockaddr_storage gAddr;	// broker, resolved once by mqttStart()
+static socklen_t gAddrLen = 0;
+static uint64_t gConnMs = 0;
+static uint64_t gLastTxMs = 0;
+static uint64_t gLastRxMs = 0;
+static uint8_t gRx[MQTT_RX_MAX];
+static int gRxLen = 0;
+static uint8_t gTx[MQTT_TX_MAX];
+static int gTxLen = 0;
+static int gTxOff = 0;
+static int gTxFull = 0;
+
+static void mqttClose(void)
+{
+	int id = 0;
+
+	if (gFd >= 0)
+	{
+		evDel(gFd);
+		close(gFd);
+		gFd = -1;
+	}
+	if (gState == MQTT_UP)
+	{
+		printf("MQTT connection to %s:%d lost\n", gCfg.host, gCfg.port);
+	}
+	gState = MQTT_IDLE;
+	gRetryMs = timeMsGet() + MQTT_RECONNECT_MS;
+	gRxLen = 0;
+	gTxLen = 0;
+	gTxOff = 0;
+	gTxFull = 0;
+	for (id = 0; id < BOARD_NR_MAX; id++)
+	{
+		gBoard[id].valid = 0;
+	}
+}
+
+/*
+ * packetPut:
+ *	Queue one control packet: <type>, remaining length, <body>
+ *********************************************************************************
+ */
+static void packetPut(int type, const uint8_t* body, int len)
+{
+	uint8_t hdr[5];
+	int n = 0;
+	int rem = len;
+
+	hdr[n++] = type;
+	do
+	{
+		hdr[n] = rem & 0x7f;
+		rem >>= 7;
+		if (rem > 0)
+		{
+			hdr[n] |= 0x80;
+		}
+		n++;
+	} while (rem > 0);
+	if (gTxLen + n + len > MQTT_TX_MAX)
+	{
+		gTxFull = 1; // dropped, the connection is restarted by the caller
+		return;
+	}
+	memcpy(&gTx[gTxLen], hdr, n);
+	memcpy(&gTx[gTxLen + n], body, len);
+	gTxLen += n + len;
+}
+
+static int strPut(uint8_t* buf, const char* str)
+{
+	int len = strlen(str);
+
+	buf[0] = len >> 8;
+	buf[1] = len & 0xff;
+	memcpy(&buf[2], str, len);
+	return 2 + len;
+}
+
+static void publish(const char* topic, const char* payload, int retain)
+{
+	uint8_t body[192];
+	int n = 0;
+	int len = strlen(payload);
+
+	if (strlen(topic) + len + 2 > sizeof(body))
+	{
+		return;
+	}
+	n = strPut(body, topic);
+	memcpy(&body[n], payload, len);
+	packetPut(MQTT_PUBLISH | (retain ? 0x01 : 0), body, n + len);
+}
+
+static void mqttFlush(void)
+{
+	ssize_t n = 0;
+
+	while (gTxOff < gTxLen)
+	{
+		n = send(gFd, &gTx[gTxOff], gTxLen - gTxOff, MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				mqttClose();
+				return;
+			}
+			break;
+		}
+		gTxOff += n;
+		gLastTxMs = timeMsGet();
+	}
+	if (gTxOff == gTxLen)
+	{
+		gTxOff = 0;
+		gTxLen = 0;
+	}
+	evMod(gFd, EPOLLIN | ((gTxLen > 0) ? EPOLLOUT : 0));
+}
+
+static void connectSend(void)
+{
+	uint8_t body[160];
+	char topic[48];
+	char id[24];
+	int n = 0;
+
+	snprintf(topic, sizeof(topic), "%s/status", gCfg.prefix);
+	snprintf(id, sizeof(id), "4relind-%d", (int)getpid());
+	n = strPut(body, "MQTT");
+	body[n++] = 4;	// protocol level 3.1.1
+	body[n++] = 0x02 | 0x04 | 0x20;	// clean session, will, will retain
+	body[n++] = MQTT_KEEPALIVE_S >> 8;
+	body[n++] = MQTT_KEEPALIVE_S & 0xff;
+	n += strPut(&body[n], id);
+	n += strPut(&body[n], topic);
+	n += strPut(&body[n], "offline");
+	packetPut(MQTT_CONNECT, body, n);
+	gState = MQTT_WAIT_ACK;
+	mqttFlush();
+}
+
+static void subscribeSend(void)
+{
+	uint8_t body[160];
+	char filter[64];
+	int n = 0;
+
+	body[n++] = 0;
+	body[n++] = 1;	// packet id
+	snprintf(filter, sizeof(filter), "%s/+/relays/set", gCfg.prefix);
+	n += strPut(&body[n], filter);
+	body[n++] = 0;	// QoS 0
+	snprintf(filter, sizeof(filter), "%s/+/relay/+/set", gCfg.prefix);
+	n += strPut(&body[n], filter);
+	body[n++] = 0;
+	packetPut(MQTT_SUBSCRIBE, body, n);
+}
+
+/*
+ * commandGet:
+ *	Record the command of one "set" topic in the board window
+ *********************************************************************************
+ */
+static void commandGet(const char* topic, const char* payload)
+{
+	char idStr[16];
+	char expect[24];
+	const char* p = NULL;
+	const char* rest = NULL;
+	char* end = NULL;
+	int len = strlen(gCfg.prefix);
+	int id = 0;
+	int ch = 0;
+	long val = 0;
+	u8 mask = 0;
+	MqttBoardType* b = NULL;
+
+	if (strncmp(topic, gCfg.prefix, len) != 0 || topic[len] != '/')
+	{
+		return;
+	}
+	p = &topic[len + 1];
+	if ( (rest = strchr(p, '/')) == NULL || rest - p >= (int)sizeof(idStr))
+	{
+		return;
+	}
+	memcpy(idStr, p, rest - p);
+	idStr[rest - p] = 0;
+	if ( (id = boardIdParse(idStr)) < 0)
+	{
+		return;
+	}
+	if (strcmp(rest, "/relays/set") == 0)
+	{
+		val = strtol(payload, &end, 0);
+		if (end == payload || *end != 0 || val < 0 || val > 0x0f)
+		{
+			return;
+		}
+		mask = 0x0f;
+	}
+	else if (sscanf(rest, "/relay/%d/set", &ch) == 1 && ch >= CHANNEL_NR_MIN
+		&& ch <= RELAY_CH_NR_MAX && snprintf(expect, sizeof(expect), "/relay/%d/set", ch) > 0
+		&& strcmp(rest, expect) == 0)
+	{
+		if (strcmp(payload, "1") == 0 || strcasecmp(payload, "on") == 0)
+		{
+			val = 0x0f;
+		}
+		else if (strcmp(payload, "0") == 0 || strcasecmp(payload, "off") == 0)
+		{
+			val = 0;
+		}
+		else
+		{
+			return;
+		}
+		mask = 1 << (ch - 1);
+	}
+	else
+	{
+		return;
+	}
+	b = &gBoard[id];
+	if (b->pendMask == 0)
+	{
+		b->pendMs = timeMsGet();
+	}
+	b->pendMask |= mask;
+	b->pendVal = (b->pendVal & ~mask) | (val & mask);
+}
+
+/*
+ * packetHandle:
+ *	One control packet from the broker, <body> of <len> bytes
+ *********************************************************************************
+ */
+static void packetHandle(int type, uint8_t* body, int len)
+{
+	char topic[128];
+	char payload[32];
+	int tlen = 0;
+	int off = 0;
+
+	switch (type & 0xf0)
+	{
+	case MQTT_CONNACK:
+		if (len < 2 || body[1] != 0)
+		{
+			printf("MQTT broker %s:%d refused the connection (%d)\n", gCfg.host, gCfg.port,
+				len < 2 ? -1 : body[1]);
+			mqttClose();
+			return;
+		}
+		gState = MQTT_UP;
+		printf("MQTT connected to %s:%d\n", gCfg.host, gCfg.port);
+		snprintf(topic, sizeof(topic), "%s/status", gCfg.prefix);
+		publish(topic, "online", 1);
+		subscribeSend();
+		break;
+	case MQTT_PUBLISH:
+		if (len < 2)
+		{
+			return;
+		}
+		tlen = (body[0] << 8) | body[1];
+		off = 2 + tlen + ((type & 0x06) ? 2 : 0); // packet id if QoS > 0
+		if (off > len || tlen >= (int)sizeof(topic) || len - off >= (int)sizeof(payload))
+		{
+			return;
+		}
+		memcpy(topic, &body[2], tlen);
+		topic[tlen] = 0;
+		memcpy(payload, &body[off], len - off);
+		payload[len - off] = 0;
+		commandGet(topic, payload);
+		break;
+	default:
+		break; // SUBACK, PINGRESP
+	}
+}
+
+static void mqttReceive(void)
+{
+	ssize_t n = 0;
+	int len = 0;
+	int hdr = 0;
+	int shift = 0;
+
+	n = recv(gFd, &gRx[gRxLen], MQTT_RX_MAX - gRxLen, 0);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+	{
+		mqttClose();
+		return;
+	}
+	if (n < 0)
+	{
+		return;
+	}
+	gRxLen += n;
+	gLastRxMs = timeMsGet();
+	while (gRxLen >= 2)
+	{
+		len = 0;
+		shift = 0;
+		for (hdr = 1; hdr < gRxLen && hdr <= 4; hdr++)
+		{
+			len |= (gRx[hdr] & 0x7f) << shift;
+			shift += 7;
+			if (!(gRx[hdr] & 0x80))
+			{
+				break;
+			}
+		}
+		if (hdr > 4 || 1 + hdr + len > MQTT_RX_MAX)
+		{
+			mqttClose(); // larger than anything we subscribed to
+			return;
+		}
+		if (hdr >= gRxLen || gRxLen < 1 + hdr + len)
+		{
+			break;
+		}
+		packetHandle(gRx[0], &gRx[1 + hdr], len);
+		if (gFd < 0)
+		{
+			return;
+		}
+		gRxLen -= 1 + hdr + len;
+		memmove(gRx, &gRx[1 + hdr + len], gRxLen);
+	}
+}
+
+static void mqttHandler(int fd, uint32_t events, void* arg)
+{
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	(void)arg;
+	if (gState == MQTT_CONNECTING)
+	{
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+		{
+			mqttClose();
+			return;
+		}
+		connectSend();
+		return;
+	}
+	if (events & (EPOLLERR | EPOLLHUP))
+	{
+		mqttClose();
+		return;
+	}
+	if (events & EPOLLIN)
+	{
+		mqttReceive();
+	}
+	if (gFd >= 0)
+	{
+		mqttFlush();
+	}
+}
+
+/*
+ * mqttResolve:
+ *	Resolve the broker address; getaddrinfo() blocks, so only at start
+ *********************************************************************************
+ */
+static int mqttResolve(void)
+{
+	struct addrinfo hints;
+	struct addrinfo* res = NULL;
+	char port[8];
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(port, sizeof(port), "%d", gCfg.port);
+	if (getaddrinfo(gCfg.host, port, &hints, &res) != 0)
+	{
+		return ERROR;
+	}
+	memcpy(&gAddr, res->ai_addr, res->ai_addrlen);
+	gAddrLen = res->ai_addrlen;
+	freeaddrinfo(res);
+	return OK;
+}
+
+static void mqttConnect(void)
+{
+	int one = 1;
+
+	gRetryMs = timeMsGet() + MQTT_RECONNECT_MS;
+	gFd = socket(gAddr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (gFd >= 0)
+	{
+		setsockopt(gFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if ( (connect(gFd, (struct sockaddr*)&gAddr, gAddrLen) == 0 || errno == EINPROGRESS)
+			&& OK == evAdd(gFd, EPOLLOUT, mqttHandler, NULL))
+		{
+			gState = MQTT_CONNECTING;
+			gConnMs = timeMsGet();
+		}
+		else
+		{
+			close(gFd);
+			gFd = -1;
+		}
+	}
+}
+
+/*
+ * commandsApply:
+ *	Write the boards whose command window is over, with one daemon call
+ *********************************************************************************
+ */
+static void commandsApply(uint64_t nowMs)
+{
+	int ids[BOARD_NR_MAX];
+	u8 masks[BOARD_NR_MAX];
+	u8 vals[BOARD_NR_MAX];
+	int m = 0;
+	int cnt = 0;
+	int id = 0;
+
+	for (id = 0; id < BOARD_NR_MAX; id++)
+	{
+		if (gBoard[id].pendMask != 0 && nowMs >= gBoard[id].pendMs + MQTT_COALESCE_MS)
+		{
+			ids[m] = id;
+			masks[m] = gBoard[id].pendMask;
+			vals[m++] = gBoard[id].pendVal;
+			gBoard[id].pendMask = 0;
+		}
+	}
+	if (m > 0 && (cnt = daemonRelaysApply(ids, masks, vals, m)) != m)
+	{
+		printf("MQTT: fail to write the relays of %d board(s)\n", m - cnt);
+	}
+}
+
+/*
+ * statePublish:
+ *	Publish the topics of the boards whose sampled state changed
+ *********************************************************************************
+ */
+static void statePublish(void)
+{
+	MqttBoardType* b = NULL;
+	char topic[96];
+	char payload[8];
+	u8 relays = 0;
+	u8 inputs = 0;
+	u8 diff = 0;
+	int id = 0;
+	int ch = 0;
+
+	for (id = 0; id < BOARD_NR_MAX; id++)
+	{
+		b = &gBoard[id];
+		if (DAEMON_BOARD_OK != daemonBoardGet(id, &relays, &inputs)
+			|| (b->valid && b->relays == relays && b->inputs == inputs))
+		{
+			continue;
+		}
+		diff = b->valid ? (b->relays ^ relays) : 0x0f;
+		for (ch = 0; ch < RELAY_CH_NR_MAX; ch++)
+		{
+			if (diff & (1 << ch))
+			{
+				snprintf(topic, sizeof(topic), "%s/%s/relay/%d", gCfg.prefix, boardIdStr(id), ch + 1);
+				publish(topic, (relays & (1 << ch)) ? "1" : "0", 1);
+			}
+		}
+		if (diff)
+		{
+			snprintf(topic, sizeof(topic), "%s/%s/relays", gCfg.prefix, boardIdStr(id));
+			snprintf(payload, sizeof(payload), "%d", relays);
+			publish(topic, payload, 1);
+		}
+		diff = b->valid ? (b->inputs ^ inputs) : 0x0f;
+		for (ch = 0; ch < IN_CH_NR_MAX; ch++)
+		{
+			if (diff & (1 << ch))
+			{
+				snprintf(topic, sizeof(topic), "%s/%s/input/%d", gCfg.prefix, boardIdStr(id), ch + 1);
+				publish(topic, (inputs & (1 << ch)) ? "1" : "0", 1);
+			}
+		}
+		if (diff)
+		{
+			snprintf(topic, sizeof(topic), "%s/%s/inputs", gCfg.prefix, boardIdStr(id));
+			snprintf(payload, sizeof(payload), "%d", inputs);
+			publish(topic, payload, 1);
+		}
+		b->valid = 1;
+		b->relays = relays;
+		b->inputs = inputs;
+	}
+}
+
+int mqttStart(const ConfigMqttType* cfg)
+{
+	gCfg = *cfg;
+	if (OK != mqttResolve())
+	{
+		return ERROR;
+	}
+	gStarted = 1;
+	memset(gBoard, 0, sizeof(gBoard));
+	mqttConnect();
+	return OK;
+}
+
+/*
+ * mqttTick:
+ *	Called by the daemon after every sample: apply the commands, publish
+ *	the changes, keep the connection alive
+ *********************************************************************************
+ */
+void mqttTick(uint64_t nowMs)
+{
+	if (!gStarted)
+	{
+		return;
+	}
+	commandsApply(nowMs);
+	switch (gState)
+	{
+	case MQTT_IDLE:
+		if (nowMs >= gRetryMs)
+		{
+			mqttConnect();
+		}
+		return;
+	case MQTT_CONNECTING:
+	case MQTT_WAIT_ACK:
+		if (nowMs > gConnMs + MQTT_KEEPALIVE_S * 1000)
+		{
+			mqttClose();
+		}
+		return;
+	default:
+		break;
+	}
+	if (nowMs > gLastRxMs + MQTT_KEEPALIVE_S * 1500)
+	{
+		mqttClose(); // no PINGRESP
+		return;
+	}
+	if (nowMs >= gLastTxMs + MQTT_KEEPALIVE_S * 500)
+	{
+		packetPut(MQTT_PINGREQ, NULL, 0);
+	}
+	statePublish();
+	if (gTxFull)
+	{
+		mqttClose();
+		return;
+	}
+	mqttFlush();
+}
+
+void mqttStop(void)
+{
+	if (!gStarted)
+	{
+		return;
+	}
+	if (gState == MQTT_UP)
+	{
+		packetPut(MQTT_DISCONNECT, NULL, 0);
+		mqttFlush();
+	}
+	gState = MQTT_IDLE;
+	if (gFd >= 0)
+	{
+		evDel(gFd);
+		close(gFd);
+		gFd = -1;
+	}
+	gStarted = 0;
+}
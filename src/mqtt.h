@@ -0,0 +1,27 @@
+#ifndef MQTT_H_
+#define MQTT_H_
+
+#include <stdint.h>
+#include "config.h"
+
+#define MQTT_KEEPALIVE_S		30
+#define MQTT_RECONNECT_MS		2000
+#define MQTT_COALESCE_MS		50		// commands of one board within this window make one write
+#define MQTT_RX_MAX				4096
+#define MQTT_TX_MAX				16384	// a slower broker is disconnected, the state republished later
+
+// control packet types (high nibble of the first byte)
+#define MQTT_CONNECT		0x10
+#define MQTT_CONNACK		0x20
+#define MQTT_PUBLISH		0x30
+#define MQTT_SUBSCRIBE		0x82	// with the mandatory flags
+#define MQTT_SUBACK			0x90
+#define MQTT_PINGREQ		0xc0
+#define MQTT_PINGRESP		0xd0
+#define MQTT_DISCONNECT		0xe0
+
+int mqttStart(const ConfigMqttType* cfg);
+void mqttTick(uint64_t nowMs);
+void mqttStop(void);
+
+#endif //MQTT_H_
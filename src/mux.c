@@ -0,0 +1,240 @@
+/*
+ * mux.c:
+ *	Access to the buses configured behind a PCA9548 style I2C mux.
+ *	The channel selected on every mux is kept in a memory mapped file
+ *	shared by all processes and is only trusted while holding the adapter
+ *	lock (flock on a /run file, plus a mutex for the threads of a process),
+ *	so the control register is written only when the channel changes.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+
+#include "relay.h"
+#include "config.h"
+#include "mux.h"
+
+typedef struct
+{
+	uint8_t ctrl[I2C_BUS_NR_MAX][MUX_PER_BUS];	// last value written, 0xff = unknown
+	uint64_t selects[I2C_BUS_NR_MAX];		// control register writes
+	uint64_t hits[I2C_BUS_NR_MAX];			// accesses with the channel already selected
+} MuxFileType;
+
+static MuxFileType gLocal; // used if the shared file is not available
+static MuxFileType* gMux = NULL;
+static pthread_once_t gMuxOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t gMuxMutex[I2C_BUS_NR_MAX] =
+{
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER};
+static int gLockFd[I2C_BUS_NR_MAX] = {-1, -1, -1, -1, -1, -1, -1, -1};
+
+static void muxOpen(void)
+{
+	if (0 == mmDirCreate(RUN_DIR))
+	{
+		gMux = mmFileOpen(MUX_FILE, sizeof(MuxFileType), 1);
+	}
+	if (gMux == NULL)
+	{
+		gMux = &gLocal;
+	}
+}
+
+/*
+ * muxParentGet:
+ *	Adapter carrying <bus>: the mux parent or the bus itself
+ *********************************************************************************
+ */
+int muxParentGet(int bus)
+{
+	ConfigMuxType mux;
+
+	if (OK == configMuxGet(bus, &mux))
+	{
+		return mux.parent;
+	}
+	return bus;
+}
+
+/*
+ * muxRouteGet:
+ *	Adapter of <bus> and the mux address/channel to select on it (addr 0
+ *	for the adapter segment itself). ERROR if no mux is configured on the
+ *	adapter, the access then needs no mux handling.
+ *********************************************************************************
+ */
+static int muxRouteGet(int bus, ConfigMuxType* route)
+{
+	int i = 0;
+
+	if (OK == configMuxGet(bus, route))
+	{
+		return OK;
+	}
+	for (i = 0; i < I2C_BUS_NR_MAX; i++)
+	{
+		if (OK == configMuxGet(i, route) && route->parent == bus)
+		{
+			route->addr = 0;
+			route->channel = 0;
+			return OK;
+		}
+	}
+	return ERROR;
+}
+
+/*
+ * muxPresent:
+ *	1 if a mux is configured at MUX_ADDR_BASE + <i> on <adapter>
+ *********************************************************************************
+ */
+static int muxPresent(int adapter, int i)
+{
+	ConfigMuxType mux;
+	int bus = 0;
+
+	for (bus = 0; bus < I2C_BUS_NR_MAX; bus++)
+	{
+		if (OK == configMuxGet(bus, &mux) && mux.parent == adapter
+			&& mux.addr == MUX_ADDR_BASE + i)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * muxLock:
+ *	Take the adapter of <bus> for one access. Fill <addr>/<ctrl> (MUX_PER_BUS
+ *	entries) with the mux control writes needed before the access: close
+ *	the channels open on the other muxes of the adapter, then select the
+ *	channel of <bus>. Accesses to the adapter segment itself close all the
+ *	channels, so no board behind a mux answers in place of a missing one.
+ *	Return the number of writes (0 if the route is already set or there is
+ *	no mux on the adapter), -1 on error.
+ *	Every successful call must be followed by muxUnlock().
+ *********************************************************************************
+ */
+int muxLock(int bus, uint8_t* addr, uint8_t* ctrl)
+{
+	ConfigMuxType route;
+	char path[64];
+	uint8_t* cur = NULL;
+	int sel = -1;
+	int i = 0;
+	int n = 0;
+
+	if (OK != muxRouteGet(bus, &route))
+	{
+		return 0;
+	}
+	pthread_once(&gMuxOnce, muxOpen);
+	pthread_mutex_lock(&gMuxMutex[route.parent]);
+	if (gLockFd[route.parent] < 0)
+	{
+		snprintf(path, sizeof(path), MUX_LOCK_FILE, route.parent);
+		gLockFd[route.parent] = open(mmPath(path), O_RDWR | O_CREAT, 0644);
+	}
+	if (gLockFd[route.parent] < 0 || flock(gLockFd[route.parent], LOCK_EX) != 0)
+	{
+		pthread_mutex_unlock(&gMuxMutex[route.parent]);
+		return -1;
+	}
+	cur = gMux->ctrl[route.parent];
+	if (route.addr != 0)
+	{
+		sel = route.addr - MUX_ADDR_BASE;
+	}
+	for (i = 0; i < MUX_PER_BUS; i++)
+	{
+		if (i != sel && cur[i] != 0 && muxPresent(route.parent, i))
+		{
+			addr[n] = MUX_ADDR_BASE + i;
+			ctrl[n++] = 0;
+			cur[i] = 0; // forgotten if the write fails
+		}
+	}
+	if (sel >= 0 && cur[sel] != (1 << route.channel))
+	{
+		addr[n] = route.addr;
+		ctrl[n++] = 1 << route.channel;
+		cur[sel] = 1 << route.channel;
+	}
+	if (n == 0)
+	{
+		__atomic_fetch_add(&gMux->hits[route.parent], 1, __ATOMIC_RELAXED);
+	}
+	else
+	{
+		__atomic_fetch_add(&gMux->selects[route.parent], 1, __ATOMIC_RELAXED);
+	}
+	return n;
+}
+
+/*
+ * muxUnlock:
+ *	Release the adapter of <bus>, forget the selected channel if the access
+ *	failed (the mux may have been reset)
+ *********************************************************************************
+ */
+void muxUnlock(int bus, int ok)
+{
+	ConfigMuxType route;
+
+	if (OK != muxRouteGet(bus, &route))
+	{
+		return;
+	}
+	if (!ok)
+	{
+		// unknown state, the next access writes all the muxes again
+		memset(gMux->ctrl[route.parent], 0xff, MUX_PER_BUS);
+	}
+	flock(gLockFd[route.parent], LOCK_UN);
+	pthread_mutex_unlock(&gMuxMutex[route.parent]);
+}
+
+void muxMetricsPrint(FILE* out)
+{
+	int buses[I2C_BUS_NR_MAX];
+	int cnt = 0;
+	int i = 0;
+	int parent = 0;
+	int done = 0;
+
+	cnt = configBusesGet(buses);
+	for (i = 0; i < cnt; i++)
+	{
+		parent = muxParentGet(buses[i]);
+		if (parent == buses[i] || (done & (1 << parent)))
+		{
+			continue;
+		}
+		if (done == 0)
+		{
+			pthread_once(&gMuxOnce, muxOpen);
+			fprintf(out, "# HELP sm4relind_mux_selects_total Mux channel changes written\n");
+			fprintf(out, "# TYPE sm4relind_mux_selects_total counter\n");
+			fprintf(out, "# HELP sm4relind_mux_hits_total Accesses that found their channel selected\n");
+			fprintf(out, "# TYPE sm4relind_mux_hits_total counter\n");
+		}
+		done |= 1 << parent;
+		fprintf(out, "sm4relind_mux_selects_total{bus=\"%d\"} %llu\n", parent,
+			(unsigned long long)gMux->selects[parent]);
+		fprintf(out, "sm4relind_mux_hits_total{bus=\"%d\"} %llu\n", parent,
+			(unsigned long long)gMux->hits[parent]);
+	}
+}
@@ -0,0 +1,19 @@
+#ifndef MUX_H_
+#define MUX_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "mmfile.h"
+
+#define MUX_FILE		RUN_DIR "/mux"
+#define MUX_LOCK_FILE	RUN_DIR "/mux-%d.lock"	// one per adapter carrying muxes
+#define MUX_ADDR_BASE	0x70
+#define MUX_PER_BUS		8	// muxes at 0x70..0x77
+#define MUX_CH_NR_MAX	8
+
+int muxParentGet(int bus);
+int muxLock(int bus, uint8_t* addr, uint8_t* ctrl);
+void muxUnlock(int bus, int ok);
+void muxMetricsPrint(FILE* out);
+
+#endif //MUX_H_
@@ -0,0 +1,255 @@
+/*
+ * output.c:
+ *	--format json|bin results of the commands that read boards. A list of
+ *	boards is one JSON document ({"boards":[..]}) or a stream of fixed size
+ *	records (output.h), so a script parses one invocation for all boards.
+ *	The text output stays in the commands. While the format is not text
+ *	stdout is pointed at stderr, so the messages printed by the commands
+ *	never end up in the data, which goes to the saved stdout.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "relay.h"
+#include "output.h"
+
+static int gFormat = OUT_TEXT;
+static int gInList = 0;
+static int gListCnt = 0;
+static FILE* gOut = NULL;	// the real stdout while the format is not text
+
+/*
+ * outFormatParse:
+ *	Take "--format <text/json/bin>" out of the arguments. Return the new
+ *	argc or ERROR if the format is unknown
+ *********************************************************************************
+ */
+int outFormatParse(int argc, char* argv[])
+{
+	int i = 0;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcasecmp(argv[i], "--format") != 0)
+		{
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			return ERROR;
+		}
+		if (strcasecmp(argv[i + 1], "text") == 0)
+		{
+			outFormatSet(OUT_TEXT);
+		}
+		else if (strcasecmp(argv[i + 1], "json") == 0)
+		{
+			outFormatSet(OUT_JSON);
+		}
+		else if (strcasecmp(argv[i + 1], "bin") == 0)
+		{
+			outFormatSet(OUT_BIN);
+		}
+		else
+		{
+			return ERROR;
+		}
+		memmove(&argv[i], &argv[i + 2], (argc - i - 2) * sizeof(char*));
+		argc -= 2;
+		argv[argc] = NULL;
+		i--;
+	}
+	return argc;
+}
+
+int outFormatGet(void)
+{
+	return gFormat;
+}
+
+/*
+ * outFormatSet:
+ *	Change the format, leaving text moves stdout to stderr and the data
+ *	to a copy of stdout, back to text restores stdout
+ *********************************************************************************
+ */
+void outFormatSet(int format)
+{
+	int fd = -1;
+
+	if ( (format != OUT_TEXT) == (gOut != NULL))
+	{
+		gFormat = format;
+		return;
+	}
+	fflush(stdout);
+	if (format != OUT_TEXT)
+	{
+		if ( (fd = dup(STDOUT_FILENO)) < 0 || (gOut = fdopen(fd, "w")) == NULL
+			|| dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+		{
+			if (gOut != NULL)
+			{
+				fclose(gOut);
+				gOut = NULL;
+			}
+			else if (fd >= 0)
+			{
+				close(fd);
+			}
+		}
+	}
+	else
+	{
+		fflush(gOut);
+		dup2(fileno(gOut), STDOUT_FILENO);
+		fclose(gOut);
+		gOut = NULL;
+	}
+	gFormat = format;
+}
+
+static FILE* outStream(void)
+{
+	return (gOut != NULL) ? gOut : stdout;
+}
+
+static void le(uint8_t* buf, uint64_t val, int size)
+{
+	int i = 0;
+
+	for (i = 0; i < size; i++)
+	{
+		buf[i] = (uint8_t)(val >> (8 * i));
+	}
+}
+
+/*
+ * outBoardsBegin:
+ *	Start a list of boards, <timeMs> = common sample time or 0
+ *********************************************************************************
+ */
+void outBoardsBegin(uint64_t timeMs)
+{
+	gInList = 1;
+	gListCnt = 0;
+	if (gFormat != OUT_JSON)
+	{
+		return;
+	}
+	if (timeMs != 0)
+	{
+		fprintf(outStream(), "{\"time\":%llu,\"boards\":[", (unsigned long long)timeMs);
+	}
+	else
+	{
+		fprintf(outStream(), "{\"boards\":[");
+	}
+}
+
+/*
+ * outBoard:
+ *	One board, in a list or alone
+ *********************************************************************************
+ */
+void outBoard(const OutRecordType* rec)
+{
+	uint8_t buf[OUT_REC_SIZE];
+
+	if (gFormat == OUT_BIN)
+	{
+		memset(buf, 0, sizeof(buf));
+		buf[0] = BOARD_BUS(rec->id);
+		buf[1] = BOARD_STACK(rec->id);
+		buf[2] = rec->flags;
+		buf[3] = rec->channel;
+		buf[4] = rec->relays;
+		buf[5] = rec->inputs;
+		le(&buf[8], rec->timeMs, 8);
+		fwrite(buf, 1, sizeof(buf), outStream());
+		return;
+	}
+	if (gFormat != OUT_JSON)
+	{
+		return;
+	}
+	fprintf(outStream(), "%s{\"id\":\"%s\",\"bus\":%d,\"stack\":%d", gListCnt++ ? "," : "",
+		boardIdStr(rec->id), BOARD_BUS(rec->id), BOARD_STACK(rec->id));
+	if (!(rec->flags & OUT_F_OK))
+	{
+		fprintf(outStream(), ",\"offline\":true");
+	}
+	else if (rec->flags & OUT_F_CHANNEL)
+	{
+		fprintf(outStream(), ",\"channel\":%d", rec->channel);
+		if (rec->flags & OUT_F_RELAYS)
+		{
+			fprintf(outStream(), ",\"relay\":%d", rec->relays);
+		}
+		if (rec->flags & OUT_F_INPUTS)
+		{
+			fprintf(outStream(), ",\"input\":%d", rec->inputs);
+		}
+	}
+	else
+	{
+		if (rec->flags & OUT_F_RELAYS)
+		{
+			fprintf(outStream(), ",\"relays\":%d", rec->relays);
+		}
+		if (rec->flags & OUT_F_INPUTS)
+		{
+			fprintf(outStream(), ",\"inputs\":%d", rec->inputs);
+		}
+	}
+	if ( (rec->flags & OUT_F_TIME) && !gInList)
+	{
+		fprintf(outStream(), ",\"time\":%llu", (unsigned long long)rec->timeMs);
+	}
+	fprintf(outStream(), gInList ? "}" : "}\n");
+}
+
+void outBoardsEnd(void)
+{
+	gInList = 0;
+	if (gFormat == OUT_JSON)
+	{
+		fprintf(outStream(), "]}\n");
+	}
+}
+
+/*
+ * outBench:
+ *	Result of "bench", the times are the totals of <count> accesses
+ *********************************************************************************
+ */
+void outBench(int id, int gpio, int count, int failed, uint64_t readNs, uint64_t writeNs)
+{
+	uint8_t buf[OUT_BENCH_SIZE];
+
+	if (gFormat == OUT_BIN)
+	{
+		memset(buf, 0, sizeof(buf));
+		buf[0] = BOARD_BUS(id);
+		buf[1] = BOARD_STACK(id);
+		buf[2] = gpio ? 1 : 0;
+		le(&buf[4], count, 4);
+		le(&buf[8], failed, 4);
+		le(&buf[16], readNs, 8);
+		le(&buf[24], writeNs, 8);
+		fwrite(buf, 1, sizeof(buf), outStream());
+		return;
+	}
+	if (gFormat == OUT_JSON)
+	{
+		fprintf(outStream(), "{\"id\":\"%s\",\"backend\":\"%s\",\"count\":%d,\"failed\":%d,"
+			"\"readUs\":%.1f,\"writeUs\":%.1f}\n", boardIdStr(id), gpio ? "gpio" : "i2c",
+			count, failed, readNs / 1000.0 / count, writeNs / 1000.0 / count);
+	}
+}
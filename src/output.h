@@ -0,0 +1,48 @@
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include <stdint.h>
+
+// --format
+#define OUT_TEXT	0
+#define OUT_JSON	1
+#define OUT_BIN		2
+
+// OutRecordType flags
+#define OUT_F_OK		0x01	// the board answered
+#define OUT_F_RELAYS	0x02	// relays valid
+#define OUT_F_INPUTS	0x04	// inputs valid
+#define OUT_F_CHANNEL	0x08	// one channel read, relays/inputs = 0/1
+#define OUT_F_TIME		0x10	// timeMs valid
+
+/*
+ * --format bin board record, OUT_REC_SIZE bytes, little endian:
+ *	0 bus, 1 stack, 2 flags, 3 channel, 4 relays, 5 inputs, 6..7 reserved,
+ *	8..15 timeMs
+ * bench record, OUT_BENCH_SIZE bytes, little endian:
+ *	0 bus, 1 stack, 2 backend (0 i2c, 1 gpio), 3 reserved, 4..7 count,
+ *	8..11 failed, 12..15 reserved, 16..23 read ns (all accesses),
+ *	24..31 write ns (all accesses)
+ */
+#define OUT_REC_SIZE	16
+#define OUT_BENCH_SIZE	32
+
+typedef struct
+{
+	int id;
+	uint8_t flags;
+	uint8_t channel;
+	uint8_t relays;
+	uint8_t inputs;
+	uint64_t timeMs;
+} OutRecordType;
+
+int outFormatParse(int argc, char* argv[]);
+int outFormatGet(void);
+void outFormatSet(int format);
+void outBoardsBegin(uint64_t timeMs);
+void outBoard(const OutRecordType* rec);
+void outBoardsEnd(void);
+void outBench(int id, int gpio, int count, int failed, uint64_t readNs, uint64_t writeNs);
+
+#endif //OUTPUT_H_
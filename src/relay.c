@@ -8,21 +8,46 @@
  *	Author: Alexandru Burcea
  ***********************************************************************
  */
+#include <ctype.h>
+#include <errno.h>
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "relay.h"
 #include "comm.h"
 #include "thread.h"
+#include "mmfile.h"
+#include "history.h"
+#include "rollup.h"
+#include "wear.h"
+#include "journal.h"
+#include "shadow.h"
+#include "metrics.h"
+#include "daemon.h"
+#include "config.h"
+#include "worker.h"
+#include "mux.h"
+#include "adapter.h"
+#include "gpio.h"
+#include "output.h"
 
 #define VERSION_BASE	(int)1
 #define VERSION_MAJOR	(int)0
 #define VERSION_MINOR	(int)0
 
 #define UNUSED(X) (void)X      /* To avoid gcc/g++ warnings */
-#define CMD_ARRAY_SIZE	8
+#define CMD_ARRAY_SIZE	23
+#define REPL_LINE_MAX	256	// interactive shell line
+#define REPL_ARG_MAX	32
+#define REPL_HIST_MAX	100	// lines kept for "!<n>"
+
+#define INIT_FILE	RUN_DIR "/init"	// boards configured by init-all since boot
+#define BUS_BATCH_MAX	(3 * STACK_NR_MAX)	// registers per bus in one batch
 
 const u8 relayMaskRemap[RELAY_CH_NR_MAX] =
 {
@@ -51,11 +76,46 @@ const int inChRemap[IN_CH_NR_MAX] =
 	1,
 	0};
 
+// channel 1 is the most significant pin of each expander nibble
+static const u8 nibbleRemap[16] =
+{
+	0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15};
+
+// opto inputs (low nibble) decode, keyed on the polarity programmed in POLINV:
+// the inputs are active low unless the expander already inverts them
+static const u8 inDecode[2][16] =
+{
+	{15, 7, 11, 3, 13, 5, 9, 1, 14, 6, 10, 2, 12, 4, 8, 0},
+	{0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15}};
+
 int relayChSet(int dev, u8 channel, OutStateEnumType state);
 int relayChGet(int dev, u8 channel, OutStateEnumType* state);
 u8 relayToIO(u8 relay);
-u8 IOToRelay(u8 io);
-u8 IOToIn(u8 io);
+
+static int gBoardDev[BOARD_NR_MAX];
+static int gBoardPolInv[BOARD_NR_MAX];
+static int gBoardPolInvKnown[BOARD_NR_MAX];	// gBoardPolInv read from the board or init-all
+static int gBoardKeep = 0;	// interactive shell: the devices stay open between commands
+
+static int gReplActive = 0;
+static int gReplExit = 0;
+static jmp_buf gReplJmp;
+
+/*
+ * cliExit:
+ *	End of a command, in the interactive shell only the command ends
+ *********************************************************************************
+ */
+static void cliExit(int code) __attribute__((noreturn));
+static void cliExit(int code)
+{
+	if (gReplActive)
+	{
+		gReplExit = code;
+		longjmp(gReplJmp, 1);
+	}
+	exit(code);
+}
 
 static void doHelp(int argc, char *argv[]);
 const CliCmdType CMD_HELP =
@@ -96,11 +156,22 @@ const CliCmdType CMD_LIST =
 		"-list",
 		1,
 		&doList,
-		"\t-list:       List all 4relind boards connected,\n\treturn       nr of boards and stack level for every board\n",
+		"\t-list:       List all 4relind boards connected on the configured buses,\n\treturn       nr of boards and id for every board\n",
 		"\tUsage:       4relind -list\n",
 		"",
 		"\tExample:     4relind -list display: 1,0 \n"};
 
+static void doAll(int argc, char *argv[]);
+const CliCmdType CMD_ALL =
+{
+	"all",
+	1,
+	&doAll,
+	"\tall:         Read relays, inputs or both of every detected board with one\n\t\t     batched transfer per bus, one line per board or one JSON document\n",
+	"\tUsage:       4relind all <read/inread/status>\n",
+	"\tUsage:       4relind all <read/inread/status> --json\n",
+	"\tExample:     4relind all status --json; Display the state of all the boards\n"};
+
 static void doRelayWrite(int argc, char *argv[]);
 const CliCmdType CMD_WRITE =
 {
@@ -112,6 +183,17 @@ const CliCmdType CMD_WRITE =
 	"\tUsage:       4relind <id> write <value>\n",
 	"\tExample:     4relind 0 write 2 On; Set Relay #2 on Board #0 On\n"};
 
+static void doSet(int argc, char *argv[]);
+const CliCmdType CMD_SET =
+{
+	"set",
+	1,
+	&doSet,
+	"\tset:         Change relays of several boards with one batched write per bus,\n\t\t     <ch>=<on/off> changes one relay, =<value> all of them (0x.., 0b.. accepted)\n",
+	"\tUsage:       4relind set <id>:<ch>=<on/off>[,<ch>=<on/off>..] ..\n",
+	"\tUsage:       4relind set <id>:=<value> ..\n",
+	"\tExample:     4relind set 0:1=on,3=off 2:=0b1010 5:=15; Relay #1 on and #3 off on Board #0,\n\t\t     Board #2 and #5 relays set to 10 and 15\n"};
+
 static void doRelayRead(int argc, char *argv[]);
 const CliCmdType CMD_READ =
 {
@@ -135,6 +217,17 @@ const CliCmdType CMD_IN_READ =
 	"\tExample:     4relind 0 inread 2; Read Status of Input #2 on Board #0\n"};
 
 
+static void doStatus(int argc, char *argv[]);
+const CliCmdType CMD_STATUS =
+{
+	"status",
+	2,
+	&doStatus,
+	"\tstatus:      Read relays and inputs status with one bus access\n",
+	"\tUsage:       4relind <id> status\n",
+	"",
+	"\tExample:     4relind 0 status; Display relays, inputs and the sample time of Board #0\n"};
+
 static void doTest(int argc, char* argv[]);
 const CliCmdType CMD_TEST =
 {
@@ -146,6 +239,138 @@ const CliCmdType CMD_TEST =
 	"\tUsage:       4relind <id> test\n",
 	"\tExample:     4relind 0 test\n"};
 
+static void doDaemon(int argc, char* argv[]);
+const CliCmdType CMD_DAEMON =
+{
+	"-daemon",
+	1,
+	&doDaemon,
+	"\t-daemon:     Sample all boards and log every state change\n",
+	"\tUsage:       4relind -daemon\n",
+	"\tUsage:       4relind -daemon <period ms>\n",
+	"\tExample:     4relind -daemon 10; Sample all boards every 10ms and log the changes\n"};
+
+static void doHistory(int argc, char* argv[]);
+const CliCmdType CMD_HISTORY =
+{
+	"history",
+	2,
+	&doHistory,
+	"\thistory:     Display the logged state changes (relays, inputs) of one board\n\t\t     <time> = seconds since epoch, -<seconds> before now or \"now\"\n",
+	"\tUsage:       4relind <id> history\n",
+	"\tUsage:       4relind <id> history <from time> [<to time>]\n",
+	"\tExample:     4relind 4 history -43200; Display board #4 changes in the last 12 hours\n"};
+
+static void doStats(int argc, char* argv[]);
+const CliCmdType CMD_STATS =
+{
+	"stats",
+	1,
+	&doStats,
+	"\tstats:       Display relay on-time and input duty cycle of one channel\n\t\t     from the daemon summaries (default: last 24 hours)\n",
+	"\tUsage:       4relind stats <id> <channel>\n",
+	"\tUsage:       4relind stats <id> <channel> --since <time>\n",
+	"\tExample:     4relind stats 0 2 --since -3600; Relay/input #2 of board #0 in the last hour\n"};
+
+static void doWear(int argc, char* argv[]);
+const CliCmdType CMD_WEAR =
+{
+	"wear",
+	2,
+	&doWear,
+	"\twear:        Display relays switching cycles and on time, or reset the counters\n\t\t     of one relay after replacement\n",
+	"\tUsage:       4relind <id> wear\n",
+	"\tUsage:       4relind <id> wear reset <channel>\n",
+	"\tExample:     4relind 0 wear; Display the wear counters of Board #0 relays\n"};
+
+static void doWearLimit(int argc, char* argv[]);
+const CliCmdType CMD_WEAR_LIMIT =
+{
+	"-wearlimit",
+	1,
+	&doWearLimit,
+	"\t-wearlimit:  Set the relay switching cycles (and on hours) that raise a wear warning,\n\t\t     0 = no warning\n",
+	"\tUsage:       4relind -wearlimit\n",
+	"\tUsage:       4relind -wearlimit <cycles> [<on hours>]\n",
+	"\tExample:     4relind -wearlimit 100000; Warn after 100000 cycles of any relay\n"};
+
+static void doMetrics(int argc, char* argv[]);
+const CliCmdType CMD_METRICS =
+{
+	"-metrics",
+	1,
+	&doMetrics,
+	"\t-metrics:    Display the counters in Prometheus text format\n",
+	"\tUsage:       4relind -metrics\n",
+	"",
+	"\tExample:     4relind -metrics > /var/lib/node_exporter/4relind.prom\n"};
+
+static void doJournal(int argc, char* argv[]);
+const CliCmdType CMD_JOURNAL =
+{
+	"-journal",
+	1,
+	&doJournal,
+	"\t-journal:    Enable/disable the journal of the last relay state of every board\n",
+	"\tUsage:       4relind -journal <on/off>\n",
+	"\tUsage:       4relind -journal\n",
+	"\tExample:     4relind -journal on; Record every relay change for \"restore\"\n"};
+
+static void doRestore(int argc, char* argv[]);
+const CliCmdType CMD_RESTORE =
+{
+	"restore",
+	1,
+	&doRestore,
+	"\trestore:     Restore the journaled relay state of all boards in one bus transfer\n",
+	"\tUsage:       4relind restore\n",
+	"",
+	"\tExample:     4relind restore; Run at boot to bring the relays back to the last state\n"};
+
+static void doInitAll(int argc, char* argv[]);
+const CliCmdType CMD_INIT_ALL =
+{
+	"init-all",
+	1,
+	&doInitAll,
+	"\tinit-all:    Configure all boards in one bus pass and mark them as initialized,\n\t\t     later commands skip the configuration check (run once at boot).\n\t\t     --polinv makes the expander invert the opto inputs in hardware\n",
+	"\tUsage:       4relind init-all\n",
+	"\tUsage:       4relind init-all --polinv\n",
+	"\tExample:     4relind init-all; Configure every detected board\n"};
+
+static void doBuses(int argc, char* argv[]);
+const CliCmdType CMD_BUSES =
+{
+	"-buses",
+	1,
+	&doBuses,
+	"\t-buses:      Display the I2C adapters capabilities and the transfer method chosen\n\t\t     for the register reads and writes with its measured cost\n",
+	"\tUsage:       4relind -buses\n",
+	"\tUsage:       4relind -buses probe\n",
+	"\tExample:     4relind -buses probe; Measure the methods again on the first board of every adapter\n"};
+
+static void doBench(int argc, char* argv[]);
+const CliCmdType CMD_BENCH =
+{
+	"bench",
+	2,
+	&doBench,
+	"\tbench:       Time the port reads and writes (same relay state written back)\n\t\t     on the active backend, SM4RELIND_BACKEND=i2c|gpio selects it\n",
+	"\tUsage:       4relind <id> bench\n",
+	"\tUsage:       4relind <id> bench <count>\n",
+	"\tExample:     SM4RELIND_BACKEND=gpio 4relind 0 bench 1000; Time 1000 accesses of Board #0 through the gpiochip\n"};
+
+static void doRepl(int argc, char* argv[]);
+const CliCmdType CMD_REPL =
+{
+	"-i",
+	1,
+	&doRepl,
+	"\t-i:          Interactive shell, the board devices and the shadow state stay open\n\t\t     between commands and every command is timed. \"!!\" runs the last\n\t\t     command again, \"!<n>\" command <n> of \"-hist\", \"quit\" ends\n",
+	"\tUsage:       4relind -i\n",
+	"",
+	"\tExample:     4relind -i then \"0 write 2 on\"; Set Relay #2 on Board #0 On\n"};
+
 CliCmdType gCmdArray[CMD_ARRAY_SIZE];
 
 char *usage = "Usage:	 4relind -h <command>\n"
@@ -154,12 +379,28 @@ char *usage = "Usage:	 4relind -h <command>\n"
 	"         4relind -list\n"
 	"         4relind <id> write <channel> <on/off>\n"
 	"         4relind <id> write <value>\n"
+	"         4relind set <id>:<ch>=<on/off>[,..] | <id>:=<value> ..\n"
 	"         4relind <id> read <channel>\n"
 	"         4relind <id> read\n"
 	"         4relind <id> inread <channel>\n"
 	"         4relind <id> inread\n"
+	"         4relind <id> status\n"
+	"         4relind all <read/inread/status> [--json]\n"
 	"         4relind <id> test\n"
-	"Where: <id> = Board level id = 0..7\n"
+	"         4relind -daemon [<period ms>]\n"
+	"         4relind <id> history [<from> [<to>]]\n"
+	"         4relind stats <id> <channel> [--since <time>]\n"
+	"         4relind <id> wear [reset <channel>]\n"
+	"         4relind -wearlimit [<cycles> [<on hours>]]\n"
+	"         4relind -metrics\n"
+	"         4relind -journal [<on/off>]\n"
+	"         4relind restore\n"
+	"         4relind init-all [--polinv]\n"
+	"         4relind -buses [probe]\n"
+	"         4relind <id> bench [<count>]\n"
+	"         4relind -i\n"
+	"Options: --format <text/json/bin> for -list, read, inread, status, all and bench\n"
+	"Where: <id> = Board level id = 0..7, or <bus>.<0..7> for the boards on /dev/i2c-<bus>\n"
 	"Type 4relind -h <command> for more help"; // No trailing newline needed here.
 
 char *warranty =
@@ -179,55 +420,160 @@ char *warranty =
 		"		along with this program. If not, see <http://www.gnu.org/licenses/>.";
 u8 relayToIO(u8 relay)
 {
-	u8 i;
-	u8 val = 0;
-	for (i = 0; i < RELAY_CH_NR_MAX; i++)
-	{
-		if ( (relay & (1 << i)) != 0)
-			val += relayMaskRemap[i];
-	}
-	return val;
+	return nibbleRemap[relay & 0x0f] << 4;
 }
 
 u8 IOToRelay(u8 io)
 {
-	u8 i;
-	u8 val = 0;
-	for (i = 0; i < RELAY_CH_NR_MAX; i++)
+	return nibbleRemap[io >> 4];
+}
+
+u8 IOToIn(u8 io, int polInv)
+{
+	return inDecode[polInv ? 1 : 0][io & 0x0f];
+}
+
+static int devId(int dev)
+{
+	int i = 0;
+
+	for (i = 0; i < BOARD_NR_MAX; i++)
 	{
-		if ( (io & relayMaskRemap[i]) != 0)
+		if (gBoardDev[i] == dev)
 		{
-			val += 1 << i;
+			return i;
 		}
 	}
-	return val;
+	return -1;
+}
+
+/*
+ * boardAddrGet:
+ *	I2C address of the board at stack level <stack>
+ *********************************************************************************
+ */
+int boardAddrGet(int stack)
+{
+	u8 st = (stack & 0x02) + (0x01 & (stack >> 2)) + (0x04 & (stack << 2));
+
+	return (st + RELAY8_HW_I2C_BASE_ADD) ^ 0x07;
 }
 
-u8 IOToIn(u8 io)
+/*
+ * boardIdParse:
+ *	Board id from the command line: <stack> on the default bus or
+ *	<bus>.<stack>. Return ERROR if invalid
+ *********************************************************************************
+ */
+int boardIdParse(const char* arg)
 {
-	u8 i;
-	u8 val = 0;
-	for (i = 0; i < IN_CH_NR_MAX; i++)
+	int bus = I2C_BUS_DEFAULT;
+	int stack = 0;
+	char* end = NULL;
+
+	if (arg == NULL)
 	{
-		if ( (io & inMaskRemap[i]) == 0)
-		{
-			val += 1 << i;
-		}
+		return ERROR;
 	}
-	return val;
+	stack = (int)strtol(arg, &end, 10);
+	if (end != arg && *end == '.')
+	{
+		bus = stack;
+		arg = end + 1;
+		stack = (int)strtol(arg, &end, 10);
+	}
+	if (end == arg || *end != 0 || bus < 0 || bus >= I2C_BUS_NR_MAX || stack < 0
+		|| stack >= STACK_NR_MAX)
+	{
+		return ERROR;
+	}
+	return BOARD_ID(bus, stack);
 }
 
-int relayChSet(int dev, u8 channel, OutStateEnumType state)
+/*
+ * boardIdStr:
+ *	Board id as the user types it, valid until the 4th next call
+ *********************************************************************************
+ */
+const char* boardIdStr(int id)
+{
+	static char str[4][16];
+	static int n = 0;
+	char* p = str[n++ % 4];
+
+	if (BOARD_BUS(id) == I2C_BUS_DEFAULT)
+	{
+		snprintf(p, sizeof(str[0]), "%d", BOARD_STACK(id));
+	}
+	else
+	{
+		snprintf(p, sizeof(str[0]), "%d.%d", BOARD_BUS(id), BOARD_STACK(id));
+	}
+	return p;
+}
+
+/*
+ * portRead:
+ *	Read the input port (relays and inputs), refresh the output shadow
+ *********************************************************************************
+ */
+static int portRead(int dev, u8* io)
+{
+	if (FAIL == i2cMem8Read(dev, RELAY8_INPORT_REG_ADD, io, 1))
+	{
+		return FAIL;
+	}
+	shadowSet(devId(dev), *io & 0xf0, timeMsGet());
+	return OK;
+}
+
+/*
+ * portWrite:
+ *	Write the relays (high nibble of <io>) unless the shadow says they
+ *	already have this value. After a successful write update the shadow,
+ *	the wear counters and the state journal.
+ *********************************************************************************
+ */
+static int portWrite(int dev, u8 io)
 {
-	int resp;
+	int id = devId(dev);
+	uint64_t now = timeMsGet();
+	u8 cur = 0;
 	u8 buff[2];
 
+	io &= 0xf0; // the input pins are not driven
+	if (OK == shadowGet(id, &cur, now) && cur == io)
+	{
+		shadowExpect(id, io, now); // supersede an older pending write
+		metricInc(METRIC_WRITES_SUPPRESSED, id);
+		return OK;
+	}
+	buff[0] = io;
+	if (OK != i2cMem8Write(dev, RELAY8_OUTPORT_REG_ADD, buff, 1))
+	{
+		return FAIL;
+	}
+	shadowWritten(id, io, timeMsGet()); // after the write, see shadowVerify()
+	metricInc(METRIC_WRITES, id);
+	if (id >= 0)
+	{
+		wearRecord(id, IOToRelay(io), now);
+		journalRecord(id, IOToRelay(io), now);
+	}
+	return OK;
+}
+
+int relayChSet(int dev, u8 channel, OutStateEnumType state)
+{
+	u8 io = 0;
+
 	if ( (channel < CHANNEL_NR_MIN) || (channel > RELAY_CH_NR_MAX))
 	{
 		printf("Invalid relay nr!\n");
 		return ERROR;
 	}
-	if (FAIL == i2cMem8Read(dev, RELAY8_INPORT_REG_ADD, buff, 1))
+	if (OK != shadowGet(devId(dev), &io, timeMsGet())
+		&& FAIL == portRead(dev, &io))
 	{
 		return FAIL;
 	}
@@ -235,19 +581,17 @@ int relayChSet(int dev, u8 channel, OutStateEnumType state)
 	switch (state)
 	{
 	case OFF:
-		buff[0] &= ~ (1 << relayChRemap[channel - 1]);
-		resp = i2cMem8Write(dev, RELAY8_OUTPORT_REG_ADD, buff, 1);
+		io &= ~ (1 << relayChRemap[channel - 1]);
 		break;
 	case ON:
-		buff[0] |= 1 << relayChRemap[channel - 1];
-		resp = i2cMem8Write(dev, RELAY8_OUTPORT_REG_ADD, buff, 1);
+		io |= 1 << relayChRemap[channel - 1];
 		break;
 	default:
 		printf("Invalid relay state!\n");
 		return ERROR;
 		break;
 	}
-	return resp;
+	return portWrite(dev, io);
 }
 
 int relayChGet(int dev, u8 channel, OutStateEnumType* state)
@@ -265,7 +609,7 @@ int relayChGet(int dev, u8 channel, OutStateEnumType* state)
 		return ERROR;
 	}
 
-	if (FAIL == i2cMem8Read(dev, RELAY8_INPORT_REG_ADD, buff, 1))
+	if (FAIL == portRead(dev, buff))
 	{
 		return ERROR;
 	}
@@ -283,11 +627,7 @@ int relayChGet(int dev, u8 channel, OutStateEnumType* state)
 
 int relaySet(int dev, int val)
 {
-	u8 buff[2];
-
-	buff[0] = relayToIO(0xff & val);
-
-	return i2cMem8Write(dev, RELAY8_OUTPORT_REG_ADD, buff, 1);
+	return portWrite(dev, relayToIO(0xff & val));
 }
 
 int relayGet(int dev, int* val)
@@ -298,7 +638,7 @@ int relayGet(int dev, int* val)
 	{
 		return ERROR;
 	}
-	if (FAIL == i2cMem8Read(dev, RELAY8_INPORT_REG_ADD, buff, 1))
+	if (FAIL == portRead(dev, buff))
 	{
 		return ERROR;
 	}
@@ -321,12 +661,12 @@ int inChGet(int dev, u8 channel, OutStateEnumType* state)
 		return ERROR;
 	}
 
-	if (FAIL == i2cMem8Read(dev, RELAY8_INPORT_REG_ADD, buff, 1))
+	if (FAIL == portRead(dev, buff))
 	{
 		return ERROR;
 	}
 
-	if ((buff[0] & (inMaskRemap[channel - 1])) == 0)
+	if (IOToIn(buff[0], boardPolInvGet(devId(dev))) & (1 << (channel - 1)))
 	{
 		*state = ON;
 	}
@@ -345,185 +685,557 @@ int inGet(int dev, int* val)
 	{
 		return ERROR;
 	}
-	if (FAIL == i2cMem8Read(dev, RELAY8_INPORT_REG_ADD, buff, 1))
+	if (FAIL == portRead(dev, buff))
 	{
 		return ERROR;
 	}
-	*val = IOToIn(buff[0]);
+	*val = IOToIn(buff[0], boardPolInvGet(devId(dev)));
 	return OK;
 }
 
-
-int doBoardInit(int stack)
+/*
+ * boardSnapshot:
+ *	Relays and inputs decoded from a single input port read
+ *********************************************************************************
+ */
+int boardSnapshot(int dev, BoardSnapshotType* snap)
 {
-	int dev = 0;
-	int add = 0;
-	uint8_t buff[8];
-	uint8_t st = 0;
+	u8 buff[2];
 
-	if ( (stack < 0) || (stack > 7))
+	if (NULL == snap)
 	{
-		printf("Invalid stack level [0..7]!");
 		return ERROR;
 	}
-	st = (stack & 0x02) + (0x01 & (stack >> 2)) + (0x04 & (stack << 2));
-	add = (st + RELAY8_HW_I2C_BASE_ADD) ^ 0x07;
-	dev = i2cSetup(add);
-	if (dev == -1)
+	snap->ok = 0;
+	if (FAIL == portRead(dev, buff))
 	{
 		return ERROR;
 	}
-	if (ERROR == i2cMem8Read(dev, RELAY8_CFG_REG_ADD, buff, 1))
+	snap->timeMs = timeMsGet();
+	snap->relays = IOToRelay(buff[0]);
+	snap->inputs = IOToIn(buff[0], boardPolInvGet(devId(dev)));
+	snap->ok = 1;
+	return OK;
+}
+
+
+/*
+ * initStateGet:
+ *	Boards of <bus> configured by "init-all" since boot (stack level mask)
+ *	and the input polarity programmed on them. The first line of the file
+ *	is the default bus (the only one the Python and Node-RED code reads),
+ *	then one "i2c-<bus> <mask> <polinv>" line for every other bus.
+ *********************************************************************************
+ */
+static int initStateGet(int bus, int* polInv)
+{
+	FILE* file = NULL;
+	char line[64];
+	unsigned int mask = 0;
+	unsigned int pol = 0;
+	int lineBus = 0;
+	int found = 0;
+
+	*polInv = 0;
+	file = fopen(mmPath(INIT_FILE), "r");
+	if (file == NULL)
 	{
-		printf("4-RELAY_PLUS card id %d not detected\n", stack);
-		return ERROR;
+		return 0;
 	}
-	if (buff[0] != 0x0f) //non initialized I/O Expander
+	if (bus == I2C_BUS_DEFAULT)
 	{
-		// make 4 I/O pins input and 4 output 
-		buff[0] = 0x0f;
-		if (0 > i2cMem8Write(dev, RELAY8_CFG_REG_ADD, buff, 1))
-		{
-			return ERROR;
-		}
-		// put all pins in 0-logic state
-		buff[0] = 0;
-		if (0 > i2cMem8Write(dev, RELAY8_OUTPORT_REG_ADD, buff, 1))
-		{
-			return ERROR;
-		}
+		found = (fscanf(file, "%x %x", &mask, &pol) >= 1);
+	}
+	while (!found && fgets(line, sizeof(line), file) != NULL)
+	{
+		found = (sscanf(line, "i2c-%d %x %x", &lineBus, &mask, &pol) >= 2)
+			&& (lineBus == bus);
+	}
+	fclose(file);
+	if (!found)
+	{
+		return 0;
 	}
+	*polInv = (pol != 0);
+	return (int)mask;
+}
 
-	return dev;
+/*
+ * boardPolInvGet:
+ *	1 if the board inputs are inverted by the expander (POLINV)
+ *********************************************************************************
+ */
+int boardPolInvGet(int id)
+{
+	if ( (id < 0) || (id >= BOARD_NR_MAX))
+	{
+		return 0;
+	}
+	return gBoardPolInv[id];
 }
 
-int boardCheck(int hwAdd)
+typedef struct
 {
-	int dev = 0;
-	uint8_t buff[8];
+	int bus;
+	int write;
+	int n;
+	int idx[BUS_BATCH_MAX];
+	I2cRegType regs[BUS_BATCH_MAX];
+} BusBatchType;
+
+static void busBatchJob(void* arg)
+{
+	BusBatchType* batch = (BusBatchType*)arg;
+	int fd = 0;
+	int i = 0;
 
-	hwAdd ^= 0x07;
-	dev = i2cSetup(hwAdd);
-	if (dev == -1)
+	fd = i2cBusOpen(batch->bus);
+	if (fd < 0)
 	{
-		return FAIL;
+		for (i = 0; i < batch->n; i++)
+		{
+			batch->regs[i].ok = 0;
+		}
+		return;
 	}
-	if (ERROR == i2cMem8Read(dev, RELAY8_CFG_REG_ADD, buff, 1))
+	if (batch->write)
 	{
-		return ERROR;
+		i2cBatchWrite(fd, batch->regs, batch->n);
 	}
-	return OK;
+	else
+	{
+		i2cBatchRead(fd, batch->regs, batch->n);
+	}
+	close(fd);
 }
 
 /*
- * doRelayWrite:
- *	Write coresponding relay channel
- **************************************************************************************
+ * boardBatch:
+ *	Read or write one register (<regs>[i].reg) on each board <ids>[i], with
+ *	one batched transfer per bus, the buses in parallel on their workers.
+ *	The entries of a bus keep their order. Return the number of successful
+ *	entries, every entry gets its own ok flag.
+ *********************************************************************************
  */
-static void doRelayWrite(int argc, char *argv[])
+static int boardBatch(const int* ids, I2cRegType* regs, int n, int write)
 {
-	int pin = 0;
-	OutStateEnumType state = STATE_COUNT;
-	int val = 0;
-	int dev = 0;
-	OutStateEnumType stateR = STATE_COUNT;
-	int valR = 0;
-	int retry = 0;
+	BusBatchType batch[I2C_BUS_NR_MAX];
+	BusBatchType* b = NULL;
+	int bus = 0;
+	int cnt = 0;
+	int i = 0;
 
-	if ( (argc != 5) && (argc != 4))
+	for (bus = 0; bus < I2C_BUS_NR_MAX; bus++)
 	{
-		printf("Usage: 4relind <id> write <relay number> <on/off> \n");
-		printf("Usage: 4relind <id> write <relay reg value> \n");
-		exit(1);
+		batch[bus].bus = bus;
+		batch[bus].write = write;
+		batch[bus].n = 0;
 	}
-
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	for (i = 0; i < n; i++)
 	{
-		exit(1);
+		b = &batch[BOARD_BUS(ids[i])];
+		regs[i].ok = 0;
+		regs[i].addr = boardAddrGet(BOARD_STACK(ids[i]));
+		if (b->n < BUS_BATCH_MAX)
+		{
+			b->regs[b->n] = regs[i];
+			b->idx[b->n++] = i;
+		}
 	}
-	if (argc == 5)
+	for (bus = 0; bus < I2C_BUS_NR_MAX; bus++)
 	{
-		pin = atoi(argv[3]);
-		if ( (pin < CHANNEL_NR_MIN) || (pin > RELAY_CH_NR_MAX))
+		if (batch[bus].n > 0)
 		{
-			printf("Relay number value out of range\n");
-			exit(1);
+			workerSubmit(bus, busBatchJob, &batch[bus]);
 		}
-
-		/**/if ( (strcasecmp(argv[4], "up") == 0)
-			|| (strcasecmp(argv[4], "on") == 0))
-			state = ON;
-		else if ( (strcasecmp(argv[4], "down") == 0)
-			|| (strcasecmp(argv[4], "off") == 0))
-			state = OFF;
-		else
+	}
+	workerWait();
+	for (bus = 0; bus < I2C_BUS_NR_MAX; bus++)
+	{
+		for (i = 0; i < batch[bus].n; i++)
 		{
-			if ( (atoi(argv[4]) >= STATE_COUNT) || (atoi(argv[4]) < 0))
-			{
-				printf("Invalid relay state!\n");
-				exit(1);
-			}
-			state = (OutStateEnumType)atoi(argv[4]);
+			regs[batch[bus].idx[i]] = batch[bus].regs[i];
+			cnt += batch[bus].regs[i].ok;
 		}
+	}
+	return cnt;
+}
 
-		retry = RETRY_TIMES;
+/*
+ * boardSnapshotAll:
+ *	Snapshot of <n> boards with one batched transfer per bus. The boards are
+ *	not configured here, a board missing or failing gets ok = 0.
+ *	Return the number of boards read
+ *********************************************************************************
+ */
+int boardSnapshotAll(const int* ids, BoardSnapshotType* snaps, int n)
+{
+	I2cRegType regs[2 * BOARD_NR_MAX];
+	int regIds[2 * BOARD_NR_MAX];
+	int polIdx[BOARD_NR_MAX];
+	int inIdx[BOARD_NR_MAX];
+	int polInv = 0;
+	int init = 0;
+	int cnt = 0;
+	int m = 0;
+	int i = 0;
+	int id = 0;
+	uint64_t now = 0;
 
-		while ( (retry > 0) && (stateR != state))
+	if (NULL == ids || NULL == snaps || n <= 0 || n > BOARD_NR_MAX)
+	{
+		return ERROR;
+	}
+	for (i = 0; i < n; i++)
+	{
+		id = ids[i];
+		if ( (id < 0) || (id >= BOARD_NR_MAX))
 		{
-			if (OK != relayChSet(dev, pin, state))
-			{
-				printf("Fail to write relay\n");
-				exit(1);
-			}
-			if (OK != relayChGet(dev, pin, &stateR))
-			{
-				printf("Fail to read relay\n");
-				exit(1);
-			}
-			retry--;
+			return ERROR;
 		}
-#ifdef DEBUG_I
-		if(retry < RETRY_TIMES)
+		regs[m].reg = RELAY8_INPORT_REG_ADD;
+		regIds[m] = id;
+		inIdx[i] = m++;
+		polIdx[i] = -1;
+		init = initStateGet(BOARD_BUS(id), &polInv) & (1 << BOARD_STACK(id));
+		if (init)
 		{
-			printf("retry %d times\n", 3-retry);
+			gBoardPolInv[id] = polInv;
+			gBoardPolInvKnown[id] = 1;
 		}
-#endif
-		if (retry == 0)
+		else if (!gBoardPolInvKnown[id]) // POLINV may keep an earlier --polinv, read it once
 		{
-			printf("Fail to write relay\n");
-			exit(1);
+			regs[m].reg = RELAY8_POLINV_REG_ADD;
+			regIds[m] = id;
+			polIdx[i] = m++;
 		}
 	}
-	else
+	boardBatch(regIds, regs, m, 0);
+	now = timeMsGet();
+	for (i = 0; i < n; i++)
 	{
-		val = atoi(argv[3]);
-		if (val < 0 || val > 255)
+		if (polIdx[i] >= 0 && regs[polIdx[i]].ok)
 		{
-			printf("Invalid relay value\n");
-			exit(1);
+			gBoardPolInv[ids[i]] = (regs[polIdx[i]].val != 0);
+			gBoardPolInvKnown[ids[i]] = 1;
 		}
+		snaps[i].ok = regs[inIdx[i]].ok && (polIdx[i] < 0 || regs[polIdx[i]].ok);
+		snaps[i].timeMs = now;
+		snaps[i].relays = IOToRelay(regs[inIdx[i]].val);
+		snaps[i].inputs = IOToIn(regs[inIdx[i]].val, gBoardPolInv[ids[i]]);
+		cnt += snaps[i].ok;
+	}
+	return cnt;
+}
 
-		retry = RETRY_TIMES;
-		valR = -1;
-		while ( (retry > 0) && (valR != val))
-		{
-
-			if (OK != relaySet(dev, val))
+/*
+ * boardRelaysWrite:
+ *	Write the relays of <n> boards (<ok>[i] = 1 if done) with one batched
+ *	transfer per bus. A board whose shadow already holds the value is not
+ *	written. Shadow, wear counters and journal are updated as for a single
+ *	write. Return the number of boards done.
+ *********************************************************************************
+ */
+int boardRelaysWrite(const int* ids, const u8* relays, int* ok, int n)
+{
+	I2cRegType regs[BOARD_NR_MAX];
+	int wrIds[BOARD_NR_MAX];
+	int idx[BOARD_NR_MAX];
+	int m = 0;
+	int cnt = 0;
+	int i = 0;
+	u8 cur = 0;
+	uint64_t now = timeMsGet();
+
+	if (NULL == ids || NULL == relays || NULL == ok || n <= 0 || n > BOARD_NR_MAX)
+	{
+		return ERROR;
+	}
+	for (i = 0; i < n; i++)
+	{
+		ok[i] = 0;
+		if ( (ids[i] < 0) || (ids[i] >= BOARD_NR_MAX))
+		{
+			continue;
+		}
+		if (OK == shadowGet(ids[i], &cur, now) && cur == relayToIO(relays[i]))
+		{
+			shadowExpect(ids[i], cur, now);
+			metricInc(METRIC_WRITES_SUPPRESSED, ids[i]);
+			ok[i] = 1;
+			cnt++;
+			continue;
+		}
+		wrIds[m] = ids[i];
+		regs[m].reg = RELAY8_OUTPORT_REG_ADD;
+		regs[m].val = relayToIO(relays[i]);
+		idx[m++] = i;
+	}
+	if (m == 0)
+	{
+		return cnt;
+	}
+	boardBatch(wrIds, regs, m, 1);
+	now = timeMsGet();
+	for (i = 0; i < m; i++)
+	{
+		if (!regs[i].ok)
+		{
+			continue;
+		}
+		shadowWritten(wrIds[i], regs[i].val, now);
+		metricInc(METRIC_WRITES, wrIds[i]);
+		wearRecord(wrIds[i], relays[idx[i]], now);
+		journalRecord(wrIds[i], relays[idx[i]], now);
+		ok[idx[i]] = 1;
+		cnt++;
+	}
+	return cnt;
+}
+
+int doBoardInit(int id)
+{
+	int dev = 0;
+	int polInv = 0;
+	int stack = BOARD_STACK(id);
+	uint8_t buff[8];
+
+	if ( (id < 0) || (id >= BOARD_NR_MAX))
+	{
+		printf("Invalid board id [<bus>.]<0..7>!\n");
+		return ERROR;
+	}
+	if (gBoardKeep && gBoardDev[id] > 0) // opened and configured by a previous command
+	{
+		// one read tells a board still configured from one gone or power cycled
+		if (OK == i2cMem8Read(gBoardDev[id], RELAY8_CFG_REG_ADD, buff, 1)
+			&& buff[0] == RELAY8_CFG_VAL)
+		{
+			return gBoardDev[id];
+		}
+		close(gBoardDev[id]);
+		gBoardDev[id] = 0;
+		gBoardPolInvKnown[id] = 0;
+	}
+	dev = i2cSetup(BOARD_BUS(id), boardAddrGet(stack));
+	if (dev == -1)
+	{
+		return ERROR;
+	}
+	if (ERROR == i2cMem8Read(dev, RELAY8_CFG_REG_ADD, buff, 1))
+	{
+		printf("4-RELAY_PLUS card id %s not detected\n", boardIdStr(id));
+		close(dev);
+		return ERROR;
+	}
+	// configured at boot and not power cycled since: the rest of the check is skipped
+	if (buff[0] == RELAY8_CFG_VAL && (initStateGet(BOARD_BUS(id), &polInv) & (1 << stack)))
+	{
+		gBoardDev[id] = dev;
+		gBoardPolInv[id] = polInv;
+		gBoardPolInvKnown[id] = 1;
+		return dev;
+	}
+	if (buff[0] != RELAY8_CFG_VAL) //non initialized I/O Expander
+	{
+		// make 4 I/O pins input and 4 output 
+		buff[0] = RELAY8_CFG_VAL;
+		if (0 > i2cMem8Write(dev, RELAY8_CFG_REG_ADD, buff, 1))
+		{
+			close(dev);
+			return ERROR;
+		}
+		// put all pins in 0-logic state
+		buff[0] = 0;
+		if (0 > i2cMem8Write(dev, RELAY8_OUTPORT_REG_ADD, buff, 1))
+		{
+			close(dev);
+			return ERROR;
+		}
+		shadowSet(id, 0, timeMsGet());
+	}
+	// not configured by init-all: POLINV keeps an earlier --polinv while the board is powered
+	if (ERROR == i2cMem8Read(dev, RELAY8_POLINV_REG_ADD, buff, 1))
+	{
+		close(dev);
+		return ERROR;
+	}
+	gBoardDev[id] = dev;
+	gBoardPolInv[id] = (buff[0] != 0);
+	gBoardPolInvKnown[id] = 1;
+
+	return dev;
+}
+
+/*
+ * boardClose:
+ *	Release a device returned by doBoardInit()
+ *********************************************************************************
+ */
+void boardClose(int dev)
+{
+	int id = devId(dev);
+
+	if (gBoardKeep)
+	{
+		return;
+	}
+	if (id >= 0)
+	{
+		gBoardDev[id] = 0;
+	}
+	close(dev);
+}
+
+int boardCheck(int bus, int hwAdd)
+{
+	int dev = 0;
+	int ret = OK;
+	uint8_t buff[8];
+
+	hwAdd ^= 0x07;
+	dev = i2cSetup(bus, hwAdd);
+	if (dev == -1)
+	{
+		return FAIL;
+	}
+	if (ERROR == i2cMem8Read(dev, RELAY8_CFG_REG_ADD, buff, 1))
+	{
+		ret = ERROR;
+	}
+	close(dev);
+	return ret;
+}
+
+/*
+ * doRelayWrite:
+ *	Write coresponding relay channel
+ **************************************************************************************
+ */
+static void doRelayWrite(int argc, char *argv[])
+{
+	int pin = 0;
+	OutStateEnumType state = STATE_COUNT;
+	int val = 0;
+	int dev = 0;
+	OutStateEnumType stateR = STATE_COUNT;
+	int valR = 0;
+	int retry = 0;
+
+	if ( (argc != 5) && (argc != 4))
+	{
+		printf("Usage: 4relind <id> write <relay number> <on/off> \n");
+		printf("Usage: 4relind <id> write <relay reg value> \n");
+		cliExit(1);
+	}
+
+	dev = doBoardInit(boardIdParse(argv[1]));
+	if (dev <= 0)
+	{
+		cliExit(1);
+	}
+	if (argc == 5)
+	{
+		pin = atoi(argv[3]);
+		if ( (pin < CHANNEL_NR_MIN) || (pin > RELAY_CH_NR_MAX))
+		{
+			printf("Relay number value out of range\n");
+			cliExit(1);
+		}
+
+		/**/if ( (strcasecmp(argv[4], "up") == 0)
+			|| (strcasecmp(argv[4], "on") == 0))
+			state = ON;
+		else if ( (strcasecmp(argv[4], "down") == 0)
+			|| (strcasecmp(argv[4], "off") == 0))
+			state = OFF;
+		else
+		{
+			if ( (atoi(argv[4]) >= STATE_COUNT) || (atoi(argv[4]) < 0))
+			{
+				printf("Invalid relay state!\n");
+				cliExit(1);
+			}
+			state = (OutStateEnumType)atoi(argv[4]);
+		}
+
+		if (daemonIsRunning()) // the daemon verifies the write on its next sample
+		{
+			if (OK != relayChSet(dev, pin, state))
+			{
+				printf("Fail to write relay\n");
+				cliExit(1);
+			}
+			return;
+		}
+		retry = RETRY_TIMES;
+
+		while ( (retry > 0) && (stateR != state))
+		{
+			if (OK != relayChSet(dev, pin, state))
+			{
+				printf("Fail to write relay\n");
+				cliExit(1);
+			}
+			if (OK != relayChGet(dev, pin, &stateR))
+			{
+				printf("Fail to read relay\n");
+				cliExit(1);
+			}
+			retry--;
+		}
+#ifdef DEBUG_I
+		if(retry < RETRY_TIMES)
+		{
+			printf("retry %d times\n", 3-retry);
+		}
+#endif
+		if (stateR != state)
+		{
+			printf("Fail to write relay\n");
+			cliExit(1);
+		}
+	}
+	else
+	{
+		val = atoi(argv[3]);
+		if (val < 0 || val > 255)
+		{
+			printf("Invalid relay value\n");
+			cliExit(1);
+		}
+
+		if (daemonIsRunning()) // the daemon verifies the write on its next sample
+		{
+			if (OK != relaySet(dev, val))
 			{
 				printf("Fail to write relay!\n");
-				exit(1);
+				cliExit(1);
+			}
+			return;
+		}
+		val &= (1 << RELAY_CH_NR_MAX) - 1;
+		retry = RETRY_TIMES;
+		valR = -1;
+		while ( (retry > 0) && (valR != val))
+		{
+
+			if (OK != relaySet(dev, val))
+			{
+				printf("Fail to write relay!\n");
+				cliExit(1);
 			}
 			if (OK != relayGet(dev, &valR))
 			{
 				printf("Fail to read relay!\n");
-				exit(1);
+				cliExit(1);
 			}
+			retry--;
 		}
-		if (retry == 0)
+		if (valR != val)
 		{
 			printf("Fail to write relay!\n");
-			exit(1);
+			cliExit(1);
 		}
 	}
 }
@@ -538,12 +1250,16 @@ static void doRelayRead(int argc, char *argv[])
 	int pin = 0;
 	int val = 0;
 	int dev = 0;
+	int id = 0;
 	OutStateEnumType state = STATE_COUNT;
+	OutRecordType rec;
 
-	dev = doBoardInit(atoi(argv[1]));
+	memset(&rec, 0, sizeof(rec));
+	id = boardIdParse(argv[1]);
+	dev = doBoardInit(id);
 	if (dev <= 0)
 	{
-		exit(1);
+		cliExit(1);
 	}
 
 	if (argc == 4)
@@ -552,15 +1268,23 @@ static void doRelayRead(int argc, char *argv[])
 		if ( (pin < CHANNEL_NR_MIN) || (pin > RELAY_CH_NR_MAX))
 		{
 			printf("Relay number value out of range!\n");
-			exit(1);
+			cliExit(1);
 		}
 
 		if (OK != relayChGet(dev, pin, &state))
 		{
 			printf("Fail to read!\n");
-			exit(1);
+			cliExit(1);
+		}
+		if (outFormatGet() != OUT_TEXT)
+		{
+			rec.id = id;
+			rec.flags = OUT_F_OK | OUT_F_RELAYS | OUT_F_CHANNEL;
+			rec.channel = pin;
+			rec.relays = state != 0;
+			outBoard(&rec);
 		}
-		if (state != 0)
+		else if (state != 0)
 		{
 			printf("1\n");
 		}
@@ -574,14 +1298,22 @@ static void doRelayRead(int argc, char *argv[])
 		if (OK != relayGet(dev, &val))
 		{
 			printf("Fail to read!\n");
-			exit(1);
+			cliExit(1);
+		}
+		if (outFormatGet() != OUT_TEXT)
+		{
+			rec.id = id;
+			rec.flags = OUT_F_OK | OUT_F_RELAYS;
+			rec.relays = val;
+			outBoard(&rec);
+			return;
 		}
 		printf("%d\n", val);
 	}
 	else
 	{
 		printf("Usage: %s read relay value\n", argv[0]);
-		exit(1);
+		cliExit(1);
 	}
 }
 
@@ -595,12 +1327,16 @@ static void doInRead(int argc, char *argv[])
 	int pin = 0;
 	int val = 0;
 	int dev = 0;
+	int id = 0;
 	OutStateEnumType state = STATE_COUNT;
+	OutRecordType rec;
 
-	dev = doBoardInit(atoi(argv[1]));
+	memset(&rec, 0, sizeof(rec));
+	id = boardIdParse(argv[1]);
+	dev = doBoardInit(id);
 	if (dev <= 0)
 	{
-		exit(1);
+		cliExit(1);
 	}
 
 	if (argc == 4)
@@ -609,15 +1345,23 @@ static void doInRead(int argc, char *argv[])
 		if ( (pin < CHANNEL_NR_MIN) || (pin > IN_CH_NR_MAX))
 		{
 			printf("Input channel number value out of range!\n");
-			exit(1);
+			cliExit(1);
 		}
 
 		if (OK != inChGet(dev, pin, &state))
 		{
 			printf("Fail to read!\n");
-			exit(1);
+			cliExit(1);
+		}
+		if (outFormatGet() != OUT_TEXT)
+		{
+			rec.id = id;
+			rec.flags = OUT_F_OK | OUT_F_INPUTS | OUT_F_CHANNEL;
+			rec.channel = pin;
+			rec.inputs = state != 0;
+			outBoard(&rec);
 		}
-		if (state != 0)
+		else if (state != 0)
 		{
 			printf("1\n");
 		}
@@ -631,85 +1375,534 @@ static void doInRead(int argc, char *argv[])
 		if (OK != inGet(dev, &val))
 		{
 			printf("Fail to read!\n");
-			exit(1);
+			cliExit(1);
+		}
+		if (outFormatGet() != OUT_TEXT)
+		{
+			rec.id = id;
+			rec.flags = OUT_F_OK | OUT_F_INPUTS;
+			rec.inputs = val;
+			outBoard(&rec);
+			return;
 		}
 		printf("%d\n", val);
 	}
 	else
 	{
 		printf("Usage: %s read inputs value\n", argv[0]);
-		exit(1);
+		cliExit(1);
 	}
 }
 
-static void doHelp(int argc, char *argv[])
+/*
+ * doStatus:
+ *	Read relays and inputs state from one input port read
+ ******************************************************************************************
+ */
+static void doStatus(int argc, char *argv[])
 {
-	int i = 0;
-	if (argc == 3)
+	int dev = 0;
+	int id = 0;
+	BoardSnapshotType snap;
+	OutRecordType rec;
+
+	if (argc != 3)
 	{
-		for (i = 0; i < CMD_ARRAY_SIZE; i++)
-		{
-			if ( (gCmdArray[i].name != NULL))
-			{
-				if (strcasecmp(argv[2], gCmdArray[i].name) == 0)
-				{
-					printf("%s%s%s%s", gCmdArray[i].help, gCmdArray[i].usage1,
-						gCmdArray[i].usage2, gCmdArray[i].example);
-					break;
-				}
-			}
-		}
-		if (CMD_ARRAY_SIZE == i)
-		{
-			printf("Option \"%s\" not found\n", argv[2]);
-			printf("%s: %s\n", argv[0], usage);
-		}
+		printf("%s", CMD_STATUS.usage1);
+		cliExit(1);
 	}
-	else
+	id = boardIdParse(argv[1]);
+	dev = doBoardInit(id);
+	if (dev <= 0)
 	{
-		printf("%s: %s\n", argv[0], usage);
+		cliExit(1);
 	}
+	if (OK != boardSnapshot(dev, &snap))
+	{
+		printf("Fail to read!\n");
+		cliExit(1);
+	}
+	if (outFormatGet() != OUT_TEXT)
+	{
+		rec.id = id;
+		rec.flags = OUT_F_OK | OUT_F_RELAYS | OUT_F_INPUTS | OUT_F_TIME;
+		rec.channel = 0;
+		rec.relays = snap.relays;
+		rec.inputs = snap.inputs;
+		rec.timeMs = snap.timeMs;
+		outBoard(&rec);
+		return;
+	}
+	printf("relays %d inputs %d time %llu.%03d\n", snap.relays, snap.inputs,
+		(unsigned long long)(snap.timeMs / 1000), (int)(snap.timeMs % 1000));
 }
 
-static void doVersion(int argc, char *argv[])
-{
-	UNUSED(argc);
-	UNUSED(argv);
-	printf("4relind v%d.%d.%d Copyright (c) 2016 - 2021 Sequent Microsystems\n",
-	VERSION_BASE, VERSION_MAJOR, VERSION_MINOR);
-	printf("\nThis is free software with ABSOLUTELY NO WARRANTY.\n");
-	printf("For details type: 4relind -warranty\n");
-
-}
-
-static void doList(int argc, char *argv[])
+/*
+ * setValueParse:
+ *	Relay value in decimal, hex (0x..) or binary (0b..), ERROR if invalid
+ ******************************************************************************************
+ */
+static int setValueParse(const char* str, const char* end)
 {
-	int ids[8];
-	int i;
-	int cnt = 0;
-	u8 st = 0;
-
-	UNUSED(argc);
-	UNUSED(argv);
+	int base = 10;
+	int val = 0;
+	int digit = 0;
 
-	for (i = 0; i < 8; i++)
+	if (end - str > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
 	{
-		st = (0x02 & i) + (0x01 & (i >> 2)) + (0x04 & (i << 2));
-		if (boardCheck(RELAY8_HW_I2C_BASE_ADD + st) == OK)
-		{
-			ids[cnt] = i;
-			cnt++;
-		}
+		base = 16;
+		str += 2;
 	}
-	printf("%d board(s) detected\n", cnt);
-	if (cnt > 0)
+	else if (end - str > 2 && str[0] == '0' && (str[1] == 'b' || str[1] == 'B'))
 	{
-		printf("Id:");
+		base = 2;
+		str += 2;
+	}
+	if (str == end)
+	{
+		return ERROR;
+	}
+	for (; str < end; str++)
+	{
+		if (*str >= '0' && *str <= '9')
+		{
+			digit = *str - '0';
+		}
+		else if (*str >= 'a' && *str <= 'f')
+		{
+			digit = *str - 'a' + 10;
+		}
+		else if (*str >= 'A' && *str <= 'F')
+		{
+			digit = *str - 'A' + 10;
+		}
+		else
+		{
+			return ERROR;
+		}
+		if (digit >= base)
+		{
+			return ERROR;
+		}
+		val = val * base + digit;
+		if (val > (1 << RELAY_CH_NR_MAX) - 1)
+		{
+			return ERROR;
+		}
+	}
+	return val;
+}
+
+/*
+ * setArgParse:
+ *	One "<id>:<ch>=<on/off>,.." or "<id>:=<value>" argument of "set", the
+ *	changed relays are added to <mask>/<val> of the board. Return the board
+ *	id or ERROR
+ ******************************************************************************************
+ */
+static int setArgParse(const char* str, u8* mask, u8* val)
+{
+	char arg[128];
+	char* spec = NULL;
+	char* item = NULL;
+	char* eq = NULL;
+	char* next = NULL;
+	int id = 0;
+	int ch = 0;
+	int v = 0;
+
+	if (strlen(str) >= sizeof(arg))
+	{
+		return ERROR;
+	}
+	strcpy(arg, str);
+	spec = strchr(arg, ':');
+	if (spec == NULL)
+	{
+		return ERROR;
+	}
+	*spec++ = 0;
+	id = boardIdParse(arg);
+	if (id < 0)
+	{
+		return ERROR;
+	}
+	if (*spec == '=')
+	{
+		v = setValueParse(spec + 1, spec + strlen(spec));
+		if (v < 0)
+		{
+			return ERROR;
+		}
+		mask[id] = (1 << RELAY_CH_NR_MAX) - 1;
+		val[id] = (u8)v;
+		return id;
+	}
+	for (item = spec; item != NULL; item = next)
+	{
+		next = strchr(item, ',');
+		if (next != NULL)
+		{
+			*next++ = 0;
+		}
+		eq = strchr(item, '=');
+		if (eq == NULL)
+		{
+			return ERROR;
+		}
+		*eq++ = 0;
+		ch = setValueParse(item, item + strlen(item));
+		if ( (ch < CHANNEL_NR_MIN) || (ch > RELAY_CH_NR_MAX))
+		{
+			return ERROR;
+		}
+		if ( (strcasecmp(eq, "on") == 0) || (strcasecmp(eq, "up") == 0)
+			|| (strcmp(eq, "1") == 0))
+		{
+			val[id] |= 1 << (ch - 1);
+		}
+		else if ( (strcasecmp(eq, "off") == 0) || (strcasecmp(eq, "down") == 0)
+			|| (strcmp(eq, "0") == 0))
+		{
+			val[id] &= ~(1 << (ch - 1));
+		}
+		else
+		{
+			return ERROR;
+		}
+		mask[id] |= 1 << (ch - 1);
+	}
+	return id;
+}
+
+/*
+ * doSet:
+ *	Masked relay changes of several boards, all parsed before anything is
+ *	written. The relays kept come from the shadow or from one batched read,
+ *	the new states go out with one batched write per bus
+ ******************************************************************************************
+ */
+static void doSet(int argc, char *argv[])
+{
+	u8 mask[BOARD_NR_MAX];
+	u8 val[BOARD_NR_MAX];
+	int ids[BOARD_NR_MAX];
+	u8 relays[BOARD_NR_MAX];
+	int ok[BOARD_NR_MAX];
+	int rdIds[BOARD_NR_MAX];
+	int rdIdx[BOARD_NR_MAX];
+	BoardSnapshotType snaps[BOARD_NR_MAX];
+	int polInv = 0;
+	int n = 0;
+	int m = 0;
+	int i = 0;
+	int id = 0;
+	int dev = 0;
+	int fail = 0;
+	u8 cur = 0;
+
+	if (argc < 3)
+	{
+		printf("%s%s", CMD_SET.usage1, CMD_SET.usage2);
+		cliExit(1);
+	}
+	memset(mask, 0, sizeof(mask));
+	memset(val, 0, sizeof(val));
+	for (i = 2; i < argc; i++)
+	{
+		id = setArgParse(argv[i], mask, val);
+		if (id < 0)
+		{
+			printf("Invalid argument \"%s\"!\n", argv[i]);
+			printf("%s%s", CMD_SET.usage1, CMD_SET.usage2);
+			cliExit(1);
+		}
+	}
+	for (id = 0; id < BOARD_NR_MAX; id++)
+	{
+		if (mask[id] == 0)
+		{
+			continue;
+		}
+		if (!(initStateGet(BOARD_BUS(id), &polInv) & (1 << BOARD_STACK(id))))
+		{
+			dev = doBoardInit(id); // not configured at boot
+			if (dev <= 0)
+			{
+				cliExit(1);
+			}
+			boardClose(dev);
+		}
+		ids[n] = id;
+		relays[n] = val[id];
+		if (mask[id] == (1 << RELAY_CH_NR_MAX) - 1)
+		{
+			n++;
+			continue;
+		}
+		if (OK == shadowGet(id, &cur, timeMsGet()))
+		{
+			relays[n] = (IOToRelay(cur) & ~mask[id]) | val[id];
+		}
+		else
+		{
+			rdIds[m] = id;
+			rdIdx[m++] = n;
+		}
+		n++;
+	}
+	if (m > 0)
+	{
+		boardSnapshotAll(rdIds, snaps, m);
+		for (i = 0; i < m; i++)
+		{
+			if (!snaps[i].ok)
+			{
+				printf("Fail to read board #%s\n", boardIdStr(rdIds[i]));
+				cliExit(1);
+			}
+			relays[rdIdx[i]] = (snaps[i].relays & ~mask[rdIds[i]]) | val[rdIds[i]];
+		}
+	}
+	if (n != boardRelaysWrite(ids, relays, ok, n))
+	{
+		for (i = 0; i < n; i++)
+		{
+			if (!ok[i])
+			{
+				printf("Fail to write board #%s\n", boardIdStr(ids[i]));
+				fail = 1;
+			}
+		}
+	}
+	if (fail)
+	{
+		cliExit(1);
+	}
+}
+
+/*
+ * doAll:
+ *	Read all the detected boards with one batched transfer per bus
+ ******************************************************************************************
+ */
+static void doAll(int argc, char *argv[])
+{
+	int ids[BOARD_NR_MAX];
+	BoardSnapshotType snaps[BOARD_NR_MAX];
+	int cnt = 0;
+	int ok = 0;
+	int relays = 0;
+	int inputs = 0;
+	int i = 0;
+	OutRecordType rec;
+
+	if (argc == 4 && strcasecmp(argv[3], "--json") == 0)
+	{
+		outFormatSet(OUT_JSON);
+	}
+	else if (argc != 3)
+	{
+		printf("%s%s", CMD_ALL.usage1, CMD_ALL.usage2);
+		cliExit(1);
+	}
+	if (strcasecmp(argv[2], "read") == 0)
+	{
+		relays = 1;
+	}
+	else if (strcasecmp(argv[2], "inread") == 0)
+	{
+		inputs = 1;
+	}
+	else if (strcasecmp(argv[2], "status") == 0)
+	{
+		relays = 1;
+		inputs = 1;
+	}
+	else
+	{
+		printf("%s%s", CMD_ALL.usage1, CMD_ALL.usage2);
+		cliExit(1);
+	}
+	cnt = boardListGet(ids);
+	if (cnt <= 0)
+	{
+		printf("No board detected!\n");
+		cliExit(1);
+	}
+	ok = boardSnapshotAll(ids, snaps, cnt);
+	if (ok < 0)
+	{
+		printf("Fail to read!\n");
+		cliExit(1);
+	}
+	if (outFormatGet() != OUT_TEXT)
+	{
+		memset(&rec, 0, sizeof(rec));
+		outBoardsBegin(snaps[0].timeMs);
+		for (i = 0; i < cnt; i++)
+		{
+			rec.id = ids[i];
+			rec.flags = (snaps[i].ok ? OUT_F_OK : 0) | (relays ? OUT_F_RELAYS : 0)
+				| (inputs ? OUT_F_INPUTS : 0) | OUT_F_TIME;
+			rec.relays = relays ? snaps[i].relays : 0;
+			rec.inputs = inputs ? snaps[i].inputs : 0;
+			rec.timeMs = snaps[i].timeMs;
+			outBoard(&rec);
+		}
+		outBoardsEnd();
+		cliExit(ok != cnt);
+	}
+	for (i = 0; i < cnt; i++)
+	{
+		printf("%s", boardIdStr(ids[i]));
+		if (!snaps[i].ok)
+		{
+			printf(" offline\n");
+		}
+		else if (relays && inputs)
+		{
+			printf(" relays %d inputs %d\n", snaps[i].relays, snaps[i].inputs);
+		}
+		else
+		{
+			printf(" %d\n", relays ? snaps[i].relays : snaps[i].inputs);
+		}
+	}
+	if (ok != cnt)
+	{
+		cliExit(1);
+	}
+}
+
+static void doHelp(int argc, char *argv[])
+{
+	int i = 0;
+	if (argc == 3)
+	{
+		for (i = 0; i < CMD_ARRAY_SIZE; i++)
+		{
+			if ( (gCmdArray[i].name != NULL))
+			{
+				if (strcasecmp(argv[2], gCmdArray[i].name) == 0)
+				{
+					printf("%s%s%s%s", gCmdArray[i].help, gCmdArray[i].usage1,
+						gCmdArray[i].usage2, gCmdArray[i].example);
+					break;
+				}
+			}
+		}
+		if (CMD_ARRAY_SIZE == i)
+		{
+			printf("Option \"%s\" not found\n", argv[2]);
+			printf("%s: %s\n", argv[0], usage);
+		}
+	}
+	else
+	{
+		printf("%s: %s\n", argv[0], usage);
+	}
+}
+
+static void doVersion(int argc, char *argv[])
+{
+	UNUSED(argc);
+	UNUSED(argv);
+	printf("4relind v%d.%d.%d Copyright (c) 2016 - 2021 Sequent Microsystems\n",
+	VERSION_BASE, VERSION_MAJOR, VERSION_MINOR);
+	printf("\nThis is free software with ABSOLUTELY NO WARRANTY.\n");
+	printf("For details type: 4relind -warranty\n");
+
+}
+
+typedef struct
+{
+	int bus;
+	int found[STACK_NR_MAX];
+} BusScanType;
+
+static void busScanJob(void* arg)
+{
+	BusScanType* scan = (BusScanType*)arg;
+	int i = 0;
+	u8 st = 0;
+
+	for (i = 0; i < STACK_NR_MAX; i++)
+	{
+		st = (0x02 & i) + (0x01 & (i >> 2)) + (0x04 & (i << 2));
+		scan->found[i] = (boardCheck(scan->bus, RELAY8_HW_I2C_BASE_ADD + st) == OK);
+	}
+}
+
+/*
+ * boardListGet:
+ *	Fill <ids> (BOARD_NR_MAX entries) with the ids of the boards detected on
+ *	the configured buses, the buses are scanned in parallel. Return the count
+ *********************************************************************************
+ */
+int boardListGet(int* ids)
+{
+	BusScanType scan[I2C_BUS_NR_MAX];
+	int buses[I2C_BUS_NR_MAX];
+	int busCnt = 0;
+	int i;
+	int j;
+	int cnt = 0;
+
+	busCnt = configBusesGet(buses);
+	for (j = 0; j < busCnt; j++)
+	{
+		scan[j].bus = buses[j];
+		workerSubmit(buses[j], busScanJob, &scan[j]);
+	}
+	workerWait();
+	for (j = 0; j < busCnt; j++)
+	{
+		for (i = 0; i < STACK_NR_MAX; i++)
+		{
+			if (scan[j].found[i])
+			{
+				ids[cnt] = BOARD_ID(scan[j].bus, i);
+				cnt++;
+			}
+		}
+	}
+	return cnt;
+}
+
+static void doList(int argc, char *argv[])
+{
+	int ids[BOARD_NR_MAX];
+	int cnt = 0;
+	int i = 0;
+	OutRecordType rec;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	cnt = boardListGet(ids);
+	if (outFormatGet() != OUT_TEXT)
+	{
+		memset(&rec, 0, sizeof(rec));
+		rec.flags = OUT_F_OK;
+		outBoardsBegin(0);
+		for (i = 0; i < cnt; i++)
+		{
+			rec.id = ids[i];
+			outBoard(&rec);
+		}
+		outBoardsEnd();
+		return;
+	}
+	printf("%d board(s) detected\n", cnt);
+	if (cnt > 0)
+	{
+		printf("Id:");
 	}
 	while (cnt > 0)
 	{
 		cnt--;
-		printf(" %d", ids[cnt]);
+		printf(" %s", boardIdStr(ids[cnt]));
 	}
 	printf("\n");
 }
@@ -733,10 +1926,10 @@ static void doTest(int argc, char* argv[])
 		3,
 		4};
 
-	dev = doBoardInit(atoi(argv[1]));
+	dev = doBoardInit(boardIdParse(argv[1]));
 	if (dev <= 0)
 	{
-		exit(1);
+		cliExit(1);
 	}
 	if (argc == 4)
 	{
@@ -785,7 +1978,7 @@ static void doTest(int argc, char* argv[])
 					printf("Fail to write relay\n");
 					if (file)
 						fclose(file);
-					exit(1);
+					cliExit(1);
 				}
 				busyWait(150);
 			}
@@ -815,7 +2008,7 @@ static void doTest(int argc, char* argv[])
 					printf("Fail to write relay!\n");
 					if (file)
 						fclose(file);
-					exit(1);
+					cliExit(1);
 				}
 				busyWait(150);
 			}
@@ -850,46 +2043,686 @@ static void doTest(int argc, char* argv[])
 	relaySet(dev, 0);
 }
 
-static void doWarranty(int argc UNU, char* argv[] UNU)
+static void doDaemon(int argc, char* argv[])
 {
-	printf("%s\n", warranty);
+	int period = DAEMON_PERIOD_MS_DEFAULT;
+
+	if (argc == 3)
+	{
+		period = atoi(argv[2]);
+		if (period < DAEMON_PERIOD_MS_MIN)
+		{
+			printf("Invalid sample period!\n");
+			cliExit(1);
+		}
+	}
+	else if (argc != 2)
+	{
+		printf("%s", CMD_DAEMON.usage1);
+		printf("%s", CMD_DAEMON.usage2);
+		cliExit(1);
+	}
+	if (OK != daemonRun(period))
+	{
+		cliExit(1);
+	}
 }
 
-static void cliInit(void)
+static int timeArgParse(const char* arg, uint64_t* ms)
 {
-	int i = 0;
-
-	memset(gCmdArray, 0, sizeof(CliCmdType) * CMD_ARRAY_SIZE);
+	char* end = NULL;
+	double val = 0;
 
-	memcpy(&gCmdArray[i], &CMD_HELP, sizeof(CliCmdType));
-	i++;
-	memcpy(&gCmdArray[i], &CMD_WAR, sizeof(CliCmdType));
-	i++;
-	memcpy(&gCmdArray[i], &CMD_LIST, sizeof(CliCmdType));
-	i++;
-	memcpy(&gCmdArray[i], &CMD_WRITE, sizeof(CliCmdType));
-	i++;
-	memcpy(&gCmdArray[i], &CMD_READ, sizeof(CliCmdType));
+	if (strcasecmp(arg, "now") == 0)
+	{
+		*ms = timeMsGet();
+		return OK;
+	}
+	val = strtod(arg, &end);
+	if (end == arg || *end != 0)
+	{
+		return ERROR;
+	}
+	if (arg[0] == '-')
+	{
+		*ms = timeMsGet() + (int64_t)(val * 1000);
+	}
+	else
+	{
+		*ms = (uint64_t)(val * 1000);
+	}
+	return OK;
+}
+
+static void historyPrint(uint64_t ms, uint8_t board, uint8_t state, void* arg)
+{
+	char buff[32];
+	time_t sec = (time_t)(ms / 1000);
+	struct tm tmv;
+
+	UNUSED(board);
+	UNUSED(arg);
+	localtime_r(&sec, &tmv);
+	strftime(buff, sizeof(buff), "%Y-%m-%d %H:%M:%S", &tmv);
+	printf("%s.%03d relays %d inputs %d\n", buff, (int)(ms % 1000),
+		HIST_RELAYS(state), HIST_INPUTS(state));
+}
+
+/*
+ * doHistory:
+ *	Display the logged state changes of one board
+ ******************************************************************************************
+ */
+static void doHistory(int argc, char* argv[])
+{
+	int id = 0;
+	uint64_t fromMs = 0;
+	uint64_t toMs = UINT64_MAX;
+
+	if (argc < 3 || argc > 5)
+	{
+		printf("%s", CMD_HISTORY.usage1);
+		printf("%s", CMD_HISTORY.usage2);
+		cliExit(1);
+	}
+	id = boardIdParse(argv[1]);
+	if (id < 0)
+	{
+		printf("Invalid board id [<bus>.]<0..7>!\n");
+		cliExit(1);
+	}
+	if ( (argc > 3 && OK != timeArgParse(argv[3], &fromMs))
+		|| (argc > 4 && OK != timeArgParse(argv[4], &toMs)))
+	{
+		printf("Invalid time value!\n");
+		cliExit(1);
+	}
+	if (OK != histQuery(id, fromMs, toMs, historyPrint, NULL))
+	{
+		printf("No history recorded, start \"4relind -daemon\" first\n");
+		cliExit(1);
+	}
+}
+
+/*
+ * doStats:
+ *	Display the on time of one relay and one input channel
+ ******************************************************************************************
+ */
+static void doStats(int argc, char* argv[])
+{
+	int id = 0;
+	int ch = 0;
+	uint64_t sinceMs = 0;
+	uint64_t nowMs = timeMsGet();
+	uint64_t onMs = 0;
+	uint64_t spanMs = 0;
+
+	if ( (argc != 4 && argc != 6)
+		|| (argc == 6 && strcasecmp(argv[4], "--since") != 0))
+	{
+		printf("%s", CMD_STATS.usage1);
+		printf("%s", CMD_STATS.usage2);
+		cliExit(1);
+	}
+	id = boardIdParse(argv[2]);
+	ch = atoi(argv[3]);
+	if (id < 0)
+	{
+		printf("Invalid board id [<bus>.]<0..7>!\n");
+		cliExit(1);
+	}
+	if ( (ch < CHANNEL_NR_MIN) || (ch > RELAY_CH_NR_MAX))
+	{
+		printf("Channel number value out of range!\n");
+		cliExit(1);
+	}
+	sinceMs = nowMs - ROLLUP_DAY_MS;
+	if (argc == 6 && OK != timeArgParse(argv[5], &sinceMs))
+	{
+		printf("Invalid time value!\n");
+		cliExit(1);
+	}
+	if (OK != rollupOpen(0))
+	{
+		printf("No statistics recorded, start \"4relind -daemon\" first\n");
+		cliExit(1);
+	}
+	if (!daemonIsRunning()) // nothing sampled since the daemon stopped
+	{
+		nowMs = 0;
+	}
+	if (OK != rollupOnTime(id, 4 + ch - 1, sinceMs, nowMs, &onMs, &spanMs))
+	{
+		printf("No statistics recorded for board #%s\n", boardIdStr(id));
+		rollupClose();
+		cliExit(1);
+	}
+	printf("relay %d on time %.3f s of %.3f s (%.2f%%)\n", ch, onMs / 1000.0,
+		spanMs / 1000.0, spanMs ? 100.0 * onMs / spanMs : 0.0);
+	rollupOnTime(id, ch - 1, sinceMs, nowMs, &onMs, &spanMs);
+	printf("input %d on time %.3f s of %.3f s (%.2f%%)\n", ch, onMs / 1000.0,
+		spanMs / 1000.0, spanMs ? 100.0 * onMs / spanMs : 0.0);
+	rollupClose();
+}
+
+/*
+ * doWear:
+ *	Display or reset the relay wear counters
+ ******************************************************************************************
+ */
+static void doWear(int argc, char* argv[])
+{
+	WearInfoType info;
+	uint64_t now = timeMsGet();
+	int id = boardIdParse(argv[1]);
+	int ch = 0;
+
+	if (id < 0)
+	{
+		printf("Invalid board id [<bus>.]<0..7>!\n");
+		cliExit(1);
+	}
+	if (argc == 5 && strcasecmp(argv[3], "reset") == 0)
+	{
+		ch = atoi(argv[4]);
+		if ( (ch < CHANNEL_NR_MIN) || (ch > RELAY_CH_NR_MAX))
+		{
+			printf("Relay number value out of range!\n");
+			cliExit(1);
+		}
+		if (OK != wearReset(id, ch))
+		{
+			printf("Fail to open %s\n", mmPath(WEAR_FILE));
+			cliExit(1);
+		}
+		return;
+	}
+	if (argc != 3)
+	{
+		printf("%s", CMD_WEAR.usage1);
+		printf("%s", CMD_WEAR.usage2);
+		cliExit(1);
+	}
+	for (ch = CHANNEL_NR_MIN; ch <= RELAY_CH_NR_MAX; ch++)
+	{
+		if (OK != wearGet(id, ch, now, &info))
+		{
+			printf("Fail to open %s\n", mmPath(WEAR_FILE));
+			cliExit(1);
+		}
+		printf("relay %d: %llu cycles, %.1f h on%s\n", ch,
+			(unsigned long long)info.switches, info.onMs / 3600000.0,
+			info.warning ? " WARNING: wear limit reached" : "");
+	}
+}
+
+/*
+ * limitParse:
+ *	Decimal wear limit, digits only
+ *********************************************************************************
+ */
+static int limitParse(const char* str, uint64_t* val)
+{
+	char* end = NULL;
+
+	if (!isdigit((unsigned char)str[0]))
+	{
+		return ERROR;
+	}
+	errno = 0;
+	*val = strtoull(str, &end, 10);
+	return (errno != 0 || *end != 0) ? ERROR : OK;
+}
+
+static void doWearLimit(int argc, char* argv[])
+{
+	uint64_t switches = 0;
+	uint64_t hours = 0;
+
+	if (argc == 2)
+	{
+		if (OK != wearLimitGet(&switches, &hours))
+		{
+			printf("Fail to open %s\n", mmPath(WEAR_FILE));
+			cliExit(1);
+		}
+		printf("%llu cycles, %llu on hours\n", (unsigned long long)switches,
+			(unsigned long long)hours);
+		return;
+	}
+	if ( (argc != 3 && argc != 4) || OK != limitParse(argv[2], &switches)
+		|| (argc == 4 && OK != limitParse(argv[3], &hours)))
+	{
+		printf("%s", CMD_WEAR_LIMIT.usage1);
+		printf("%s", CMD_WEAR_LIMIT.usage2);
+		cliExit(1);
+	}
+	if (OK != wearLimitSet(switches, hours))
+	{
+		printf("Fail to open %s\n", mmPath(WEAR_FILE));
+		cliExit(1);
+	}
+}
+
+static void doMetrics(int argc, char* argv[])
+{
+	UNUSED(argc);
+	UNUSED(argv);
+	metricsPrint(stdout);
+}
+
+static void doJournal(int argc, char* argv[])
+{
+	int enable = 0;
+
+	if (argc == 2)
+	{
+		printf("%s\n", journalIsEnabled() ? "on" : "off");
+		return;
+	}
+	if (argc == 3 && (strcasecmp(argv[2], "on") == 0 || strcmp(argv[2], "1") == 0))
+	{
+		enable = 1;
+	}
+	else if (argc != 3 || (strcasecmp(argv[2], "off") != 0 && strcmp(argv[2], "0") != 0))
+	{
+		printf("%s", CMD_JOURNAL.usage1);
+		cliExit(1);
+	}
+	if (OK != journalEnable(enable))
+	{
+		printf("Fail to open %s\n", mmPath(JOURNAL_FILE));
+		cliExit(1);
+	}
+}
+
+/*
+ * doRestore:
+ *	Write back the journaled relay state of every board. For each board the
+ *	output port is loaded before the pins are configured as outputs so the
+ *	relays go straight to the restored state.
+ ******************************************************************************************
+ */
+static void doRestore(int argc, char* argv[])
+{
+	I2cRegType regs[2 * BOARD_NR_MAX];
+	int ids[2 * BOARD_NR_MAX];
+	u8 relays[BOARD_NR_MAX];
+	int n = 0;
+	int i = 0;
+	int id = 0;
+	int fail = 0;
+	uint64_t now = 0;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	if (!journalIsEnabled())
+	{
+		printf("The relay state journal is off, enable it with \"4relind -journal on\"\n");
+		cliExit(1);
+	}
+	for (id = 0; id < BOARD_NR_MAX; id++)
+	{
+		if (OK != journalGet(id, &relays[n]))
+		{
+			continue;
+		}
+		regs[2 * n].reg = RELAY8_OUTPORT_REG_ADD;
+		regs[2 * n].val = relayToIO(relays[n]);
+		regs[2 * n + 1].reg = RELAY8_CFG_REG_ADD;
+		regs[2 * n + 1].val = RELAY8_CFG_VAL;
+		ids[2 * n] = id;
+		ids[2 * n + 1] = id;
+		n++;
+	}
+	if (n == 0)
+	{
+		return;
+	}
+	boardBatch(ids, regs, 2 * n, 1);
+	now = timeMsGet();
+	for (i = 0; i < n; i++)
+	{
+		if (regs[2 * i].ok && regs[2 * i + 1].ok)
+		{
+			shadowSet(ids[2 * i], regs[2 * i].val, now);
+			wearRecord(ids[2 * i], relays[i], now);
+		}
+		else
+		{
+			printf("Fail to restore board #%s\n", boardIdStr(ids[2 * i]));
+			fail = 1;
+		}
+	}
+	if (fail)
+	{
+		cliExit(1);
+	}
+}
+
+/*
+ * doInitAll:
+ *	Discover and configure all boards on the configured buses with one batched
+ *	read and one batched write per bus, then record the configured boards and
+ *	the input polarity under /run. Journaled relay states are restored,
+ *	unconfigured boards start with all relays off as doBoardInit() does.
+ ******************************************************************************************
+ */
+static void doInitAll(int argc, char* argv[])
+{
+	I2cRegType cfg[BOARD_NR_MAX];
+	int cfgIds[BOARD_NR_MAX];
+	I2cRegType regs[3 * BOARD_NR_MAX];
+	int ids[3 * BOARD_NR_MAX];
+	int buses[I2C_BUS_NR_MAX];
+	int mask[I2C_BUS_NR_MAX];
+	int busCnt = 0;
+	u8 relays = 0;
+	u8 polInv = 0;
+	int id = 0;
+	int bit = 0;
+	int m = 0;
+	int n = 0;
+	int i = 0;
+	int j = 0;
+	int cnt = 0;
+	FILE* file = NULL;
+
+	if (argc == 3 && strcasecmp(argv[2], "--polinv") == 0)
+	{
+		polInv = RELAY8_CFG_VAL; // invert the input pins only
+	}
+	else if (argc != 2)
+	{
+		printf("%s", CMD_INIT_ALL.usage1);
+		printf("%s", CMD_INIT_ALL.usage2);
+		cliExit(1);
+	}
+
+	memset(mask, 0, sizeof(mask));
+	busCnt = configBusesGet(buses);
+	for (j = 0; j < busCnt; j++)
+	{
+		for (i = 0; i < STACK_NR_MAX; i++)
+		{
+			cfgIds[m] = BOARD_ID(buses[j], i);
+			cfg[m++].reg = RELAY8_CFG_REG_ADD;
+		}
+	}
+	boardBatch(cfgIds, cfg, m, 0);
+	for (j = 0; j < m; j++)
+	{
+		if (!cfg[j].ok)
+		{
+			continue;
+		}
+		id = cfgIds[j];
+		mask[BOARD_BUS(id)] |= 1 << BOARD_STACK(id);
+		regs[n].reg = RELAY8_POLINV_REG_ADD;
+		regs[n].val = polInv;
+		ids[n++] = id;
+		relays = 0;
+		if (OK == journalGet(id, &relays) || cfg[j].val != RELAY8_CFG_VAL)
+		{
+			regs[n].reg = RELAY8_OUTPORT_REG_ADD;
+			regs[n].val = relayToIO(relays);
+			ids[n++] = id;
+		}
+		if (cfg[j].val != RELAY8_CFG_VAL)
+		{
+			regs[n].reg = RELAY8_CFG_REG_ADD;
+			regs[n].val = RELAY8_CFG_VAL;
+			ids[n++] = id;
+		}
+	}
+	if (n > 0)
+	{
+		boardBatch(ids, regs, n, 1);
+	}
+	for (i = 0; i < n; i++)
+	{
+		bit = 1 << BOARD_STACK(ids[i]);
+		if (!regs[i].ok && (mask[BOARD_BUS(ids[i])] & bit))
+		{
+			printf("Fail to initialize board #%s\n", boardIdStr(ids[i]));
+			mask[BOARD_BUS(ids[i])] &= ~bit;
+		}
+		else if (regs[i].ok && regs[i].reg == RELAY8_OUTPORT_REG_ADD)
+		{
+			shadowSet(ids[i], regs[i].val, timeMsGet());
+			wearRecord(ids[i], IOToRelay(regs[i].val), timeMsGet());
+		}
+	}
+	if (0 != mmDirCreate(RUN_DIR) || (file = fopen(mmPath(INIT_FILE), "w")) == NULL)
+	{
+		printf("Fail to write %s\n", mmPath(INIT_FILE));
+		cliExit(1);
+	}
+	fprintf(file, "0x%02x 0x%02x\n", mask[I2C_BUS_DEFAULT], polInv);
+	for (j = 0; j < busCnt; j++)
+	{
+		if (buses[j] != I2C_BUS_DEFAULT)
+		{
+			fprintf(file, "i2c-%d 0x%02x 0x%02x\n", buses[j], mask[buses[j]], polInv);
+		}
+	}
+	fclose(file);
+	for (j = 0; j < I2C_BUS_NR_MAX; j++)
+	{
+		for (i = 0; i < STACK_NR_MAX; i++)
+		{
+			cnt += (mask[j] >> i) & 1;
+		}
+	}
+	printf("%d board(s) initialized\n", cnt);
+}
+
+static void doWarranty(int argc UNU, char* argv[] UNU)
+{
+	printf("%s\n", warranty);
+}
+
+static void cliInit(void)
+{
+	int i = 0;
+
+	memset(gCmdArray, 0, sizeof(CliCmdType) * CMD_ARRAY_SIZE);
+
+	memcpy(&gCmdArray[i], &CMD_HELP, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_WAR, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_LIST, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_ALL, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_WRITE, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_SET, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_READ, sizeof(CliCmdType));
 	i++;
 	memcpy(&gCmdArray[i], &CMD_IN_READ, sizeof(CliCmdType));
 	i++;
+	memcpy(&gCmdArray[i], &CMD_STATUS, sizeof(CliCmdType));
+	i++;
 	memcpy(&gCmdArray[i], &CMD_TEST, sizeof(CliCmdType));
 	i++;
 	memcpy(&gCmdArray[i], &CMD_VERSION, sizeof(CliCmdType));
-
+	i++;
+	memcpy(&gCmdArray[i], &CMD_DAEMON, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_HISTORY, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_STATS, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_WEAR, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_WEAR_LIMIT, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_METRICS, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_JOURNAL, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_RESTORE, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_INIT_ALL, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_BUSES, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_BENCH, sizeof(CliCmdType));
+	i++;
+	memcpy(&gCmdArray[i], &CMD_REPL, sizeof(CliCmdType));
 }
 
-int main(int argc, char *argv[])
+/*
+ * doBuses:
+ *	Display the probing result of every adapter. "probe" forgets it and
+ *	measures again on the first board answering on the adapter: its
+ *	configuration register is read and written back unchanged.
+ **************************************************************************************
+ */
+static void doBuses(int argc, char* argv[])
 {
+	int buses[I2C_BUS_NR_MAX];
+	AdapterInfoType* info = NULL;
+	uint8_t buff[1];
+	int busCnt = 0;
+	int adapter = 0;
+	int probe = 0;
+	int done = 0;
+	int dev = 0;
 	int i = 0;
+	int j = 0;
 
-	cliInit();
+	if (argc == 3 && strcasecmp(argv[2], "probe") == 0)
+	{
+		probe = 1;
+	}
+	else if (argc != 2)
+	{
+		printf("%s", CMD_BUSES.usage1);
+		printf("%s", CMD_BUSES.usage2);
+		cliExit(1);
+	}
+	busCnt = configBusesGet(buses);
+	for (i = 0; probe && i < busCnt; i++)
+	{
+		adapter = muxParentGet(buses[i]);
+		if (!(done & (1 << adapter)))
+		{
+			adapterReset(adapter);
+			done |= 1 << adapter;
+		}
+	}
+	for (i = 0; probe && i < busCnt; i++)
+	{
+		info = adapterInfoGet(muxParentGet(buses[i]));
+		for (j = 0; j < STACK_NR_MAX && info != NULL && !info->benched[ADAPTER_OP_WRITE]; j++)
+		{
+			dev = i2cSetup(buses[i], boardAddrGet(j));
+			if (dev < 0)
+			{
+				break;
+			}
+			if (OK == i2cMem8Read(dev, RELAY8_CFG_REG_ADD, buff, 1))
+			{
+				i2cMem8Write(dev, RELAY8_CFG_REG_ADD, buff, 1);
+			}
+			close(dev);
+		}
+	}
+	done = 0;
+	for (i = 0; i < busCnt; i++)
+	{
+		adapter = muxParentGet(buses[i]);
+		if (!(done & (1 << adapter)))
+		{
+			adapterPrint(stdout, adapter);
+			done |= 1 << adapter;
+		}
+	}
+}
 
-	if (argc == 1)
+static uint64_t timeNsGet(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * doBench:
+ *	Time <count> input port reads and <count> output port writes of the
+ *	value already there, to compare the i2c-dev and gpiochip backends
+ **************************************************************************************
+ */
+static void doBench(int argc, char* argv[])
+{
+	int dev = 0;
+	int count = BENCH_COUNT_DEFAULT;
+	int fail = 0;
+	int i = 0;
+	u8 out = 0;
+	u8 io = 0;
+	uint64_t t0 = 0;
+	uint64_t tRead = 0;
+	uint64_t tWrite = 0;
+
+	if (argc == 4)
 	{
-		printf("%s\n", usage);
-		return 1;
+		count = atoi(argv[3]);
 	}
+	if ( (argc != 3 && argc != 4) || count <= 0)
+	{
+		printf("%s", CMD_BENCH.usage1);
+		printf("%s", CMD_BENCH.usage2);
+		cliExit(1);
+	}
+	dev = doBoardInit(boardIdParse(argv[1]));
+	if (dev <= 0)
+	{
+		cliExit(1);
+	}
+	if (OK != i2cMem8Read(dev, RELAY8_OUTPORT_REG_ADD, &out, 1))
+	{
+		printf("Fail to read!\n");
+		cliExit(1);
+	}
+	t0 = timeNsGet();
+	for (i = 0; i < count; i++)
+	{
+		fail += (OK != i2cMem8Read(dev, RELAY8_INPORT_REG_ADD, &io, 1));
+	}
+	tRead = timeNsGet() - t0;
+	t0 = timeNsGet();
+	for (i = 0; i < count; i++)
+	{
+		fail += (OK != i2cMem8Write(dev, RELAY8_OUTPORT_REG_ADD, &out, 1));
+	}
+	tWrite = timeNsGet() - t0;
+	if (outFormatGet() != OUT_TEXT)
+	{
+		outBench(boardIdParse(argv[1]), gpioEnabled(), count, fail, tRead, tWrite);
+		return;
+	}
+	printf("backend %s: read %.1fus write %.1fus (%d accesses each, %d failed)\n",
+		gpioEnabled() ? "gpio" : "i2c", tRead / 1000.0 / count, tWrite / 1000.0 / count,
+		count, fail);
+}
+
+/*
+ * cliDispatch:
+ *	Run the command of <argv>, ERROR if there is none
+ ******************************************************************************************
+ */
+static int cliDispatch(int argc, char *argv[])
+{
+	int i = 0;
+
 	for (i = 0; i < CMD_ARRAY_SIZE; i++)
 	{
 		if ( (gCmdArray[i].name != NULL) && (gCmdArray[i].namePos < argc))
@@ -897,12 +2730,165 @@ int main(int argc, char *argv[])
 			if (strcasecmp(argv[gCmdArray[i].namePos], gCmdArray[i].name) == 0)
 			{
 				gCmdArray[i].pFunc(argc, argv);
-				return 0;
+				return OK;
 			}
 		}
 	}
+	return ERROR;
+}
+
+/*
+ * replSplit:
+ *	Split <line> in place into <args> after <name>, return the argument count
+ ******************************************************************************************
+ */
+static int replSplit(char* line, char* name, char* args[])
+{
+	char* save = NULL;
+	char* tok = NULL;
+	int n = 1;
+
+	args[0] = name;
+	for (tok = strtok_r(line, " \t", &save); tok != NULL && n < REPL_ARG_MAX;
+		tok = strtok_r(NULL, " \t", &save))
+	{
+		args[n++] = tok;
+	}
+	args[n] = NULL;
+	return n;
+}
+
+/*
+ * doRepl:
+ *	Read commands from stdin and run them in this process, so the devices
+ *	opened, the boards configured and the shadow mapped stay for the next
+ *	command. The time of every command goes to stderr.
+ ******************************************************************************************
+ */
+static void doRepl(int argc, char* argv[])
+{
+	static char hist[REPL_HIST_MAX][REPL_LINE_MAX];
+	char line[REPL_LINE_MAX];
+	char* args[REPL_ARG_MAX + 1];
+	int histCnt = 0;
+	int format = outFormatGet();
+	int tty = isatty(STDIN_FILENO);
+	int n = 0;
+	int i = 0;
+	uint64_t t0 = 0;
+
+	if (argc != 2)
+	{
+		printf("%s", CMD_REPL.usage1);
+		cliExit(1);
+	}
+	gBoardKeep = 1;
+	while (1)
+	{
+		if (tty)
+		{
+			printf("4relind> ");
+			fflush(stdout);
+		}
+		if (fgets(line, sizeof(line), stdin) == NULL)
+		{
+			break;
+		}
+		line[strcspn(line, "\r\n")] = 0;
+		if (line[0] == '!')
+		{
+			i = (line[1] == '!') ? histCnt : atoi(&line[1]);
+			if (i < 1 || i > histCnt || i <= histCnt - REPL_HIST_MAX)
+			{
+				printf("No command %s in the history\n", line);
+				continue;
+			}
+			strcpy(line, hist[(i - 1) % REPL_HIST_MAX]);
+			printf("%s\n", line);
+		}
+		if (line[strspn(line, " \t")] == 0)
+		{
+			continue;
+		}
+		if (strcmp(line, "-hist") != 0)
+		{
+			strcpy(hist[histCnt % REPL_HIST_MAX], line);
+			histCnt++;
+		}
+		n = replSplit(line, argv[0], args);
+		if (strcasecmp(args[1], "quit") == 0 || strcasecmp(args[1], "exit") == 0)
+		{
+			break;
+		}
+		if (strcmp(args[1], "-hist") == 0)
+		{
+			for (i = (histCnt > REPL_HIST_MAX) ? histCnt - REPL_HIST_MAX : 0; i < histCnt; i++)
+			{
+				printf("%5d  %s\n", i + 1, hist[i % REPL_HIST_MAX]);
+			}
+			continue;
+		}
+		if (strcmp(args[1], "-i") == 0)
+		{
+			printf("Already in the interactive shell\n");
+			continue;
+		}
+		outFormatSet(format);
+		n = outFormatParse(n, args);
+		if (n < 0)
+		{
+			printf("Invalid --format, use text, json or bin\n");
+			continue;
+		}
+		gReplExit = 0;
+		gReplActive = 1;
+		t0 = timeNsGet();
+		if (setjmp(gReplJmp) == 0 && OK != cliDispatch(n, args))
+		{
+			printf("Invalid command option\n");
+			gReplExit = 1;
+		}
+		gReplActive = 0;
+		gpioRelease(); // do not hold the lines while waiting for the next command
+		outFormatSet(format); // the prompt back on stdout
+		fflush(stdout);
+		fprintf(stderr, "[%s%.3f ms]\n", gReplExit ? "failed, " : "",
+			(timeNsGet() - t0) / 1000000.0);
+	}
+	gBoardKeep = 0;
+	for (i = 0; i < BOARD_NR_MAX; i++)
+	{
+		if (gBoardDev[i] > 0)
+		{
+			close(gBoardDev[i]);
+			gBoardDev[i] = 0;
+		}
+	}
+}
+
+#ifndef RELAY_NO_MAIN	// built without main() for 4relind-fs
+int main(int argc, char *argv[])
+{
+	cliInit();
+
+	argc = outFormatParse(argc, argv);
+	if (argc < 0)
+	{
+		printf("Invalid --format, use text, json or bin\n");
+		return 1;
+	}
+	if (argc == 1)
+	{
+		printf("%s\n", usage);
+		return 1;
+	}
+	if (OK == cliDispatch(argc, argv))
+	{
+		return 0;
+	}
 	printf("Invalid command option\n");
 	printf("%s\n", usage);
 
 	return 0;
 }
+#endif
@@ -12,12 +12,31 @@
 #define CHANNEL_NR_MIN		1
 #define RELAY_CH_NR_MAX		4
 #define IN_CH_NR_MAX			4
+#define STACK_NR_MAX			8
+
+#define I2C_BUS_DEFAULT		1
+#define I2C_BUS_NR_MAX		8	// adapters /dev/i2c-0 .. /dev/i2c-7
+#define BOARD_NR_MAX		(I2C_BUS_NR_MAX * STACK_NR_MAX)
+
+// board id of the (bus, stack) pair, the boards on the default bus keep the
+// stack level as id (and the state recorded before multi-bus support)
+#define BOARD_ID(bus, stack)	((((bus) + I2C_BUS_NR_MAX - I2C_BUS_DEFAULT) \
+	% I2C_BUS_NR_MAX) * STACK_NR_MAX + (stack))
+#define BOARD_BUS(id)		(((id) / STACK_NR_MAX + I2C_BUS_DEFAULT) % I2C_BUS_NR_MAX)
+#define BOARD_STACK(id)		((id) % STACK_NR_MAX)
 
 #define ERROR	-1
 #define OK		0
 #define FAIL	-1
 
 #define RELAY8_HW_I2C_BASE_ADD	0x38
+#define RELAY8_CFG_VAL		0x0f	// 4 inputs (low nibble), 4 outputs
+#define BENCH_COUNT_DEFAULT	1000	// accesses timed by "bench"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef uint8_t u8;
 typedef uint16_t u16;
 
@@ -39,4 +58,36 @@ typedef struct
  const char* example;
 }CliCmdType;
 
+typedef struct
+{
+	u8 relays;
+	u8 inputs;
+	u8 ok;
+	uint64_t timeMs;
+} BoardSnapshotType;
+
+int boardIdParse(const char* arg);
+int boardAddrGet(int stack);
+const char* boardIdStr(int id);
+int doBoardInit(int id);
+void boardClose(int dev);
+int relayChSet(int dev, u8 channel, OutStateEnumType state);
+int relayChGet(int dev, u8 channel, OutStateEnumType* state);
+int relaySet(int dev, int val);
+int relayGet(int dev, int* val);
+int inChGet(int dev, u8 channel, OutStateEnumType* state);
+int inGet(int dev, int* val);
+int boardSnapshot(int dev, BoardSnapshotType* snap);
+int boardSnapshotAll(const int* ids, BoardSnapshotType* snaps, int n);
+int boardRelaysWrite(const int* ids, const u8* relays, int* ok, int n);
+int boardListGet(int* ids);
+u8 relayToIO(u8 relay);
+u8 IOToRelay(u8 io);
+u8 IOToIn(u8 io, int polInv);
+int boardPolInvGet(int id);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif //RELAY8_H_
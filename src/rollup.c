@@ -0,0 +1,274 @@
+/*
+ * rollup.c:
+ *	Run-length summaries of the board state kept at minute, hour and day
+ *	resolution. Every state change adds the time spent in the previous state
+ *	to the buckets it covers, so an on-time query only sums a few buckets
+ *	instead of replaying the history log.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "relay.h"
+#include "rollup.h"
+
+#define ROLLUP_MAGIC	0x31555234	// "4RU1"
+#define ROLLUP_BITS		8	// one counter for every bit of the board state
+
+typedef struct
+{
+	uint32_t slot;
+	uint32_t onMs[ROLLUP_BITS];
+} RollupBucketType;
+
+typedef struct
+{
+	uint64_t firstMs;
+	uint64_t lastMs;
+	uint8_t state;
+	uint8_t valid;
+	uint8_t resume;	// daemon restarted, the time since lastMs is unknown
+	uint8_t reserved[5];
+	RollupBucketType minute[ROLLUP_MINUTE_SLOTS];
+	RollupBucketType hour[ROLLUP_HOUR_SLOTS];
+	RollupBucketType day[ROLLUP_DAY_SLOTS];
+} RollupBoardType;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t reserved;
+	RollupBoardType board[BOARD_NR_MAX];
+} RollupFileType;
+
+typedef struct
+{
+	uint64_t res;
+	int slots;
+	size_t offset;
+} RollupLevelType;
+
+static const RollupLevelType gLevels[] =
+{
+	{ROLLUP_DAY_MS, ROLLUP_DAY_SLOTS, offsetof(RollupBoardType, day)},
+	{ROLLUP_HOUR_MS, ROLLUP_HOUR_SLOTS, offsetof(RollupBoardType, hour)},
+	{ROLLUP_MINUTE_MS, ROLLUP_MINUTE_SLOTS, offsetof(RollupBoardType, minute)}};
+
+#define ROLLUP_LEVELS	(int)(sizeof(gLevels) / sizeof(gLevels[0]))
+
+static RollupFileType* gRollup = NULL;
+
+static RollupBucketType* bucketGet(RollupBoardType* b, int level, uint64_t slot)
+{
+	RollupBucketType* ring = (RollupBucketType*)((uint8_t*)b
+		+ gLevels[level].offset);
+
+	return &ring[slot % gLevels[level].slots];
+}
+
+int rollupOpen(int writable)
+{
+	int i = 0;
+
+	if (writable && 0 != mmDirCreate(STATE_DIR))
+	{
+		return ERROR;
+	}
+	gRollup = mmFileOpen(ROLLUP_FILE, sizeof(RollupFileType), writable);
+	if (gRollup == NULL)
+	{
+		return ERROR;
+	}
+	if (gRollup->magic != ROLLUP_MAGIC)
+	{
+		if (!writable)
+		{
+			rollupClose();
+			return ERROR;
+		}
+		// only the board headers: the file is mostly buckets, a bucket is
+		// used only for the slot it holds and the span starts at firstMs
+		// (rollupUpdate()), so the old ones age out without writing every page
+		for (i = 0; i < BOARD_NR_MAX; i++)
+		{
+			memset(&gRollup->board[i], 0, offsetof(RollupBoardType, minute));
+		}
+		gRollup->reserved = 0;
+		gRollup->magic = ROLLUP_MAGIC;
+	}
+	if (writable)
+	{
+		for (i = 0; i < BOARD_NR_MAX; i++)
+		{
+			gRollup->board[i].resume = 1;
+		}
+	}
+	return OK;
+}
+
+void rollupClose(void)
+{
+	mmFileClose(gRollup, sizeof(RollupFileType));
+	gRollup = NULL;
+}
+
+/*
+ * accrue:
+ *	Add the on time of <state> in [from, to) to the buckets of every level
+ *********************************************************************************
+ */
+static void accrue(RollupBoardType* b, uint8_t state, uint64_t from, uint64_t to)
+{
+	RollupBucketType* bucket = NULL;
+	uint64_t res = 0;
+	uint64_t slot = 0;
+	uint64_t t = 0;
+	uint64_t end = 0;
+	int level = 0;
+	int bit = 0;
+
+	for (level = 0; level < ROLLUP_LEVELS; level++)
+	{
+		res = gLevels[level].res;
+		t = from;
+		if (to - t > res * gLevels[level].slots) // older buckets get overwritten anyway
+		{
+			t = to - res * gLevels[level].slots;
+		}
+		while (t < to)
+		{
+			slot = t / res;
+			end = (slot + 1) * res;
+			if (end > to)
+			{
+				end = to;
+			}
+			bucket = bucketGet(b, level, slot);
+			if (bucket->slot != (uint32_t)slot)
+			{
+				memset(bucket, 0, sizeof(RollupBucketType));
+				bucket->slot = (uint32_t)slot;
+			}
+			for (bit = 0; bit < ROLLUP_BITS; bit++)
+			{
+				if (state & (1 << bit))
+				{
+					bucket->onMs[bit] += (uint32_t)(end - t);
+				}
+			}
+			t = end;
+		}
+	}
+}
+
+/*
+ * rollupUpdate:
+ *	Account the time spent in the previous state and switch to <state>
+ *********************************************************************************
+ */
+int rollupUpdate(uint8_t board, uint8_t state, uint64_t ms)
+{
+	RollupBoardType* b = NULL;
+	int level = 0;
+
+	if (gRollup == NULL || board >= BOARD_NR_MAX)
+	{
+		return ERROR;
+	}
+	b = &gRollup->board[board];
+	if (!b->valid)
+	{
+		b->firstMs = ms;
+		b->lastMs = ms;
+		// the buckets before firstMs are never read, the one holding it may
+		// be left from before a reset
+		for (level = 0; level < ROLLUP_LEVELS; level++)
+		{
+			memset(bucketGet(b, level, ms / gLevels[level].res), 0, sizeof(RollupBucketType));
+		}
+	}
+	if (b->resume) // the downtime is not credited to the last known state
+	{
+		b->lastMs = ms;
+		b->resume = 0;
+	}
+	if (ms > b->lastMs)
+	{
+		accrue(b, b->state, b->lastMs, ms);
+		b->lastMs = ms;
+	}
+	b->state = state;
+	b->valid = 1;
+	return OK;
+}
+
+/*
+ * rollupOnTime:
+ *	On time of state <bit> since <sinceMs> (minute resolution) and the
+ *	covered time span. Full days and hours are taken from the coarse levels
+ *	so the cost does not depend on the number of recorded changes.
+ *	<nowMs> = 0 ends the span at the last sample (no daemon running).
+ *********************************************************************************
+ */
+int rollupOnTime(uint8_t board, int bit, uint64_t sinceMs, uint64_t nowMs,
+	uint64_t* onMs, uint64_t* spanMs)
+{
+	RollupBoardType* b = NULL;
+	RollupBucketType* bucket = NULL;
+	uint64_t t = 0;
+	uint64_t res = 0;
+	uint64_t sum = 0;
+	int level = 0;
+
+	if (gRollup == NULL || board >= BOARD_NR_MAX || bit < 0 || bit >= ROLLUP_BITS
+		|| onMs == NULL || spanMs == NULL)
+	{
+		return ERROR;
+	}
+	b = &gRollup->board[board];
+	if (!b->valid)
+	{
+		return ERROR;
+	}
+	sinceMs -= sinceMs % ROLLUP_MINUTE_MS; // the buckets and the span start together
+	if (sinceMs < b->firstMs)
+	{
+		sinceMs = b->firstMs;
+	}
+	if (nowMs < b->lastMs)
+	{
+		nowMs = b->lastMs;
+	}
+	if (sinceMs > nowMs)
+	{
+		sinceMs = nowMs;
+	}
+	t = sinceMs - sinceMs % ROLLUP_MINUTE_MS;
+	while (t < b->lastMs)
+	{
+		for (level = 0; level < ROLLUP_LEVELS; level++)
+		{
+			res = gLevels[level].res;
+			if ( (t % res) == 0 && (t + res <= b->lastMs || level == ROLLUP_LEVELS - 1))
+			{
+				break;
+			}
+		}
+		bucket = bucketGet(b, level, t / res);
+		if (bucket->slot == (uint32_t)(t / res))
+		{
+			sum += bucket->onMs[bit];
+		}
+		t += res;
+	}
+	if (b->state & (1 << bit))
+	{
+		sum += nowMs - (sinceMs > b->lastMs ? sinceMs : b->lastMs);
+	}
+	*onMs = sum;
+	*spanMs = nowMs - sinceMs;
+	return OK;
+}
@@ -0,0 +1,23 @@
+#ifndef ROLLUP_H_
+#define ROLLUP_H_
+
+#include <stdint.h>
+#include "mmfile.h"
+
+#define ROLLUP_FILE		STATE_DIR "/rollup.dat"
+
+#define ROLLUP_MINUTE_MS	60000ULL
+#define ROLLUP_HOUR_MS		(60 * ROLLUP_MINUTE_MS)
+#define ROLLUP_DAY_MS		(24 * ROLLUP_HOUR_MS)
+
+#define ROLLUP_MINUTE_SLOTS	1440	// one day
+#define ROLLUP_HOUR_SLOTS	744		// 31 days
+#define ROLLUP_DAY_SLOTS	366		// one year
+
+int rollupOpen(int writable);
+void rollupClose(void);
+int rollupUpdate(uint8_t board, uint8_t state, uint64_t ms);
+int rollupOnTime(uint8_t board, int bit, uint64_t sinceMs, uint64_t nowMs,
+	uint64_t* onMs, uint64_t* spanMs);
+
+#endif //ROLLUP_H_
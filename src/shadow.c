@@ -0,0 +1,158 @@
+/*
+ * shadow.c:
+ *	Last known output port value of every board, shared by all processes.
+ *	Updated on every read and write of the port so that writes of the
+ *	value already present can be skipped. An entry is trusted only for
+ *	SHADOW_REFRESH_MS to catch changes made by other programs.
+ *	Every write also leaves the expected value for the daemon, which checks
+ *	it against its next sample instead of the writer reading the port back.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+
+#include "relay.h"
+#include "shadow.h"
+
+typedef struct
+{
+	uint64_t timeMs;	// 0 = unknown
+	uint8_t out;
+	uint8_t expect;
+	uint8_t pending;	// expect not verified yet
+	uint8_t retries;
+	uint32_t expectMs;	// low 32 bits of the time the expected value was written
+} ShadowEntryType;
+
+typedef struct
+{
+	ShadowEntryType board[BOARD_NR_MAX];
+} ShadowFileType;
+
+static ShadowFileType* gShadow = NULL;
+static int gShadowFailed = 0;
+
+static int shadowOpen(void)
+{
+	if (gShadow != NULL)
+	{
+		return OK;
+	}
+	if (gShadowFailed || 0 != mmDirCreate(RUN_DIR))
+	{
+		gShadowFailed = 1;
+		return ERROR;
+	}
+	gShadow = mmFileOpen(SHADOW_FILE, sizeof(ShadowFileType), 1);
+	if (gShadow == NULL)
+	{
+		gShadowFailed = 1;
+		return ERROR;
+	}
+	return OK;
+}
+
+/*
+ * shadowGet:
+ *	OK if the shadow of <id> is recent enough to skip a bus access
+ *********************************************************************************
+ */
+int shadowGet(int id, uint8_t* out, uint64_t nowMs)
+{
+	ShadowEntryType* e = NULL;
+	uint64_t t = 0;
+
+	if (id < 0 || id >= BOARD_NR_MAX || OK != shadowOpen())
+	{
+		return ERROR;
+	}
+	e = &gShadow->board[id];
+	t = __atomic_load_n(&e->timeMs, __ATOMIC_ACQUIRE);
+	if (t == 0 || nowMs < t || nowMs - t >= SHADOW_REFRESH_MS)
+	{
+		return ERROR;
+	}
+	*out = __atomic_load_n(&e->out, __ATOMIC_RELAXED);
+	return OK;
+}
+
+void shadowSet(int id, uint8_t out, uint64_t ms)
+{
+	ShadowEntryType* e = NULL;
+
+	if (id < 0 || id >= BOARD_NR_MAX || OK != shadowOpen())
+	{
+		return;
+	}
+	e = &gShadow->board[id];
+	__atomic_store_n(&e->out, out, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->timeMs, ms, __ATOMIC_RELEASE);
+}
+
+/*
+ * shadowExpect:
+ *	Record the value the output port must have since <ms> (taken after the
+ *	write), to be verified by the first sample read after it
+ *********************************************************************************
+ */
+void shadowExpect(int id, uint8_t out, uint64_t ms)
+{
+	ShadowEntryType* e = NULL;
+
+	if (id < 0 || id >= BOARD_NR_MAX || OK != shadowOpen())
+	{
+		return;
+	}
+	e = &gShadow->board[id];
+	__atomic_store_n(&e->expect, out, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->retries, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->expectMs, (uint32_t)ms, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->pending, 1, __ATOMIC_RELEASE);
+}
+
+void shadowWritten(int id, uint8_t out, uint64_t ms)
+{
+	shadowExpect(id, out, ms);
+	shadowSet(id, out, ms);
+}
+
+/*
+ * shadowVerify:
+ *	Check a sampled output port value, read from <sampleMs> on, against the
+ *	pending write. A write made after the sample started is left for the
+ *	next sample. On mismatch the value to rewrite is returned in <expect>,
+ *	the pending write is dropped after RETRY_TIMES mismatches.
+ *********************************************************************************
+ */
+int shadowVerify(int id, uint8_t out, uint64_t sampleMs, uint8_t* expect)
+{
+	ShadowEntryType* e = NULL;
+
+	if (id < 0 || id >= BOARD_NR_MAX || OK != shadowOpen())
+	{
+		return SHADOW_VERIFY_OK;
+	}
+	e = &gShadow->board[id];
+	if (!__atomic_load_n(&e->pending, __ATOMIC_ACQUIRE))
+	{
+		return SHADOW_VERIFY_OK;
+	}
+	*expect = __atomic_load_n(&e->expect, __ATOMIC_RELAXED);
+	if ((int32_t)((uint32_t)sampleMs - __atomic_load_n(&e->expectMs, __ATOMIC_RELAXED)) <= 0)
+	{
+		return SHADOW_VERIFY_NEWER;
+	}
+	if (*expect == out)
+	{
+		__atomic_store_n(&e->pending, 0, __ATOMIC_RELEASE);
+		return SHADOW_VERIFY_OK;
+	}
+	if (++e->retries > RETRY_TIMES)
+	{
+		__atomic_store_n(&e->pending, 0, __ATOMIC_RELEASE);
+		return SHADOW_VERIFY_FAIL;
+	}
+	return SHADOW_VERIFY_REWRITE;
+}
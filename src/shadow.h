@@ -0,0 +1,22 @@
+#ifndef SHADOW_H_
+#define SHADOW_H_
+
+#include <stdint.h>
+#include "mmfile.h"
+
+#define SHADOW_FILE			RUN_DIR "/shadow"
+#define SHADOW_REFRESH_MS	1000	// trust the shadow at most this long, then write anyway
+
+// shadowVerify() results
+#define SHADOW_VERIFY_OK		0
+#define SHADOW_VERIFY_REWRITE	1	// mismatch, write <expect> again
+#define SHADOW_VERIFY_FAIL		-1	// still wrong after RETRY_TIMES rewrites
+#define SHADOW_VERIFY_NEWER		2	// the write is not older than the sample, check the next one
+
+int shadowGet(int id, uint8_t* out, uint64_t nowMs);
+void shadowSet(int id, uint8_t out, uint64_t ms);
+void shadowExpect(int id, uint8_t out, uint64_t ms);
+void shadowWritten(int id, uint8_t out, uint64_t ms);
+int shadowVerify(int id, uint8_t out, uint64_t sampleMs, uint8_t* expect);
+
+#endif //SHADOW_H_
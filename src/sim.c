@@ -0,0 +1,270 @@
+/*
+ * sim.c:
+ *	Simulated I2C adapters, used instead of /dev/i2c-* when the SM4RELIND_SIM
+ *	environment variable lists the boards to simulate (board ids as on the
+ *	command line). The expanders (PCA9534 register model) and the muxes
+ *	configured in /etc/4relind.conf live in a memory mapped file so the
+ *	state survives between commands and is shared with the daemon. Every
+ *	transfer and mux control write is counted, SM4RELIND_SIM_DELAY_US adds
+ *	a bus time to every transfer.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "relay.h"
+#include "config.h"
+#include "mux.h"
+#include "sim.h"
+
+#define SIM_MAGIC		0x31535234	// "4RS1"
+#define SIM_ADDR_MAX	128
+#define SIM_TOPO_MAX	256
+
+typedef struct
+{
+	uint8_t present;
+	uint8_t ptr;		// register pointer
+	uint8_t pins;		// level of the input pins
+	uint8_t reg[4];		// INPORT (unused), OUTPORT, POLINV, CFG
+	uint8_t reserved;
+} SimDevType;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t reserved;
+	char topo[SIM_TOPO_MAX];	// SM4RELIND_SIM value the file was built for
+	uint8_t mux[I2C_BUS_NR_MAX][MUX_PER_BUS];	// mux control registers by adapter
+	SimDevType dev[I2C_BUS_NR_MAX][SIM_ADDR_MAX];	// expanders by (logical) bus
+	uint64_t transfers[I2C_BUS_NR_MAX];
+	uint64_t muxWrites[I2C_BUS_NR_MAX];
+} SimFileType;
+
+static SimFileType* gSim = NULL;
+static pthread_once_t gSimOnce = PTHREAD_ONCE_INIT;
+static int gSimDelayUs = 0;
+
+static void simDevReset(SimDevType* dev)
+{
+	memset(dev, 0, sizeof(SimDevType));
+	dev->present = 1;
+	dev->pins = 0x0f;	// opto inputs idle (active low)
+	dev->reg[RELAY8_OUTPORT_REG_ADD] = 0xff;	// PCA9534 power on values
+	dev->reg[RELAY8_CFG_REG_ADD] = 0xff;
+}
+
+static void simOpen(void)
+{
+	const char* topo = getenv(SIM_ENV);
+	char buff[SIM_TOPO_MAX];
+	char* tok = NULL;
+	char* save = NULL;
+	int id = 0;
+
+	if (topo == NULL || 0 != mmDirCreate(RUN_DIR))
+	{
+		return;
+	}
+	if (getenv(SIM_DELAY_ENV) != NULL)
+	{
+		gSimDelayUs = atoi(getenv(SIM_DELAY_ENV));
+	}
+	gSim = mmFileOpen(SIM_FILE, sizeof(SimFileType), 1);
+	if (gSim == NULL)
+	{
+		printf("Fail to open %s\n", mmPath(SIM_FILE));
+		return;
+	}
+	if (gSim->magic == SIM_MAGIC && strncmp(gSim->topo, topo, SIM_TOPO_MAX) == 0)
+	{
+		return;
+	}
+	memset(gSim, 0, sizeof(SimFileType));
+	strncpy(gSim->topo, topo, SIM_TOPO_MAX - 1);
+	strncpy(buff, topo, sizeof(buff) - 1);
+	buff[sizeof(buff) - 1] = 0;
+	for (tok = strtok_r(buff, " ,", &save); tok != NULL;
+		tok = strtok_r(NULL, " ,", &save))
+	{
+		id = boardIdParse(tok);
+		if (id < 0)
+		{
+			printf("%s: invalid board id \"%s\"\n", SIM_ENV, tok);
+			continue;
+		}
+		simDevReset(&gSim->dev[BOARD_BUS(id)][boardAddrGet(BOARD_STACK(id))]);
+	}
+	gSim->magic = SIM_MAGIC;
+}
+
+int simEnabled(void)
+{
+	pthread_once(&gSimOnce, simOpen);
+	return gSim != NULL;
+}
+
+/*
+ * simMuxGet:
+ *	Control register of the mux at <addr> on <adapter>, NULL if none is
+ *	configured there
+ *********************************************************************************
+ */
+static uint8_t* simMuxGet(int adapter, int addr)
+{
+	ConfigMuxType mux;
+	int bus = 0;
+
+	for (bus = 0; bus < I2C_BUS_NR_MAX; bus++)
+	{
+		if (OK == configMuxGet(bus, &mux) && mux.parent == adapter && mux.addr == addr)
+		{
+			return &gSim->mux[adapter][addr - MUX_ADDR_BASE];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * simDevGet:
+ *	Expander answering at <addr> on <adapter>: on the adapter itself or
+ *	behind a selected mux channel. NULL if none or more than one answer.
+ *********************************************************************************
+ */
+static SimDevType* simDevGet(int adapter, int addr)
+{
+	SimDevType* dev = NULL;
+	ConfigMuxType mux;
+	int bus = 0;
+	int cnt = 0;
+
+	if (gSim->dev[adapter][addr].present)
+	{
+		dev = &gSim->dev[adapter][addr];
+		cnt++;
+	}
+	for (bus = 0; bus < I2C_BUS_NR_MAX; bus++)
+	{
+		if (OK == configMuxGet(bus, &mux) && mux.parent == adapter
+			&& (gSim->mux[adapter][mux.addr - MUX_ADDR_BASE] & (1 << mux.channel))
+			&& gSim->dev[bus][addr].present)
+		{
+			dev = &gSim->dev[bus][addr];
+			cnt++;
+		}
+	}
+	return (cnt == 1) ? dev : NULL;
+}
+
+static uint8_t simRegRead(SimDevType* dev)
+{
+	uint8_t cfg = dev->reg[RELAY8_CFG_REG_ADD];
+
+	if ( (dev->ptr & 0x03) == RELAY8_INPORT_REG_ADD)
+	{
+		return (dev->reg[RELAY8_OUTPORT_REG_ADD] & ~cfg)
+			| ( (dev->pins ^ dev->reg[RELAY8_POLINV_REG_ADD]) & cfg);
+	}
+	return dev->reg[dev->ptr & 0x03];
+}
+
+/*
+ * simTransfer:
+ *	Run the messages of one transfer on <adapter>, stop at the first one not
+ *	acknowledged. Return 0 if all were, -1 otherwise
+ *********************************************************************************
+ */
+int simTransfer(int adapter, struct i2c_msg* msgs, int n)
+{
+	SimDevType* dev = NULL;
+	uint8_t* mux = NULL;
+	int i = 0;
+	int k = 0;
+
+	if (!simEnabled() || adapter < 0 || adapter >= I2C_BUS_NR_MAX)
+	{
+		return -1;
+	}
+	__atomic_fetch_add(&gSim->transfers[adapter], 1, __ATOMIC_RELAXED);
+	if (gSimDelayUs > 0)
+	{
+		usleep(gSimDelayUs);
+	}
+	for (i = 0; i < n; i++)
+	{
+		if (msgs[i].addr >= SIM_ADDR_MAX)
+		{
+			return -1;
+		}
+		mux = simMuxGet(adapter, msgs[i].addr);
+		if (mux != NULL)
+		{
+			if (msgs[i].flags & I2C_M_RD)
+			{
+				memset(msgs[i].buf, *mux, msgs[i].len);
+			}
+			else if (msgs[i].len > 0)
+			{
+				*mux = msgs[i].buf[msgs[i].len - 1];
+				__atomic_fetch_add(&gSim->muxWrites[adapter], 1, __ATOMIC_RELAXED);
+			}
+			continue;
+		}
+		dev = simDevGet(adapter, msgs[i].addr);
+		if (dev == NULL)
+		{
+			return -1;
+		}
+		if (msgs[i].flags & I2C_M_RD)
+		{
+			for (k = 0; k < msgs[i].len; k++)
+			{
+				msgs[i].buf[k] = simRegRead(dev);
+			}
+		}
+		else if (msgs[i].len > 0)
+		{
+			dev->ptr = msgs[i].buf[0];
+			for (k = 1; k < msgs[i].len; k++)
+			{
+				if ( (dev->ptr & 0x03) != RELAY8_INPORT_REG_ADD)
+				{
+					dev->reg[dev->ptr & 0x03] = msgs[i].buf[k];
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+void simMetricsPrint(FILE* out)
+{
+	int bus = 0;
+
+	if (!simEnabled())
+	{
+		return;
+	}
+	fprintf(out, "# HELP sm4relind_sim_transfers_total Transfers run on the simulated adapter\n");
+	fprintf(out, "# TYPE sm4relind_sim_transfers_total counter\n");
+	fprintf(out, "# HELP sm4relind_sim_mux_writes_total Mux control writes seen by the simulated adapter\n");
+	fprintf(out, "# TYPE sm4relind_sim_mux_writes_total counter\n");
+	for (bus = 0; bus < I2C_BUS_NR_MAX; bus++)
+	{
+		if (gSim->transfers[bus] == 0)
+		{
+			continue;
+		}
+		fprintf(out, "sm4relind_sim_transfers_total{bus=\"%d\"} %llu\n", bus,
+			(unsigned long long)gSim->transfers[bus]);
+		fprintf(out, "sm4relind_sim_mux_writes_total{bus=\"%d\"} %llu\n", bus,
+			(unsigned long long)gSim->muxWrites[bus]);
+	}
+}
@@ -0,0 +1,16 @@
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdio.h>
+#include <linux/i2c.h>
+#include "mmfile.h"
+
+#define SIM_ENV		"SM4RELIND_SIM"	// board ids to simulate, e.g. "0 1 3.2"
+#define SIM_DELAY_ENV	"SM4RELIND_SIM_DELAY_US"	// bus time of one transfer
+#define SIM_FILE	RUN_DIR "/sim"
+
+int simEnabled(void);
+int simTransfer(int adapter, struct i2c_msg* msgs, int n);
+void simMetricsPrint(FILE* out);
+
+#endif //SIM_H_
@@ -2,6 +2,7 @@
 #include <string.h>
 #include <termios.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "thread.h"
 
@@ -106,3 +107,17 @@ void busyWait(int ms)
 
   nanosleep (&sleeper, &dummy) ;
 }
+
+/*
+ * timeMsGet:
+ *	Wall clock time in milliseconds since the epoch
+ *********************************************************************************
+ */
+
+uint64_t timeMsGet(void)
+{
+  struct timespec ts ;
+
+  clock_gettime (CLOCK_REALTIME, &ts) ;
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 ;
+}
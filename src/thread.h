@@ -1,6 +1,8 @@
 #ifndef _THREAD_H_
 #define _THREAD_H_
 
+#include <stdint.h>
+
 #define	COUNT_KEY	0
 #define YES		1
 #define NO		2
@@ -10,6 +12,7 @@
 
 
 void busyWait(int ms);
+uint64_t timeMsGet(void);
 void startThread(void);
 int checkThreadResult(void);
 
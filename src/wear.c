@@ -0,0 +1,250 @@
+/*
+ * wear.c:
+ *	Persistent relay switching counters and accumulated on time.
+ *	Every process writing the output port accounts the transitions it sees
+ *	against the last recorded state, kept in a shared memory mapped file.
+ *	The state is swapped atomically so a transition is counted only once
+ *	even if several writers (or the daemon) observe it.
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "relay.h"
+#include "thread.h"
+#include "wear.h"
+
+#define WEAR_MAGIC	0x31575234	// "4RW1"
+
+typedef struct
+{
+	uint64_t switches;
+	uint64_t onMs;
+	uint64_t onSinceMs;
+} WearChType;
+
+typedef struct
+{
+	uint8_t state;
+	uint8_t valid;
+	uint8_t reserved[6];
+	WearChType ch[RELAY_CH_NR_MAX];
+} WearBoardType;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t reserved;
+	uint64_t limitSwitches;	// 0 = no warning
+	uint64_t limitOnHours;	// 0 = no warning
+	WearBoardType board[BOARD_NR_MAX];
+} WearFileType;
+
+static WearFileType* gWear = NULL;
+static int gWearFailed = 0;
+
+static int wearOpen(void)
+{
+	if (gWear != NULL)
+	{
+		return OK;
+	}
+	if (gWearFailed || 0 != mmDirCreate(STATE_DIR))
+	{
+		gWearFailed = 1;
+		return ERROR;
+	}
+	gWear = mmFileOpen(WEAR_FILE, sizeof(WearFileType), 1);
+	if (gWear == NULL)
+	{
+		gWearFailed = 1;
+		return ERROR;
+	}
+	if (__atomic_load_n(&gWear->magic, __ATOMIC_ACQUIRE) != WEAR_MAGIC)
+	{
+		memset(gWear, 0, sizeof(WearFileType));
+		__atomic_store_n(&gWear->magic, WEAR_MAGIC, __ATOMIC_RELEASE);
+	}
+	return OK;
+}
+
+static int limitReached(WearChType* ch, uint64_t onMs)
+{
+	return (gWear->limitSwitches && ch->switches >= gWear->limitSwitches)
+		|| (gWear->limitOnHours && onMs >= gWear->limitOnHours * 3600000ULL);
+}
+
+/*
+ * wearRecord:
+ *	Account the relay transitions from the last recorded state to <relays>
+ *	Print a warning when a relay crosses the configured limits
+ *********************************************************************************
+ */
+int wearRecord(int id, uint8_t relays, uint64_t ms)
+{
+	WearBoardType* b = NULL;
+	WearChType* ch = NULL;
+	uint8_t old = 0;
+	uint8_t changed = 0;
+	uint64_t since = 0;
+	uint64_t onMs = 0;
+	uint64_t limitMs = 0;
+	uint64_t sw = 0;
+	int crossed = 0;
+	int i = 0;
+
+	if ( (id < 0) || (id >= BOARD_NR_MAX) || OK != wearOpen())
+	{
+		return ERROR;
+	}
+	b = &gWear->board[id];
+	relays &= (1 << RELAY_CH_NR_MAX) - 1;
+	old = __atomic_exchange_n(&b->state, relays, __ATOMIC_ACQ_REL);
+	if (!__atomic_exchange_n(&b->valid, 1, __ATOMIC_ACQ_REL))
+	{
+		old = relays; // first record, previous state unknown
+		for (i = 0; i < RELAY_CH_NR_MAX; i++)
+		{
+			if (relays & (1 << i))
+			{
+				__atomic_store_n(&b->ch[i].onSinceMs, ms, __ATOMIC_RELAXED);
+			}
+		}
+	}
+	changed = old ^ relays;
+	for (i = 0; i < RELAY_CH_NR_MAX; i++)
+	{
+		if ( (changed & (1 << i)) == 0)
+		{
+			continue;
+		}
+		ch = &b->ch[i];
+		sw = __atomic_add_fetch(&ch->switches, 1, __ATOMIC_RELAXED);
+		crossed = (gWear->limitSwitches != 0) && (sw == gWear->limitSwitches);
+		if (relays & (1 << i))
+		{
+			__atomic_store_n(&ch->onSinceMs, ms, __ATOMIC_RELAXED);
+		}
+		else
+		{
+			since = __atomic_exchange_n(&ch->onSinceMs, 0, __ATOMIC_RELAXED);
+			if (since != 0 && ms > since)
+			{
+				onMs = __atomic_add_fetch(&ch->onMs, ms - since, __ATOMIC_RELAXED);
+				limitMs = gWear->limitOnHours * 3600000ULL;
+				crossed |= (limitMs != 0) && (onMs >= limitMs)
+					&& (onMs - (ms - since) < limitMs);
+			}
+		}
+		if (crossed)
+		{
+			printf("Warning: relay #%d on board #%s reached the wear limit\n",
+				i + 1, boardIdStr(id));
+		}
+	}
+	return OK;
+}
+
+int wearGet(int id, int ch, uint64_t nowMs, WearInfoType* info)
+{
+	WearChType* c = NULL;
+	uint64_t since = 0;
+
+	if ( (id < 0) || (id >= BOARD_NR_MAX) || (ch < CHANNEL_NR_MIN)
+		|| (ch > RELAY_CH_NR_MAX) || info == NULL || OK != wearOpen())
+	{
+		return ERROR;
+	}
+	c = &gWear->board[id].ch[ch - 1];
+	info->switches = __atomic_load_n(&c->switches, __ATOMIC_RELAXED);
+	info->onMs = __atomic_load_n(&c->onMs, __ATOMIC_RELAXED);
+	since = __atomic_load_n(&c->onSinceMs, __ATOMIC_RELAXED);
+	if (since != 0 && nowMs > since)
+	{
+		info->onMs += nowMs - since;
+	}
+	info->warning = limitReached(c, info->onMs);
+	return OK;
+}
+
+int wearReset(int id, int ch)
+{
+	WearChType* c = NULL;
+	uint8_t state = 0;
+
+	if ( (id < 0) || (id >= BOARD_NR_MAX) || (ch < CHANNEL_NR_MIN)
+		|| (ch > RELAY_CH_NR_MAX) || OK != wearOpen())
+	{
+		return ERROR;
+	}
+	c = &gWear->board[id].ch[ch - 1];
+	state = __atomic_load_n(&gWear->board[id].state, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->switches, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->onMs, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->onSinceMs, (state & (1 << (ch - 1))) ? timeMsGet() : 0,
+	__ATOMIC_RELAXED);
+	return OK;
+}
+
+int wearLimitSet(uint64_t switches, uint64_t onHours)
+{
+	if (OK != wearOpen())
+	{
+		return ERROR;
+	}
+	gWear->limitSwitches = switches;
+	gWear->limitOnHours = onHours;
+	return OK;
+}
+
+int wearLimitGet(uint64_t* switches, uint64_t* onHours)
+{
+	if (OK != wearOpen())
+	{
+		return ERROR;
+	}
+	*switches = gWear->limitSwitches;
+	*onHours = gWear->limitOnHours;
+	return OK;
+}
+
+/*
+ * wearMetricsPrint:
+ *	Counters in Prometheus text exposition format
+ *********************************************************************************
+ */
+void wearMetricsPrint(FILE* out)
+{
+	WearInfoType info;
+	uint64_t now = timeMsGet();
+	int id = 0;
+	int ch = 0;
+
+	if (OK != wearOpen())
+	{
+		return;
+	}
+	fprintf(out, "# TYPE sm4relind_relay_switches_total counter\n");
+	fprintf(out, "# TYPE sm4relind_relay_on_seconds_total counter\n");
+	fprintf(out, "# TYPE sm4relind_relay_wear_warning gauge\n");
+	for (id = 0; id < BOARD_NR_MAX; id++)
+	{
+		if (!gWear->board[id].valid)
+		{
+			continue;
+		}
+		for (ch = CHANNEL_NR_MIN; ch <= RELAY_CH_NR_MAX; ch++)
+		{
+			wearGet(id, ch, now, &info);
+			fprintf(out, "sm4relind_relay_switches_total{bus=\"%d\",stack=\"%d\",relay=\"%d\"} %llu\n",
+				BOARD_BUS(id), BOARD_STACK(id), ch, (unsigned long long)info.switches);
+			fprintf(out, "sm4relind_relay_on_seconds_total{bus=\"%d\",stack=\"%d\",relay=\"%d\"} %.3f\n",
+				BOARD_BUS(id), BOARD_STACK(id), ch, info.onMs / 1000.0);
+			fprintf(out, "sm4relind_relay_wear_warning{bus=\"%d\",stack=\"%d\",relay=\"%d\"} %d\n",
+				BOARD_BUS(id), BOARD_STACK(id), ch, info.warning);
+		}
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef WEAR_H_
+#define WEAR_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "mmfile.h"
+
+#define WEAR_FILE	STATE_DIR "/wear.dat"
+
+typedef struct
+{
+	uint64_t switches;
+	uint64_t onMs;
+	int warning;
+} WearInfoType;
+
+int wearRecord(int id, uint8_t relays, uint64_t ms);
+int wearGet(int id, int ch, uint64_t nowMs, WearInfoType* info);
+int wearReset(int id, int ch);
+int wearLimitSet(uint64_t switches, uint64_t onHours);
+int wearLimitGet(uint64_t* switches, uint64_t* onHours);
+void wearMetricsPrint(FILE* out);
+
+#endif //WEAR_H_
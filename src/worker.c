@@ -0,0 +1,177 @@
+/*
+ * worker.c:
+ *	One worker thread and job queue per I2C adapter. The jobs of a bus run
+ *	in order on its worker, the adapters run in parallel. The buses behind a
+ *	mux share the worker of their adapter, which runs the queued jobs of the
+ *	current mux channel before switching to another. The jobs should only
+ *	do bus transfers (comm layer) and leave the results in their argument,
+ *	the submitter applies them after workerWait().
+ *
+ *	Copyright (c) 2016-2021 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <pthread.h>
+
+#include "relay.h"
+#include "mux.h"
+#include "worker.h"
+
+typedef struct
+{
+	WorkerJobType job;
+	void* arg;
+	int bus;
+} WorkerItemType;
+
+typedef struct
+{
+	pthread_t thread;
+	pthread_cond_t cond;
+	int started;
+	int stop;
+	int cnt;
+	int lastBus;
+	WorkerItemType queue[WORKER_QUEUE_LEN];
+} BusWorkerType;
+
+static BusWorkerType gWorkers[I2C_BUS_NR_MAX];
+static pthread_mutex_t gLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gDone = PTHREAD_COND_INITIALIZER;
+static int gPending = 0;
+
+/*
+ * workerPop:
+ *	Oldest job of the bus served last (no mux channel switch), else the
+ *	oldest job. Jobs of the same bus keep their order.
+ *********************************************************************************
+ */
+static WorkerItemType workerPop(BusWorkerType* w)
+{
+	WorkerItemType item;
+	int i = 0;
+
+	for (i = 0; i < w->cnt && w->queue[i].bus != w->lastBus; i++)
+		;
+	if (i == w->cnt)
+	{
+		i = 0;
+	}
+	item = w->queue[i];
+	for (; i < w->cnt - 1; i++)
+	{
+		w->queue[i] = w->queue[i + 1];
+	}
+	w->cnt--;
+	w->lastBus = item.bus;
+	return item;
+}
+
+static void* workerLoop(void* arg)
+{
+	BusWorkerType* w = (BusWorkerType*)arg;
+	WorkerItemType item;
+
+	pthread_mutex_lock(&gLock);
+	for (;;)
+	{
+		while (w->cnt == 0 && !w->stop)
+		{
+			pthread_cond_wait(&w->cond, &gLock);
+		}
+		if (w->cnt == 0)
+		{
+			break;
+		}
+		item = workerPop(w);
+		pthread_mutex_unlock(&gLock);
+		item.job(item.arg);
+		pthread_mutex_lock(&gLock);
+		gPending--;
+		pthread_cond_broadcast(&gDone);
+	}
+	pthread_mutex_unlock(&gLock);
+	return NULL;
+}
+
+/*
+ * workerSubmit:
+ *	Queue <job> on the worker of the adapter carrying <bus>, starting the
+ *	worker on first use.
+ *	Block while the queue is full. If the thread can not be created the
+ *	job runs in the caller.
+ *********************************************************************************
+ */
+int workerSubmit(int bus, WorkerJobType job, void* arg)
+{
+	BusWorkerType* w = NULL;
+
+	if (bus < 0 || bus >= I2C_BUS_NR_MAX || job == NULL)
+	{
+		return ERROR;
+	}
+	w = &gWorkers[muxParentGet(bus)];
+	pthread_mutex_lock(&gLock);
+	if (!w->started)
+	{
+		pthread_cond_init(&w->cond, NULL);
+		w->stop = 0;
+		w->lastBus = -1;
+		if (0 != pthread_create(&w->thread, NULL, workerLoop, w))
+		{
+			pthread_mutex_unlock(&gLock);
+			job(arg);
+			return OK;
+		}
+		w->started = 1;
+	}
+	while (w->cnt >= WORKER_QUEUE_LEN)
+	{
+		pthread_cond_wait(&gDone, &gLock);
+	}
+	w->queue[w->cnt].job = job;
+	w->queue[w->cnt].arg = arg;
+	w->queue[w->cnt].bus = bus;
+	w->cnt++;
+	gPending++;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&gLock);
+	return OK;
+}
+
+/*
+ * workerWait:
+ *	Wait until all the submitted jobs are done
+ *********************************************************************************
+ */
+void workerWait(void)
+{
+	pthread_mutex_lock(&gLock);
+	while (gPending > 0)
+	{
+		pthread_cond_wait(&gDone, &gLock);
+	}
+	pthread_mutex_unlock(&gLock);
+}
+
+void workerStopAll(void)
+{
+	int bus = 0;
+
+	for (bus = 0; bus < I2C_BUS_NR_MAX; bus++)
+	{
+		pthread_mutex_lock(&gLock);
+		if (!gWorkers[bus].started)
+		{
+			pthread_mutex_unlock(&gLock);
+			continue;
+		}
+		gWorkers[bus].stop = 1;
+		pthread_cond_signal(&gWorkers[bus].cond);
+		pthread_mutex_unlock(&gLock);
+		pthread_join(gWorkers[bus].thread, NULL);
+		pthread_cond_destroy(&gWorkers[bus].cond);
+		gWorkers[bus].started = 0;
+	}
+}
@@ -0,0 +1,12 @@
+#ifndef WORKER_H_
+#define WORKER_H_
+
+#define WORKER_QUEUE_LEN	16	// pending jobs per bus
+
+typedef void (*WorkerJobType)(void* arg);
+
+int workerSubmit(int bus, WorkerJobType job, void* arg);
+void workerWait(void);
+void workerStopAll(void);
+
+#endif //WORKER_H_